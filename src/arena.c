@@ -0,0 +1,79 @@
+#include "arena.h"
+
+void ArenaInit(Arena *arena)
+{
+    assert(arena != NULL);
+
+    memset(arena, 0, sizeof(Arena));
+    arena->freeHead = ARENA_NONE;
+}
+
+void ArenaDestroy(Arena *arena)
+{
+    assert(arena != NULL);
+
+    for (int i = 0; i < arena->chunkCount; i++) {
+        free(arena->chunks[i]);
+    }
+    free(arena->chunks);
+    ArenaInit(arena);
+}
+
+uint32_t ArenaAlloc(Arena *arena)
+{
+    assert(arena != NULL);
+
+    if (arena->freeHead != ARENA_NONE) {
+        uint32_t index = arena->freeHead;
+        memcpy(&arena->freeHead, ArenaPage(arena, index), sizeof(uint32_t));
+        return index;
+    }
+
+    if (arena->pageCount ==
+        (uint32_t)arena->chunkCount * ARENA_CHUNK_PAGES) {
+        if (arena->pageCount >= ARENA_NONE - ARENA_CHUNK_PAGES) {
+            return ARENA_NONE;
+        }
+        if (arena->chunkCount == arena->chunkCapacity) {
+            int capacity = arena->chunkCapacity ? arena->chunkCapacity * 2 : 8;
+            uint8_t **chunks =
+                realloc(arena->chunks, capacity * sizeof(uint8_t *));
+            if (!chunks) {
+                return ARENA_NONE;
+            }
+            arena->chunks = chunks;
+            arena->chunkCapacity = capacity;
+        }
+        uint8_t *chunk = malloc(ARENA_CHUNK_PAGES * ARENA_PAGE_SIZE);
+        if (!chunk) {
+            return ARENA_NONE;
+        }
+        arena->chunks[arena->chunkCount++] = chunk;
+    }
+
+    return arena->pageCount++;
+}
+
+void ArenaRelease(Arena *arena, uint32_t index)
+{
+    assert(arena != NULL);
+    assert(index < arena->pageCount);
+
+    memcpy(ArenaPage(arena, index), &arena->freeHead, sizeof(uint32_t));
+    arena->freeHead = index;
+}
+
+void ArenaReset(Arena *arena)
+{
+    assert(arena != NULL);
+
+    arena->pageCount = 0;
+    arena->freeHead = ARENA_NONE;
+}
+
+size_t ArenaBytes(const Arena *arena)
+{
+    assert(arena != NULL);
+
+    return (size_t)arena->chunkCount * ARENA_CHUNK_PAGES * ARENA_PAGE_SIZE;
+}
@@ -0,0 +1,50 @@
+#ifndef CHIP8_ARENA_H
+#define CHIP8_ARENA_H
+
+// Arena module.
+// Hands out fixed size pages, addressed by index, from large chunks. Pages
+// cost nothing beyond their bytes, and are all freed at once by ArenaReset().
+
+#include "def.h"
+
+#define ARENA_PAGE_SIZE 128
+#define ARENA_CHUNK_PAGES 256
+// Returned by ArenaAlloc() when out of memory.
+#define ARENA_NONE UINT32_MAX
+
+typedef struct tArena {
+    uint8_t **chunks;
+    int chunkCount;
+    int chunkCapacity;
+    // Pages handed out from the chunks so far, freed or not.
+    uint32_t pageCount;
+    // Freed pages, linked through their first four bytes.
+    uint32_t freeHead;
+} Arena;
+
+// ArenaInit() - Initialises an empty arena.
+void ArenaInit(Arena *arena);
+
+// ArenaDestroy() - Frees the arena and every page in it.
+void ArenaDestroy(Arena *arena);
+
+// ArenaAlloc() - Returns the index of a free page, or ARENA_NONE.
+uint32_t ArenaAlloc(Arena *arena);
+
+// ArenaRelease() - Returns a page to the arena.
+void ArenaRelease(Arena *arena, uint32_t index);
+
+// ArenaReset() - Frees every page, keeping the chunks for reuse.
+void ArenaReset(Arena *arena);
+
+// ArenaBytes() - Returns the bytes held by the arena's chunks.
+size_t ArenaBytes(const Arena *arena);
+
+// ArenaPage() - Returns the bytes of a page.
+static inline uint8_t *ArenaPage(const Arena *arena, uint32_t index)
+{
+    return arena->chunks[index / ARENA_CHUNK_PAGES] +
+           (index % ARENA_CHUNK_PAGES) * ARENA_PAGE_SIZE;
+}
+
+#endif // CHIP8_ARENA_H
@@ -0,0 +1,464 @@
+// chip8-batch, runs a manifest of headless jobs across every core.
+//
+// Each manifest line is a job of up to four whitespace separated fields, paths
+// with spaces can be double quoted and # starts a comment:
+//
+//     rom [movie|-] [frames] [quirks]
+//
+// A job with a movie replays its input, seed, cycles per tick and quirks, and
+// checks the hash it ends on when it runs the movie's full length. Frames of 0
+// or left out mean the movie's length, or --frames without one. Quirks take
+// the names VMParseQuirks() does, and given with a movie override its own.
+// Results are written as one JSON object per line, in manifest order.
+
+#include "def.h"
+#include "adc_argp.h"
+#include "movie.h"
+#include "pool.h"
+#include "tool.h"
+#include "vm.h"
+
+#define BATCH_LINE_MAX 4096
+#define BATCH_ERROR_MAX 160
+
+typedef enum {
+    BATCH_REPLAY_NONE,
+    BATCH_REPLAY_MATCH,
+    BATCH_REPLAY_MISMATCH,
+    // The job stopped before the end of the movie, so there is nothing to
+    // compare against.
+    BATCH_REPLAY_PARTIAL
+} BatchReplay;
+
+typedef struct tBatchJob {
+    int line;
+    char *romPath;
+    char *moviePath;
+    uint64_t frames;
+    uint32_t quirks;
+    bool quirksGiven;
+
+    bool failed;
+    char error[BATCH_ERROR_MAX];
+    uint64_t framesRun;
+    uint64_t cycles;
+    uint64_t stateHash;
+    uint64_t displayHash;
+    BatchReplay replay;
+    double wallMs;
+} BatchJob;
+
+typedef struct tBatch {
+    BatchJob *jobs;
+    int jobCount;
+    int jobCapacity;
+    int cyclesPerTick;
+    unsigned int seed;
+    uint64_t frames;
+} Batch;
+
+static char *NextToken(char **cursor);
+static char *CopyString(const char *str);
+static int BatchLoadManifest(Batch *batch, const char *filePath);
+static int BatchParseLine(Batch *batch, char *text, int line);
+static void BatchFree(Batch *batch);
+static void BatchRunJob(void *user, int index, int worker);
+static void WriteResult(FILE *out, const BatchJob *job, int index);
+
+int main(int argc, char *argv[])
+{
+    const char *manifestPath = NULL;
+    const char *outPath = NULL;
+    int threadCount = 0;
+    int cyclesPerTick = 20;
+    unsigned int seed = 1;
+    int frames = 600;
+
+    adc_argp_option opts[] = {
+        ADC_ARGP_HELP(),
+        ADC_ARGP_OPTION("manifest", "m", ADC_ARGP_TYPE_STRING, &manifestPath,
+                        "Manifest of jobs to run, one per line. Required"),
+        ADC_ARGP_OPTION(
+            "out", "o", ADC_ARGP_TYPE_STRING, &outPath,
+            "Write the JSONL results to this file. Defaults to stdout"),
+        ADC_ARGP_OPTION(
+            "threads", "j", ADC_ARGP_TYPE_UINT, &threadCount,
+            "Worker threads. Defaults to 0, one per cpu"),
+        ADC_ARGP_OPTION(
+            "cycles", "c", ADC_ARGP_TYPE_UINT, &cyclesPerTick,
+            "Cycles per tick for jobs without a movie. Defaults to 20"),
+        ADC_ARGP_OPTION(
+            "seed", "s", ADC_ARGP_TYPE_UINT, &seed,
+            "Rng seed for jobs without a movie, 0 seeds from the time. "
+            "Defaults to 1"),
+        ADC_ARGP_OPTION(
+            "frames", "n", ADC_ARGP_TYPE_UINT, &frames,
+            "Ticks to run for jobs with neither frames nor a movie. "
+            "Defaults to 600")
+    };
+
+    adc_argp_parser *parser = adc_argp_new_parser(opts, ADC_ARGP_COUNT(opts));
+    if (!parser) {
+        fprintf(stderr, "Failed to create arg parser\n");
+        return EXIT_FAILURE;
+    }
+    int errors = adc_argp_parse(parser, argc, (const char **)argv);
+    if (errors > 0) {
+        adc_argp_print_errors(parser, stderr);
+    }
+    adc_argp_destroy_parser(&parser);
+    if (errors > 0) {
+        return EXIT_FAILURE;
+    }
+    if (!manifestPath) {
+        fprintf(stderr, "No manifest given, use --manifest!\n");
+        return EXIT_FAILURE;
+    }
+    if (cyclesPerTick <= 0) {
+        fprintf(stderr, "Cycles per tick must be positive!\n");
+        return EXIT_FAILURE;
+    }
+
+    Batch batch = {0};
+    batch.cyclesPerTick = cyclesPerTick;
+    batch.seed = seed;
+    batch.frames = (uint64_t)MAX(frames, 0);
+    if (BatchLoadManifest(&batch, manifestPath) != 0) {
+        BatchFree(&batch);
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = stdout;
+    if (outPath) {
+        out = fopen(outPath, "w");
+        if (!out) {
+            fprintf(stderr, "Failed to open %s for writing!\n", outPath);
+            BatchFree(&batch);
+            return EXIT_FAILURE;
+        }
+    }
+
+    Pool *pool = PoolCreate(threadCount);
+    if (!pool) {
+        if (out != stdout) {
+            fclose(out);
+        }
+        BatchFree(&batch);
+        return EXIT_FAILURE;
+    }
+
+    double start = ToolNowSeconds();
+    PoolRun(pool, batch.jobCount, BatchRunJob, &batch);
+    double elapsed = ToolNowSeconds() - start;
+
+    int failed = 0;
+    int mismatched = 0;
+    double jobSeconds = 0.0;
+    for (int i = 0; i < batch.jobCount; i++) {
+        const BatchJob *job = &batch.jobs[i];
+        WriteResult(out, job, i);
+        failed += job->failed;
+        mismatched += job->replay == BATCH_REPLAY_MISMATCH;
+        jobSeconds += job->wallMs / 1000.0;
+    }
+
+    int result = EXIT_SUCCESS;
+    if (out != stdout && fclose(out) != 0) {
+        fprintf(stderr, "Failed to write %s!\n", outPath);
+        result = EXIT_FAILURE;
+    }
+
+    fprintf(stderr,
+            "Batch finished! %d jobs on %d threads in %.03fs (%.03fs of "
+            "jobs), %d failed, %d replay mismatches\n",
+            batch.jobCount, PoolThreadCount(pool), elapsed, jobSeconds,
+            failed, mismatched);
+
+    PoolDestroy(pool);
+    BatchFree(&batch);
+
+    if (failed > 0 || mismatched > 0) {
+        result = EXIT_FAILURE;
+    }
+    return result;
+}
+
+static void BatchRunJob(void *user, int index, int worker)
+{
+    (void)worker;
+    Batch *batch = user;
+    BatchJob *job = &batch->jobs[index];
+    double start = ToolNowSeconds();
+
+    // A replay takes the seed, cycles, quirks and length from the movie.
+    VM *vm = NULL;
+    Movie movie;
+    bool replay = job->moviePath != NULL;
+    int cyclesPerTick = batch->cyclesPerTick;
+    unsigned int seed = batch->seed;
+    uint64_t frames = job->frames ? job->frames : batch->frames;
+    if (replay) {
+        if (MovieLoad(&movie, job->moviePath) != 0) {
+            snprintf(job->error, sizeof(job->error), "failed to load movie");
+            replay = false;
+            goto error;
+        }
+        cyclesPerTick = movie.cyclesPerTick;
+        seed = movie.seed;
+        frames = job->frames ? job->frames : movie.frames;
+        if (!job->quirksGiven) {
+            job->quirks = movie.quirks;
+        }
+    }
+
+    vm = VMCreate(cyclesPerTick, VMCOLOR_PALETTE_ORIGINAL, seed);
+    if (!vm) {
+        snprintf(job->error, sizeof(job->error), "failed to create the vm");
+        goto error;
+    }
+    VMSetQuirks(vm, job->quirks);
+    if (VMLoadRom(vm, job->romPath) != 0) {
+        snprintf(job->error, sizeof(job->error), "failed to load rom");
+        goto error;
+    }
+    if (replay && movie.romHash != VMGetRomHash(vm)) {
+        snprintf(job->error, sizeof(job->error),
+                 "movie was recorded with a different rom");
+        goto error;
+    }
+
+    int nextEvent = 0;
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        while (replay && nextEvent < movie.eventCount &&
+               movie.events[nextEvent].tick <= frame) {
+            const MovieEvent *event = &movie.events[nextEvent++];
+            VMScheduleKeyAt(vm, event->key, event->pressed, event->tick,
+                            event->cycle);
+        }
+
+        VMTick(vm);
+    }
+
+    job->framesRun = frames;
+    job->cycles = VMGetCycleCount(vm);
+    job->stateHash = VMHashState(vm);
+    job->displayHash = VMHashDisplay(vm);
+    if (replay) {
+        // Running a different length or other quirks cannot end on the
+        // recorded state, so there is nothing to compare.
+        if (frames != movie.frames || job->quirks != movie.quirks) {
+            job->replay = BATCH_REPLAY_PARTIAL;
+        } else if (VMHashMovieState(vm) == movie.finalHash) {
+            job->replay = BATCH_REPLAY_MATCH;
+        } else {
+            job->replay = BATCH_REPLAY_MISMATCH;
+        }
+        MovieFree(&movie);
+    }
+    VMDestroy(vm);
+    job->wallMs = (ToolNowSeconds() - start) * 1000.0;
+    return;
+
+error:
+    job->failed = true;
+    if (replay) {
+        MovieFree(&movie);
+    }
+    VMDestroy(vm);
+    job->wallMs = (ToolNowSeconds() - start) * 1000.0;
+}
+
+static int BatchLoadManifest(Batch *batch, const char *filePath)
+{
+    FILE *file = fopen(filePath, "r");
+    if (!file) {
+        fprintf(stderr, "Failed to open manifest %s!\n", filePath);
+        return -1;
+    }
+
+    char text[BATCH_LINE_MAX];
+    int line = 0;
+    while (fgets(text, sizeof(text), file)) {
+        line++;
+        size_t length = strlen(text);
+        if (length == sizeof(text) - 1 && text[length - 1] != '\n' &&
+            !feof(file)) {
+            fprintf(stderr, "%s:%d: line is too long!\n", filePath, line);
+            goto error;
+        }
+        if (BatchParseLine(batch, text, line) != 0) {
+            fprintf(stderr, "%s:%d: invalid job!\n", filePath, line);
+            goto error;
+        }
+    }
+    if (ferror(file)) {
+        fprintf(stderr, "Failed to read manifest %s!\n", filePath);
+        goto error;
+    }
+    fclose(file);
+
+    if (batch->jobCount == 0) {
+        fprintf(stderr, "Manifest %s has no jobs!\n", filePath);
+        return -1;
+    }
+    return 0;
+
+error:
+    fclose(file);
+    return -1;
+}
+
+static int BatchParseLine(Batch *batch, char *text, int line)
+{
+    // Cut the comment off, unless the # is part of a quoted path.
+    bool quoted = false;
+    for (char *c = text; *c; c++) {
+        if (*c == '"') {
+            quoted = !quoted;
+        } else if (*c == '#' && !quoted) {
+            *c = '\0';
+            break;
+        }
+    }
+
+    char *cursor = text;
+    char *romPath = NextToken(&cursor);
+    char *moviePath = NextToken(&cursor);
+    char *frames = NextToken(&cursor);
+    char *quirks = NextToken(&cursor);
+    if (!romPath) {
+        return 0; // Blank or comment.
+    }
+    if (!cursor || NextToken(&cursor)) {
+        return -1; // Unterminated quote or too many fields.
+    }
+
+    BatchJob job = {0};
+    job.line = line;
+    if (frames) {
+        char *end;
+        job.frames = strtoull(frames, &end, 10);
+        if (*end != '\0' || frames[0] == '-') {
+            return -1;
+        }
+    }
+    if (quirks && VMParseQuirks(quirks, &job.quirks) != 0) {
+        return -1;
+    }
+    job.quirksGiven = quirks != NULL;
+
+    if (batch->jobCount == batch->jobCapacity) {
+        int capacity = batch->jobCapacity ? batch->jobCapacity * 2 : 64;
+        BatchJob *jobs = realloc(batch->jobs, capacity * sizeof(BatchJob));
+        if (!jobs) {
+            return -1;
+        }
+        batch->jobs = jobs;
+        batch->jobCapacity = capacity;
+    }
+
+    job.romPath = CopyString(romPath);
+    if (!job.romPath) {
+        return -1;
+    }
+    if (moviePath && strcmp(moviePath, "-") != 0) {
+        job.moviePath = CopyString(moviePath);
+        if (!job.moviePath) {
+            free(job.romPath);
+            return -1;
+        }
+    }
+    batch->jobs[batch->jobCount++] = job;
+    return 0;
+}
+
+static void BatchFree(Batch *batch)
+{
+    for (int i = 0; i < batch->jobCount; i++) {
+        free(batch->jobs[i].romPath);
+        free(batch->jobs[i].moviePath);
+    }
+    free(batch->jobs);
+    batch->jobs = NULL;
+    batch->jobCount = 0;
+    batch->jobCapacity = 0;
+}
+
+// Returns the next field of the line, NUL terminated in place, or NULL at the
+// end of the line. An unterminated quote sets the cursor to NULL.
+static char *NextToken(char **cursor)
+{
+    char *c = *cursor;
+    if (!c) {
+        return NULL;
+    }
+    while (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n') {
+        c++;
+    }
+    if (*c == '\0') {
+        *cursor = c;
+        return NULL;
+    }
+
+    char *token = c;
+    if (*c == '"') {
+        token = ++c;
+        while (*c != '"' && *c != '\0') {
+            c++;
+        }
+        if (*c != '"') {
+            *cursor = NULL;
+            return NULL;
+        }
+    } else {
+        while (*c != '\0' && *c != ' ' && *c != '\t' && *c != '\r' &&
+               *c != '\n') {
+            c++;
+        }
+    }
+    if (*c != '\0') {
+        *c++ = '\0';
+    }
+
+    *cursor = c;
+    return token;
+}
+
+static char *CopyString(const char *str)
+{
+    size_t size = strlen(str) + 1;
+    char *copy = malloc(size);
+    if (copy) {
+        memcpy(copy, str, size);
+    }
+    return copy;
+}
+
+static void WriteResult(FILE *out, const BatchJob *job, int index)
+{
+    static const char *replayNames[] = {NULL, "match", "mismatch", "partial"};
+    char quirks[128];
+    VMFormatQuirks(job->quirks, quirks, sizeof(quirks));
+
+    fprintf(out, "{\"job\":%d,\"line\":%d,\"rom\":", index, job->line);
+    ToolWriteJsonString(out, job->romPath);
+    fputs(",\"movie\":", out);
+    ToolWriteJsonString(out, job->moviePath);
+    fputs(",\"quirks\":", out);
+    ToolWriteJsonString(out, quirks);
+    if (job->failed) {
+        fputs(",\"error\":", out);
+        ToolWriteJsonString(out, job->error);
+    } else {
+        // Hashes are strings, JSON numbers are doubles to most readers.
+        fprintf(out,
+                ",\"frames\":%llu,\"cycles\":%llu,\"display_hash\":\"%016llx\""
+                ",\"state_hash\":\"%016llx\",\"replay\":",
+                (unsigned long long)job->framesRun,
+                (unsigned long long)job->cycles,
+                (unsigned long long)job->displayHash,
+                (unsigned long long)job->stateHash);
+        ToolWriteJsonString(out, replayNames[job->replay]);
+    }
+    fprintf(out, ",\"wall_ms\":%.3f}\n", job->wallMs);
+}
@@ -1,5 +1,6 @@
 #include "chip8.h"
 
+#include <stddef.h>
 #include <time.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,7 +29,7 @@ typedef union tOpcode {
     struct UXYN uxyn;
 } Opcode;
 
-static uint8_t fontData[16 * 5] = {
+static const uint8_t fontData[16 * 5] = {
     0xF0, 0x90, 0x90, 0x90, 0xF0, // '0'
     0x20, 0x60, 0x20, 0x20, 0x70, // '1'
     0xF0, 0x10, 0xF0, 0x80, 0xF0, // '2'
@@ -47,19 +48,36 @@ static uint8_t fontData[16 * 5] = {
     0xF0, 0x80, 0xF0, 0x80, 0x80, // 'F'
 };
 
+// Addresses past the end of memory, from PC or I, wrap around to its start.
+#define ADDRESS(address) ((address) & 0xFFF)
+
 static Opcode FetchOpcode(Chip8 *chip8);
 static void DecodeAndExecOpcode(Chip8 *chip8, Opcode op);
+static uint8_t NextRandom(Chip8 *chip8);
+static inline uint64_t BlockMask(size_t address, size_t size);
 
-void Chip8Init(Chip8 *chip8)
+void Chip8Init(Chip8 *chip8, unsigned int seed)
 {
-    // Seed the rng.
-    srand(time(NULL));
-
     // Reset all of the CHIP8 memory.
     memset(chip8->memory, 0, 0x1000);
 
+    Chip8Seed(chip8, seed);
+
     // Copy over the font data.
     memcpy(chip8->font, fontData, 16 * 5);
+
+    chip8->dirty = ~(uint64_t)0;
+    chip8->quirks = 0;
+}
+
+void Chip8Seed(Chip8 *chip8, unsigned int seed)
+{
+    // xorshift gets stuck on a zero state.
+    chip8->rng = seed != 0 ? seed : (uint32_t)time(NULL);
+    if (chip8->rng == 0) {
+        chip8->rng = 0x2545F491;
+    }
+    chip8->dirty |= BlockMask(offsetof(Chip8, rng), sizeof(chip8->rng));
 }
 
 void Chip8Cycle(Chip8 *chip8)
@@ -69,6 +87,19 @@ void Chip8Cycle(Chip8 *chip8)
 
     // Decode and execute the instruction.
     DecodeAndExecOpcode(chip8, ins);
+
+    // Nearly every instruction writes a register, so rather than tracking
+    // them one by one, the blocks holding the registers before the display and
+    // those from PC onwards are marked every cycle.
+    chip8->dirty |= BlockMask(0, offsetof(Chip8, display)) |
+                    BlockMask(offsetof(Chip8, PC),
+                              offsetof(Chip8, rng) + sizeof(chip8->rng) -
+                                  offsetof(Chip8, PC));
+}
+
+void Chip8MarkDirty(Chip8 *chip8, size_t address, size_t size)
+{
+    chip8->dirty |= BlockMask(address, size);
 }
 
 bool Chip8WaitingForKey(Chip8 *chip8)
@@ -76,10 +107,125 @@ bool Chip8WaitingForKey(Chip8 *chip8)
     return (chip8->waitingKey.waiting == 1) ? true : false;
 }
 
+bool Chip8IsOpcode(uint16_t op)
+{
+    uint8_t kk = op & 0xFF;
+    uint8_t n = op & 0xF;
+
+    switch (op >> 12) {
+    case 0x0:
+        return op == 0x00E0 || op == 0x00EE;
+    case 0x5:
+    case 0x9:
+        return n == 0;
+    case 0x8:
+        return n <= 0x7 || n == 0xE;
+    case 0xE:
+        return kk == 0x9E || kk == 0xA1;
+    case 0xF:
+        return kk == 0x07 || kk == 0x0A || kk == 0x15 || kk == 0x18 ||
+               kk == 0x1E || kk == 0x29 || kk == 0x33 || kk == 0x55 ||
+               kk == 0x65;
+    default:
+        return true;
+    }
+}
+
+bool Chip8FindDelayLoop(const Chip8 *chip8, Chip8DelayLoop *loop)
+{
+    if (chip8->waitingKey.waiting) {
+        return false;
+    }
+
+    // Run round the loop once on a copy of the registers, noting which way
+    // each compare went.
+    uint8_t V[16];
+    bool equal[CHIP8_DELAY_LOOP_MAX];
+    memcpy(V, chip8->V, sizeof(V));
+    uint16_t pc = chip8->PC;
+    int length = 0;
+    do {
+        if (length == CHIP8_DELAY_LOOP_MAX || pc > CHIP8_USERMEM_END - 1) {
+            return false;
+        }
+        uint16_t op = (chip8->memory[pc] << 8) | chip8->memory[pc + 1];
+        uint8_t x = (op >> 8) & 0xF;
+        uint8_t kk = op & 0xFF;
+        loop->address[length] = pc;
+        loop->reg[length] = -1;
+        pc += 2;
+
+        switch (op >> 12) {
+        case 0x1:
+            pc = op & 0xFFF;
+            break;
+        case 0x3:
+        case 0x4:
+            equal[length] = V[x] == kk;
+            if (equal[length] == (op >> 12 == 0x3)) {
+                pc += 2;
+            }
+            break;
+        case 0x6:
+            V[x] = kk;
+            loop->reg[length] = x;
+            loop->value[length] = kk;
+            break;
+        case 0xF:
+            if (kk != 0x07) {
+                return false;
+            }
+            V[x] = chip8->delayTimer;
+            loop->reg[length] = x;
+            loop->value[length] = -1;
+            break;
+        default:
+            return false;
+        }
+        length++;
+    } while (pc != chip8->PC);
+
+    // Each compare must go the same way for every value its register can hold
+    // while the timer counts down: the one it holds now, the constants the loop
+    // loads into it and, if the loop loads the timer into it, the timer values.
+    // As the timer holds each value only once, a compare may only rely on the
+    // timer not matching, and the loop ends once it does.
+    loop->length = length;
+    loop->exitDelay = -1;
+    for (int i = 0; i < length; i++) {
+        uint16_t address = loop->address[i];
+        uint8_t u = chip8->memory[address] >> 4;
+        uint8_t x = chip8->memory[address] & 0xF;
+        uint8_t kk = chip8->memory[address + 1];
+        if (u != 0x3 && u != 0x4) {
+            continue;
+        }
+        if ((chip8->V[x] == kk) != equal[i]) {
+            return false;
+        }
+        for (int j = 0; j < length; j++) {
+            if (loop->reg[j] != x) {
+                continue;
+            }
+            if (loop->value[j] >= 0) {
+                if ((loop->value[j] == kk) != equal[i]) {
+                    return false;
+                }
+            } else if (equal[i]) {
+                return false;
+            } else if (kk <= chip8->delayTimer) {
+                loop->exitDelay = MAX(loop->exitDelay, kk);
+            }
+        }
+    }
+
+    return true;
+}
+
 static Opcode FetchOpcode(Chip8 *chip8)
 {
-    uint8_t upper = chip8->memory[chip8->PC];
-    uint8_t lower = chip8->memory[chip8->PC + 1];
+    uint8_t upper = chip8->memory[ADDRESS(chip8->PC)];
+    uint8_t lower = chip8->memory[ADDRESS(chip8->PC + 1)];
     uint16_t value = (upper << 8) | lower;
 
     chip8->PC += 2;
@@ -103,6 +249,8 @@ static void DecodeAndExecOpcode(Chip8 *chip8, Opcode op)
     if (op.val == 0x00E0) {
         for (int i = 0; i < ARRAY_LEN(chip8->display); i++)
             display[i] = 0;
+        chip8->dirty |=
+            BlockMask(offsetof(Chip8, display), sizeof(chip8->display));
     }
     // 0x00EE RET - Return from a subroutine.
     if (op.val == 0x00EE) {
@@ -120,6 +268,11 @@ static void DecodeAndExecOpcode(Chip8 *chip8, Opcode op)
         chip8->SP = chip8->SP + 1 % CHIP8_STACK_MAX;
         stack[chip8->SP] = chip8->PC;
         chip8->PC = unnn.nnn;
+        // An overflowing stack writes past the registers.
+        if (chip8->SP >= CHIP8_STACK_MAX) {
+            chip8->dirty |= BlockMask(offsetof(Chip8, stack) + chip8->SP * 2,
+                                      sizeof(uint16_t));
+        }
     }
     // 3xkk SE Vx, byte - Skip next instruction if Vx == kk.
     if (u == 3) {
@@ -154,14 +307,20 @@ static void DecodeAndExecOpcode(Chip8 *chip8, Opcode op)
     // 8xy1 OR Vx, Vy - Performs bitwise OR of Vx and Vy, then stores result in Vx.
     if (u == 8 && (uint8_t)uxyn.n == 1) {
         V[uxyn.x] |= V[uxyn.y];
+        if (chip8->quirks & CHIP8_QUIRK_VF_RESET)
+            V[0xF] = 0;
     }
     // 8xy2 AND Vx, Vy - Performs bitwise AND of Vx and Vy, then stores result in Vx.
     if (u == 8 && (uint8_t)uxyn.n == 2) {
         V[uxyn.x] &= V[uxyn.y];
+        if (chip8->quirks & CHIP8_QUIRK_VF_RESET)
+            V[0xF] = 0;
     }
     // 8xy3 XOR Vx, Vy - Performs bitwise AND of Vx and Vy, then stores result in Vx.
     if (u == 8 && (uint8_t)uxyn.n == 3) {
         V[uxyn.x] ^= V[uxyn.y];
+        if (chip8->quirks & CHIP8_QUIRK_VF_RESET)
+            V[0xF] = 0;
     }
     // 8xy4 ADD Vx, Vy - Adds Vy to Vx. Stores carry flag in VF.
     if (u == 8 && (uint8_t)uxyn.n == 4) {
@@ -175,8 +334,10 @@ static void DecodeAndExecOpcode(Chip8 *chip8, Opcode op)
     }
     // 8xy6 SHR Vx - Stores Vx lsb in VF, then shifts Vx to the right by 1.
     if (u == 8 && (uint8_t)uxyn.n == 6) {
-        V[0xF] = (V[uxyn.x] & (1 << 0));
-        V[uxyn.x] >>= 1;
+        uint8_t src =
+            (chip8->quirks & CHIP8_QUIRK_SHIFT_VY) ? V[uxyn.y] : V[uxyn.x];
+        V[0xF] = (src & (1 << 0));
+        V[uxyn.x] = src >> 1;
     }
     // 8xy7 SUBN Vx, Vy - Subtracts Vx from Vy. Stores borrow flag in VF.
     if (u == 8 && (uint8_t)uxyn.n == 7) {
@@ -185,8 +346,10 @@ static void DecodeAndExecOpcode(Chip8 *chip8, Opcode op)
     }
     // 8xyE SHL Vx - Stores Vx msb in VF, then shifts Vx to the left by 1.
     if (u == 8 && (uint8_t)uxyn.n == 0x0E) {
-        V[0xF] = (V[uxyn.x] & (1 << 7)) ? 1 : 0;
-        V[uxyn.x] <<= 1;
+        uint8_t src =
+            (chip8->quirks & CHIP8_QUIRK_SHIFT_VY) ? V[uxyn.y] : V[uxyn.x];
+        V[0xF] = (src & (1 << 7)) ? 1 : 0;
+        V[uxyn.x] = src << 1;
     }
     // 9xy0 SNE Vx, Vy - Skips the next instruction if Vx != Vy.
     if (u == 9 && (uint8_t)uxyn.n == 0) {
@@ -200,11 +363,12 @@ static void DecodeAndExecOpcode(Chip8 *chip8, Opcode op)
     }
     // Bnnn JP V0, addr - Sets PC to nnn plus the value of V0.
     if (u == 0xB) {
-        chip8->PC = (uint16_t)unnn.nnn + V[0];
+        uint8_t reg = (chip8->quirks & CHIP8_QUIRK_JUMP_VX) ? uxkk.x : 0;
+        chip8->PC = (uint16_t)unnn.nnn + V[reg];
     }
     // Cxkk RND Vx, byte - Stores random number (between 0 and 255) ANDed with kk in Vx.
     if (u == 0xC) {
-        V[uxkk.x] = (rand() % 256) & (uint8_t)uxkk.kk;
+        V[uxkk.x] = NextRandom(chip8) & (uint8_t)uxkk.kk;
     }
     // Dxyn DRW Vx, Vy, nibble - Display n-byte sprite starting at mem location I at (Vx, Vy).
     // Set VF to 1 if collision.
@@ -214,13 +378,22 @@ static void DecodeAndExecOpcode(Chip8 *chip8, Opcode op)
         // Calculate the start and end draw coordinates.
         int startX = V[uxyn.x] % CHIP8_W;
         int startY = V[uxyn.y] % CHIP8_H;
-        int endX = MIN(startX + 8, CHIP8_W);
-        int endY = MIN(startY + uxyn.n, CHIP8_H);
+        bool wrap = (chip8->quirks & CHIP8_QUIRK_SPRITE_WRAP) != 0;
+        int endX = wrap ? startX + 8 : MIN(startX + 8, CHIP8_W);
+        int endY = wrap ? startY + uxyn.n : MIN(startY + uxyn.n, CHIP8_H);
+        if (endY > CHIP8_H) {
+            chip8->dirty |=
+                BlockMask(offsetof(Chip8, display), sizeof(chip8->display));
+        } else {
+            chip8->dirty |= BlockMask(offsetof(Chip8, display) +
+                                          (startY * CHIP8_W) / 8,
+                                      ((endY - startY) * CHIP8_W) / 8);
+        }
 
         // Loop over each row of the sprite.
         for (int yline = startY; yline < endY; yline++) {
             // Get the current byte from sprite.
-            uint8_t spriteB = mem[chip8->I + (yline - startY)];
+            uint8_t spriteB = mem[ADDRESS(chip8->I + (yline - startY))];
             // Loop over each pixel of the sprite and determine if draw needed.
             for (int xline = startX; xline < endX; xline++) {
                 // Get the pixel in sprite byte.
@@ -231,8 +404,9 @@ static void DecodeAndExecOpcode(Chip8 *chip8, Opcode op)
                 if (!spriteP)
                     continue;
 
-                // Get the display byte and pixel.
-                int index = yline * CHIP8_W + xline;
+                // Get the display byte and pixel. Only a wrapping sprite
+                // reaches past the edges.
+                int index = (yline % CHIP8_H) * CHIP8_W + (xline % CHIP8_W);
                 int dispIndx = index / 8;
                 int offset = index % 8;
                 uint8_t dispB = display[dispIndx];
@@ -290,22 +464,63 @@ static void DecodeAndExecOpcode(Chip8 *chip8, Opcode op)
     // Fx33 LD B, Vx - Store BCD representation of Vx in I, I+1, I+2.
     if (u == 0xF && (uint8_t)uxkk.kk == 0x33) {
         uint8_t x = uxkk.x;
-        mem[chip8->I] = V[x] / 100;
-        mem[chip8->I + 1] = (V[x] / 10) % 10;
-        mem[chip8->I + 2] = (V[x] % 10);
+        mem[ADDRESS(chip8->I)] = V[x] / 100;
+        mem[ADDRESS(chip8->I + 1)] = (V[x] / 10) % 10;
+        mem[ADDRESS(chip8->I + 2)] = (V[x] % 10);
+        chip8->dirty |= BlockMask(chip8->I, 3);
     }
     // Fx55 LD [I], Vx - Store registers V0 to Vx in memory locations starting at I.
     if (u == 0xF && (uint8_t)uxkk.kk == 0x55) {
         uint8_t x = uxkk.x;
         for (uint8_t i = 0; i <= x; i++) {
-            mem[chip8->I + i] = V[i];
+            mem[ADDRESS(chip8->I + i)] = V[i];
         }
+        chip8->dirty |= BlockMask(chip8->I, x + 1);
+        if (chip8->quirks & CHIP8_QUIRK_LOAD_STORE_I)
+            chip8->I += x + 1;
     }
     // Fx65 LD [I], Vx - Read registers V0 to Vx from memory locations starting at I.
     if (u == 0xF && (uint8_t)uxkk.kk == 0x65) {
         uint8_t x = uxkk.x;
         for (uint8_t i = 0; i <= x; i++) {
-            V[i] = mem[chip8->I + i];
+            V[i] = mem[ADDRESS(chip8->I + i)];
         }
+        if (chip8->quirks & CHIP8_QUIRK_LOAD_STORE_I)
+            chip8->I += x + 1;
+    }
+}
+
+static uint8_t NextRandom(Chip8 *chip8)
+{
+    uint32_t x = chip8->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    chip8->rng = x;
+
+    // The high bits are the better mixed ones.
+    return (uint8_t)(x >> 24);
+}
+
+// Returns the dirty bits of the blocks holding size bytes from address, which
+// wrap around past the end of memory as ADDRESS() does.
+static inline uint64_t BlockMask(size_t address, size_t size)
+{
+    if (size == 0) {
+        return 0;
     }
+
+    address = ADDRESS(address);
+    uint64_t wrapped = 0;
+    if (address + size > 0x1000) {
+        wrapped = BlockMask(0, address + size - 0x1000);
+    }
+
+    size_t end = MIN(address + size, (size_t)0x1000);
+    size_t first = address / CHIP8_DIRTY_BLOCK_SIZE;
+    size_t last = (end - 1) / CHIP8_DIRTY_BLOCK_SIZE;
+    uint64_t upTo = last == CHIP8_DIRTY_BLOCKS - 1 ?
+                        ~(uint64_t)0 :
+                        ((uint64_t)1 << (last + 1)) - 1;
+    return (upTo & ~(((uint64_t)1 << first) - 1)) | wrapped;
 }
@@ -13,6 +13,25 @@
 #define CHIP8_USERMEM_END 0xFFF
 #define CHIP8_USERMEM_TOTAL (CHIP8_USERMEM_END - CHIP8_USERMEM_START)
 #define CHIP8_STACK_MAX 16
+// Writes to memory are tracked per block, one bit of Chip8.dirty each.
+#define CHIP8_DIRTY_BLOCK_SIZE 64
+#define CHIP8_DIRTY_BLOCKS (0x1000 / CHIP8_DIRTY_BLOCK_SIZE)
+
+// Behaviours that differ between CHIP-8 interpreters, as bits of Chip8.quirks.
+// With none set the CPU behaves as it always has.
+typedef enum {
+    // 8xy1, 8xy2 and 8xy3 reset VF to 0.
+    CHIP8_QUIRK_VF_RESET = 1 << 0,
+    // 8xy6 and 8xyE shift Vy into Vx rather than shifting Vx.
+    CHIP8_QUIRK_SHIFT_VY = 1 << 1,
+    // Fx55 and Fx65 leave I pointing past the last register.
+    CHIP8_QUIRK_LOAD_STORE_I = 1 << 2,
+    // Bnnn jumps to nnn plus Vx, x being the top digit of nnn, not V0.
+    CHIP8_QUIRK_JUMP_VX = 1 << 3,
+    // Dxyn wraps sprites around the screen edges rather than clipping them.
+    CHIP8_QUIRK_SPRITE_WRAP = 1 << 4,
+    CHIP8_QUIRK_ALL = (1 << 5) - 1
+} Chip8Quirk;
 
 typedef union tChip8WaitingKey {
     uint8_t val;
@@ -28,33 +47,82 @@ typedef union tChip8WaitingKey {
 } Chip8WaitingKey;
 
 // The CHIP-8 system.
-typedef union tChip8 {
-    uint8_t memory[0x1000];
+typedef struct tChip8 {
+    union {
+        uint8_t memory[0x1000];
 
-    struct {
-        uint8_t V[16];
-        uint8_t delayTimer;
-        uint8_t soundTimer;
-        uint8_t SP;
-        uint8_t keys[16];
-        Chip8WaitingKey waitingKey;
-
-        uint8_t display[(CHIP8_W * CHIP8_H) / 8];
-        uint8_t font[16 * 5];
-
-        uint16_t PC;
-        uint16_t stack[CHIP8_STACK_MAX];
-        uint16_t I;
+        struct {
+            uint8_t V[16];
+            uint8_t delayTimer;
+            uint8_t soundTimer;
+            uint8_t SP;
+            uint8_t keys[16];
+            Chip8WaitingKey waitingKey;
+
+            uint8_t display[(CHIP8_W * CHIP8_H) / 8];
+            uint8_t font[16 * 5];
+
+            uint16_t PC;
+            uint16_t stack[CHIP8_STACK_MAX];
+            uint16_t I;
+
+            // xorshift32 state for Cxkk. Kept with the registers so that
+            // snapshots and save states replay the same random numbers.
+            uint32_t rng;
+        };
     };
+
+    // Bit n is set once block n of memory has been written, including the
+    // registers and display that live in it. Never cleared here, the VM hands
+    // the bits out to whoever needs to know what changed.
+    uint64_t dirty;
+
+    // Chip8Quirk bits, set by the VM after Chip8Init().
+    uint32_t quirks;
 } Chip8;
 
-// Chip8Init() - Initialises the CHIP-8 CPU.
-void Chip8Init(Chip8 *chip8);
+// Most instructions in a loop found by Chip8FindDelayLoop().
+#define CHIP8_DELAY_LOOP_MAX 16
+
+// A loop waiting on the delay timer, starting at PC.
+typedef struct tChip8DelayLoop {
+    int length;
+    // The address of each instruction, the register it loads or -1, and the
+    // value it loads or -1 for the delay timer.
+    uint16_t address[CHIP8_DELAY_LOOP_MAX];
+    int8_t reg[CHIP8_DELAY_LOOP_MAX];
+    int16_t value[CHIP8_DELAY_LOOP_MAX];
+    // The loop goes round unchanged while the delay timer is above this, or
+    // forever if it is -1.
+    int exitDelay;
+} Chip8DelayLoop;
+
+// Chip8Init() - Initialises the CHIP-8 CPU. A seed of 0 seeds the rng from the
+// current time.
+void Chip8Init(Chip8 *chip8, unsigned int seed);
+
+// Chip8Seed() - Reseeds the rng. A seed of 0 seeds it from the current time.
+void Chip8Seed(Chip8 *chip8, unsigned int seed);
 
 // Chip8Cycle() - Read and execute an instruction.
 void Chip8Cycle(Chip8 *chip8);
 
+// Chip8MarkDirty() - Marks the blocks holding size bytes from address as
+// written. Only needed for writes made outside Chip8Cycle().
+void Chip8MarkDirty(Chip8 *chip8, size_t address, size_t size);
+
 // Chip8WaitingForKey() - Returns if the CHIP8 is waiting for a key.
 bool Chip8WaitingForKey(Chip8 *chip8);
 
+// Chip8IsOpcode() - Returns if op is a CHIP-8 instruction. 0nnn, calling
+// machine code, is not one.
+bool Chip8IsOpcode(uint16_t op);
+
+// Chip8FindDelayLoop() - Checks if the CPU is spinning in a loop that only
+// loads the delay timer or constants into registers, compares registers with
+// constants and jumps, as programs do to wait for the timer. Returns true and
+// fills loop if it is, and the loop goes the same way round for every value the
+// timer counts down through until it reaches loop->exitDelay.
+bool Chip8FindDelayLoop(const Chip8 *chip8, Chip8DelayLoop *loop);
+
 #endif // _CHIP8_H_
@@ -0,0 +1,374 @@
+#include "env.h"
+
+#include "vm.h"
+
+#include <time.h>
+
+typedef struct tEnvReward {
+    uint16_t address;
+    EnvValueType type;
+    float weight;
+} EnvReward;
+
+struct tEnv {
+    VM **vms;
+    int envCount;
+    int frameSkip;
+    // The keys held on each VM.
+    uint16_t *keys;
+
+    uint16_t *actions;
+    int actionCount;
+
+    EnvReward rewards[ENV_MAX_REWARDS];
+    int rewardCount;
+    // The weighted sum of the reward values of each environment at the end of
+    // its last step, which the next step's reward is the change from.
+    double *scores;
+
+    EnvObservationType observation;
+    int scale;
+    // The Chip8Quirk bits, applied again on reset since the reset state may
+    // have been taken before they were set.
+    uint32_t quirks;
+
+    // A VMTakeSnapshot() of the state every VM resets to, and the keys held in
+    // it.
+    void *resetState;
+    uint16_t resetKeys;
+};
+
+static double EnvScore(Env *env, int index);
+static void EnvObserveOne(Env *env, int index, uint8_t *out);
+
+Env *EnvCreate(int envCount, int cyclesPerTick, unsigned int seed)
+{
+    Env *env = calloc(1, sizeof(Env));
+    if (!env) {
+        fprintf(stderr, "Failed to allocate %d environments!\n", envCount);
+        return NULL;
+    }
+    env->envCount = envCount;
+    env->frameSkip = 1;
+    env->observation = ENVOBSERVATION_BITS;
+    env->scale = 1;
+
+    if (envCount <= 0) {
+        fprintf(stderr, "Environment count must be positive, got %d!\n",
+                envCount);
+        goto error;
+    }
+    env->vms = calloc(envCount, sizeof(VM *));
+    env->keys = calloc(envCount, sizeof(uint16_t));
+    env->scores = calloc(envCount, sizeof(double));
+    env->resetState = malloc(VMSnapshotSize());
+    if (!env->vms || !env->keys || !env->scores || !env->resetState) {
+        fprintf(stderr, "Failed to allocate %d environments!\n", envCount);
+        goto error;
+    }
+
+    uint32_t base = seed != 0 ? seed : (uint32_t)time(NULL);
+    for (int i = 0; i < envCount; i++) {
+        env->vms[i] = VMCreate(cyclesPerTick, VMCOLOR_PALETTE_ORIGINAL,
+                               base + (uint32_t)i);
+        if (!env->vms[i]) {
+            goto error;
+        }
+    }
+    VMTakeSnapshot(env->vms[0], env->resetState);
+
+    return env;
+
+error:
+    EnvDestroy(env);
+    return NULL;
+}
+
+void EnvDestroy(Env *env)
+{
+    if (!env) {
+        return;
+    }
+
+    if (env->vms) {
+        for (int i = 0; i < env->envCount; i++) {
+            VMDestroy(env->vms[i]);
+        }
+    }
+    free(env->vms);
+    free(env->keys);
+    free(env->resetState);
+    free(env->actions);
+    free(env->scores);
+    free(env);
+}
+
+int EnvGetCount(const Env *env)
+{
+    assert(env != NULL);
+
+    return env->envCount;
+}
+
+void EnvSetQuirks(Env *env, uint32_t quirks)
+{
+    assert(env != NULL);
+
+    env->quirks = quirks;
+    for (int i = 0; i < env->envCount; i++) {
+        VMSetQuirks(env->vms[i], quirks);
+    }
+}
+
+int EnvLoadRom(Env *env, const uint8_t *data, size_t size)
+{
+    assert(env != NULL);
+
+    for (int i = 0; i < env->envCount; i++) {
+        if (VMLoadRomData(env->vms[i], data, size) < 0) {
+            return -1;
+        }
+        env->keys[i] = 0;
+        env->scores[i] = EnvScore(env, i);
+    }
+    VMTakeSnapshot(env->vms[0], env->resetState);
+    env->resetKeys = 0;
+
+    return 0;
+}
+
+int EnvSetActions(Env *env, const uint16_t *keys, int count)
+{
+    assert(env != NULL);
+    assert(keys != NULL || count == 0);
+
+    if (count < 0) {
+        fprintf(stderr, "Action count must not be negative, got %d!\n", count);
+        return -1;
+    }
+
+    uint16_t *actions = NULL;
+    if (count > 0) {
+        actions = malloc(count * sizeof(uint16_t));
+        if (!actions) {
+            fprintf(stderr, "Failed to allocate %d actions!\n", count);
+            return -1;
+        }
+        memcpy(actions, keys, count * sizeof(uint16_t));
+    }
+
+    free(env->actions);
+    env->actions = actions;
+    env->actionCount = count;
+
+    return 0;
+}
+
+void EnvSetFrameSkip(Env *env, int frames)
+{
+    assert(env != NULL);
+    assert(frames > 0);
+
+    env->frameSkip = frames;
+}
+
+int EnvAddReward(Env *env, uint16_t address, EnvValueType type, float weight)
+{
+    assert(env != NULL);
+
+    static const int widths[ENVVALUE_MAX] = { 1, 2, 3 };
+    if (type < 0 || type >= ENVVALUE_MAX ||
+        address + widths[type] > 0x1000) {
+        fprintf(stderr, "Invalid reward value at 0x%03X!\n", address);
+        return -1;
+    }
+    if (env->rewardCount == ENV_MAX_REWARDS) {
+        fprintf(stderr, "Too many reward values, at most %d!\n",
+                ENV_MAX_REWARDS);
+        return -1;
+    }
+
+    env->rewards[env->rewardCount++] =
+        (EnvReward){ .address = address, .type = type, .weight = weight };
+    for (int i = 0; i < env->envCount; i++) {
+        env->scores[i] = EnvScore(env, i);
+    }
+
+    return 0;
+}
+
+int EnvSetObservation(Env *env, EnvObservationType type, int scale)
+{
+    assert(env != NULL);
+
+    if (type < 0 || type >= ENVOBSERVATION_MAX ||
+        (type == ENVOBSERVATION_BYTES && (scale <= 0 || CHIP8_H % scale))) {
+        fprintf(stderr, "Invalid observation, scale must divide %d!\n",
+                CHIP8_H);
+        return -1;
+    }
+
+    env->observation = type;
+    env->scale = type == ENVOBSERVATION_BYTES ? scale : 1;
+
+    return 0;
+}
+
+size_t EnvGetObservationSize(const Env *env)
+{
+    assert(env != NULL);
+
+    if (env->observation == ENVOBSERVATION_BITS) {
+        return CHIP8_W * CHIP8_H / 8;
+    }
+    return (CHIP8_W / env->scale) * (CHIP8_H / env->scale);
+}
+
+int EnvStep(Env *env, const int *actions, uint8_t *observations,
+            float *rewards)
+{
+    assert(env != NULL);
+    assert(actions != NULL);
+
+    int limit = env->actionCount > 0 ? env->actionCount : 0x10000;
+    for (int i = 0; i < env->envCount; i++) {
+        if (actions[i] < 0 || actions[i] >= limit) {
+            fprintf(stderr, "Invalid action %d for environment %d!\n",
+                    actions[i], i);
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < env->envCount; i++) {
+        VM *vm = env->vms[i];
+        uint16_t keys = env->actionCount > 0 ? env->actions[actions[i]] :
+                                               (uint16_t)actions[i];
+        uint16_t changed = keys ^ env->keys[i];
+        // Releases first, so a key released and another pressed in one step
+        // ends an Fx0A wait with the released key.
+        for (int k = 0; k < 16; k++) {
+            if ((changed >> k) & 1 && !((keys >> k) & 1)) {
+                VMClearKey(vm, k);
+            }
+        }
+        for (int k = 0; k < 16; k++) {
+            if ((changed >> k) & 1 && (keys >> k) & 1) {
+                VMSetKey(vm, k);
+            }
+        }
+        env->keys[i] = keys;
+
+        for (int f = 0; f < env->frameSkip; f++) {
+            VMTick(vm);
+        }
+    }
+
+    if (env->rewardCount > 0) {
+        for (int i = 0; i < env->envCount; i++) {
+            double score = EnvScore(env, i);
+            if (rewards) {
+                rewards[i] = (float)(score - env->scores[i]);
+            }
+            env->scores[i] = score;
+        }
+    } else if (rewards) {
+        memset(rewards, 0, env->envCount * sizeof(float));
+    }
+
+    if (observations) {
+        EnvObserve(env, observations);
+    }
+
+    return 0;
+}
+
+void EnvObserve(Env *env, uint8_t *observations)
+{
+    assert(env != NULL);
+    assert(observations != NULL);
+
+    size_t size = EnvGetObservationSize(env);
+    for (int i = 0; i < env->envCount; i++) {
+        EnvObserveOne(env, i, observations + i * size);
+    }
+}
+
+void EnvReset(Env *env, int index, unsigned int seed)
+{
+    assert(env != NULL);
+    assert(index >= 0 && index < env->envCount);
+
+    VM *vm = env->vms[index];
+    VMRestoreSnapshot(vm, env->resetState);
+    VMSetQuirks(vm, env->quirks);
+    if (seed != 0) {
+        VMSetSeed(vm, seed);
+    }
+    env->keys[index] = env->resetKeys;
+    env->scores[index] = EnvScore(env, index);
+}
+
+void EnvSetResetState(Env *env, int index)
+{
+    assert(env != NULL);
+    assert(index >= 0 && index < env->envCount);
+
+    VMTakeSnapshot(env->vms[index], env->resetState);
+    env->resetKeys = env->keys[index];
+}
+
+static double EnvScore(Env *env, int index)
+{
+    double score = 0;
+
+    for (int r = 0; r < env->rewardCount; r++) {
+        const EnvReward *reward = &env->rewards[r];
+        uint16_t address = reward->address;
+        VM *vm = env->vms[index];
+        int value = VMPeek(vm, address);
+        if (reward->type == ENVVALUE_WORD) {
+            value = (value << 8) | VMPeek(vm, address + 1);
+        } else if (reward->type == ENVVALUE_BCD) {
+            value = value * 100 + VMPeek(vm, address + 1) * 10 +
+                    VMPeek(vm, address + 2);
+        }
+        score += (double)reward->weight * value;
+    }
+
+    return score;
+}
+
+static void EnvObserveOne(Env *env, int index, uint8_t *out)
+{
+    const uint8_t *display = VMGetDisplayPixels(env->vms[index]);
+
+    if (env->observation == ENVOBSERVATION_BITS) {
+        memcpy(out, display, CHIP8_W * CHIP8_H / 8);
+        return;
+    }
+
+    // Scales divide the height, a power of two, so they are powers of two too.
+    int scale = env->scale;
+    int shift = 0;
+    while ((1 << shift) < scale) {
+        shift++;
+    }
+
+    int columns = CHIP8_W >> shift;
+    int lit[CHIP8_W];
+    for (int by = 0; by < CHIP8_H >> shift; by++) {
+        memset(lit, 0, columns * sizeof(int));
+        for (int y = by << shift; y < (by + 1) << shift; y++) {
+            const uint8_t *row = display + y * (CHIP8_W / 8);
+            for (int x = 0; x < CHIP8_W; x += 8) {
+                uint8_t bits = row[x / 8];
+                for (int bit = 0; bits; bit++, bits <<= 1) {
+                    lit[(x + bit) >> shift] += bits >> 7;
+                }
+            }
+        }
+        for (int bx = 0; bx < columns; bx++) {
+            *out++ = (uint8_t)(lit[bx] * 255 >> (shift * 2));
+        }
+    }
+}
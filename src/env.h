@@ -0,0 +1,95 @@
+#ifndef CHIP8_ENV_H
+#define CHIP8_ENV_H
+
+// Env module.
+// Steps a batch of VMs running one ROM as environments for reinforcement
+// learning. An agent step holds the keys of each environment's action for a
+// few ticks, scores it from values in its memory and writes out what its
+// display shows, allocating nothing and copying nothing but the observations.
+// Episodes reset by restoring a snapshot.
+
+#include "def.h"
+
+// Most memory values summed into the reward.
+#define ENV_MAX_REWARDS 8
+
+// How a value read for the reward is stored, starting at its address.
+typedef enum {
+    // One byte.
+    ENVVALUE_BYTE,
+    // Two bytes, most significant first.
+    ENVVALUE_WORD,
+    // Three decimal digits, hundreds first, as Fx33 writes them.
+    ENVVALUE_BCD,
+    ENVVALUE_MAX
+} EnvValueType;
+
+typedef enum {
+    // The display as it is laid out in Chip8.display, 1 bit per pixel.
+    ENVOBSERVATION_BITS,
+    // One byte per square of scale by scale pixels, 0 with none lit to 255
+    // with all lit, rows top to bottom.
+    ENVOBSERVATION_BYTES,
+    ENVOBSERVATION_MAX
+} EnvObservationType;
+
+typedef struct tEnv Env;
+
+// EnvCreate() - Creates envCount environments. Environment n is seeded with
+// seed + n, or from the current time if seed is 0. Returns NULL on failure.
+Env *EnvCreate(int envCount, int cyclesPerTick, unsigned int seed);
+
+// EnvDestroy() - Frees environments created by EnvCreate().
+void EnvDestroy(Env *env);
+
+// EnvGetCount() - Returns the number of environments.
+int EnvGetCount(const Env *env);
+
+// EnvSetQuirks() - Sets the Chip8Quirk bits that every environment emulates,
+// including after EnvReset().
+void EnvSetQuirks(Env *env, uint32_t quirks);
+
+// EnvLoadRom() - Loads the ROM into every environment, and makes its start the
+// state they reset to. Returns 0 on success and -1 on failure.
+int EnvLoadRom(Env *env, const uint8_t *data, size_t size);
+
+// EnvSetActions() - Sets the keys held for each action, bit n for key n.
+// Without a table, or with a count of 0, an action is the bitmask itself.
+// Returns 0 on success and -1 on failure.
+int EnvSetActions(Env *env, const uint16_t *keys, int count);
+
+// EnvSetFrameSkip() - Sets the ticks an agent step runs for, 1 by default.
+void EnvSetFrameSkip(Env *env, int frames);
+
+// EnvAddReward() - Adds weight times the change in the value at an address to
+// the reward of every step. Addresses below 16 are the registers V0 to VF.
+// Returns 0 on success and -1 on failure.
+int EnvAddReward(Env *env, uint16_t address, EnvValueType type, float weight);
+
+// EnvSetObservation() - Sets what observations hold, ENVOBSERVATION_BITS by
+// default. The scale of ENVOBSERVATION_BYTES must divide the display height.
+// Returns 0 on success and -1 on failure.
+int EnvSetObservation(Env *env, EnvObservationType type, int scale);
+
+// EnvGetObservationSize() - Returns the bytes of one observation.
+size_t EnvGetObservationSize(const Env *env);
+
+// EnvStep() - Runs one agent step of every environment with the given actions.
+// Writes the observations back to back into observations and the rewards into
+// rewards, when they are not NULL. Returns 0 on success and -1 on failure.
+int EnvStep(Env *env, const int *actions, uint8_t *observations,
+            float *rewards);
+
+// EnvObserve() - Writes the observations of every environment, as EnvStep()
+// does.
+void EnvObserve(Env *env, uint8_t *observations);
+
+// EnvReset() - Restores an environment to the reset state. A seed other than 0
+// reseeds its rng, 0 keeps that of the reset state.
+void EnvReset(Env *env, int index, unsigned int seed);
+
+// EnvSetResetState() - Makes the current state of an environment the one they
+// all reset to, for example once it is past a title screen.
+void EnvSetResetState(Env *env, int index);
+
+#endif // CHIP8_ENV_H
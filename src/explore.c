@@ -0,0 +1,735 @@
+// chip8-explore, searches the states a ROM can reach breadth first.
+//
+// From every state the search branches on each chosen key, and on no key,
+// holding it for --frames ticks and then releasing it. States are told apart
+// by VMHashMachine(), so a state reached again by any path is expanded once,
+// and each level of the search is expanded across every core. The result is
+// one JSON object with the new states found at each depth, the addresses
+// executed and the inputs leading to states that match --goal.
+//
+// A goal is one or more comma separated comparisons of a byte of memory, or a
+// register V0 to VF, with a number, all of which must hold:
+//
+//     --goal "V3==2,0x2F0>=5"
+
+#include "def.h"
+#include "adc_argp.h"
+#include "pool.h"
+#include "tool.h"
+#include "vm.h"
+
+#include <ctype.h>
+
+// Comparisons in a goal, and goal states whose inputs are reported.
+#define EXPLORE_TERMS_MAX 16
+#define EXPLORE_GOALS_MAX 64
+// The action that holds no key.
+#define EXPLORE_NO_KEY -1
+
+typedef enum {
+    EXPLORE_OP_EQ,
+    EXPLORE_OP_NE,
+    EXPLORE_OP_LE,
+    EXPLORE_OP_GE,
+    EXPLORE_OP_LT,
+    EXPLORE_OP_GT,
+    EXPLORE_OP_MAX
+} ExploreOp;
+
+typedef struct tExploreTerm {
+    uint16_t address;
+    ExploreOp op;
+    uint8_t value;
+} ExploreTerm;
+
+// A state found by the search, and the key held to reach it from its parent.
+typedef struct tExploreNode {
+    int parent;
+    int key;
+} ExploreNode;
+
+// A state a worker reached from the frontier, not yet merged into the search.
+typedef struct tExploreChild {
+    uint64_t hash;
+    int parent;
+    int action;
+    bool goal;
+    int worker;
+    int snapshot;
+} ExploreChild;
+
+typedef struct tExploreWorker {
+    VM *vm;
+    VMCoverage coverage;
+    ExploreChild *children;
+    int childCount;
+    int childCapacity;
+    uint8_t *snapshots;
+    bool failed;
+} ExploreWorker;
+
+typedef struct tExplore {
+    int frames;
+    int actions[17];
+    int actionCount;
+    ExploreTerm terms[EXPLORE_TERMS_MAX];
+    int termCount;
+    int maxStates;
+    size_t snapshotSize;
+
+    ExploreNode *nodes;
+    int nodeCount;
+    // Open addressed set of the hashes of every state found, 0 marks a free
+    // entry.
+    uint64_t *visited;
+    size_t visitedMask;
+
+    // The states of the level being expanded, as node indices and snapshots,
+    // and those of the next level.
+    int *frontier;
+    uint8_t *frontierSnapshots;
+    int frontierCount;
+    int frontierCapacity;
+    int *next;
+    uint8_t *nextSnapshots;
+    int nextCount;
+    int nextCapacity;
+
+    ExploreWorker *workers;
+    int workerCount;
+
+    int goals[EXPLORE_GOALS_MAX];
+    int goalCount;
+    bool truncated;
+} Explore;
+
+static int ParseKeys(Explore *explore, const char *str);
+static int ParseGoal(Explore *explore, const char *str);
+static bool MatchesGoal(const Explore *explore, VM *vm);
+static bool Visited(const Explore *explore, uint64_t hash);
+static void Visit(Explore *explore, uint64_t hash);
+static int AddState(Explore *explore, uint64_t hash, int parent, int key,
+                    bool goal, const void *snapshot);
+static void ExpandState(void *user, int job, int worker);
+static int CompareChildren(const void *a, const void *b);
+static int MergeLevel(Explore *explore);
+static void ExploreFree(Explore *explore);
+static void WriteResult(FILE *out, const Explore *explore, const char *romPath,
+                        const char *quirks, const int *levels, int levelCount,
+                        size_t romSize, double wallMs);
+
+int main(int argc, char *argv[])
+{
+    const char *romPath = NULL;
+    const char *outPath = NULL;
+    const char *keys = NULL;
+    const char *goal = NULL;
+    const char *quirkNames = NULL;
+    int threadCount = 0;
+    int cyclesPerTick = 20;
+    unsigned int seed = 1;
+    int frames = 10;
+    int depth = 8;
+    int maxStates = 100000;
+
+    adc_argp_option opts[] = {
+        ADC_ARGP_HELP(),
+        ADC_ARGP_OPTION("rom", "r", ADC_ARGP_TYPE_STRING, &romPath,
+                        "ROM to explore. Required"),
+        ADC_ARGP_OPTION(
+            "out", "o", ADC_ARGP_TYPE_STRING, &outPath,
+            "Write the JSON result to this file. Defaults to stdout"),
+        ADC_ARGP_OPTION(
+            "keys", "k", ADC_ARGP_TYPE_STRING, &keys,
+            "Keys to branch on as hex digits, e.g. 456. Defaults to all 16"),
+        ADC_ARGP_OPTION(
+            "goal", "g", ADC_ARGP_TYPE_STRING, &goal,
+            "Comparisons a goal state matches, e.g. \"V3==2,0x2F0>=5\""),
+        ADC_ARGP_OPTION(
+            "frames", "f", ADC_ARGP_TYPE_UINT, &frames,
+            "Ticks each key is held for before the next branch. Defaults "
+            "to 10"),
+        ADC_ARGP_OPTION(
+            "depth", "d", ADC_ARGP_TYPE_UINT, &depth,
+            "Inputs in the longest sequence searched. Defaults to 8"),
+        ADC_ARGP_OPTION(
+            "max-states", "m", ADC_ARGP_TYPE_UINT, &maxStates,
+            "States to stop the search at, each level holds about 6 KB per "
+            "state. Defaults to 100000"),
+        ADC_ARGP_OPTION(
+            "threads", "j", ADC_ARGP_TYPE_UINT, &threadCount,
+            "Worker threads. Defaults to 0, one per cpu"),
+        ADC_ARGP_OPTION(
+            "cycles", "c", ADC_ARGP_TYPE_UINT, &cyclesPerTick,
+            "Cycles per tick. Defaults to 20"),
+        ADC_ARGP_OPTION(
+            "seed", "s", ADC_ARGP_TYPE_UINT, &seed,
+            "Rng seed, 0 seeds from the time. Defaults to 1"),
+        ADC_ARGP_OPTION(
+            "quirks", "q", ADC_ARGP_TYPE_STRING, &quirkNames,
+            "Quirks to emulate, as names or a number. Defaults to none")
+    };
+
+    adc_argp_parser *parser = adc_argp_new_parser(opts, ADC_ARGP_COUNT(opts));
+    if (!parser) {
+        fprintf(stderr, "Failed to create arg parser\n");
+        return EXIT_FAILURE;
+    }
+    int errors = adc_argp_parse(parser, argc, (const char **)argv);
+    if (errors > 0) {
+        adc_argp_print_errors(parser, stderr);
+    }
+    adc_argp_destroy_parser(&parser);
+    if (errors > 0) {
+        return EXIT_FAILURE;
+    }
+    if (!romPath) {
+        fprintf(stderr, "No rom given, use --rom!\n");
+        return EXIT_FAILURE;
+    }
+    if (cyclesPerTick <= 0 || frames <= 0 || maxStates <= 0) {
+        fprintf(stderr, "Cycles, frames and max states must be positive!\n");
+        return EXIT_FAILURE;
+    }
+    uint32_t quirks = 0;
+    if (quirkNames && VMParseQuirks(quirkNames, &quirks) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    Explore explore = {0};
+    explore.frames = frames;
+    explore.maxStates = maxStates;
+    explore.snapshotSize = VMSnapshotSize();
+    if (ParseKeys(&explore, keys ? keys : "0123456789ABCDEF") != 0 ||
+        (goal && ParseGoal(&explore, goal) != 0)) {
+        return EXIT_FAILURE;
+    }
+
+    int result = EXIT_FAILURE;
+    FILE *out = NULL;
+    Pool *pool = NULL;
+    VM *vm = NULL;
+    int *levels = NULL;
+    uint8_t rom[CHIP8_USERMEM_TOTAL + 1];
+    size_t romSize = sizeof(rom);
+    if (ToolReadRom(romPath, rom, &romSize) != 0) {
+        goto error;
+    }
+
+    pool = PoolCreate(threadCount);
+    levels = calloc(depth + 1, sizeof(int));
+    size_t visitedSize = 1024;
+    while (visitedSize < (size_t)maxStates * 2) {
+        visitedSize *= 2;
+    }
+    explore.visited = calloc(visitedSize, sizeof(uint64_t));
+    explore.visitedMask = visitedSize - 1;
+    explore.nodes = malloc(maxStates * sizeof(ExploreNode));
+    if (!pool || !levels || !explore.visited || !explore.nodes) {
+        fprintf(stderr, "Failed to allocate the search!\n");
+        goto error;
+    }
+
+    explore.workerCount = PoolThreadCount(pool);
+    explore.workers = calloc(explore.workerCount, sizeof(ExploreWorker));
+    if (!explore.workers) {
+        fprintf(stderr, "Failed to allocate the search!\n");
+        goto error;
+    }
+    for (int i = 0; i < explore.workerCount; i++) {
+        explore.workers[i].vm =
+            VMCreate(cyclesPerTick, VMCOLOR_PALETTE_ORIGINAL, seed);
+        if (!explore.workers[i].vm) {
+            goto error;
+        }
+        VMSetCoverage(explore.workers[i].vm, &explore.workers[i].coverage);
+    }
+
+    // The search starts from the ROM as loaded.
+    vm = VMCreate(cyclesPerTick, VMCOLOR_PALETTE_ORIGINAL, seed);
+    if (!vm) {
+        goto error;
+    }
+    VMSetQuirks(vm, quirks);
+    if (VMLoadRomData(vm, rom, romSize) != 0) {
+        goto error;
+    }
+    uint8_t *root = malloc(explore.snapshotSize);
+    if (!root) {
+        fprintf(stderr, "Failed to allocate the search!\n");
+        goto error;
+    }
+    VMTakeSnapshot(vm, root);
+    int added = AddState(&explore, VMHashMachine(vm), -1, EXPLORE_NO_KEY,
+                         MatchesGoal(&explore, vm), root);
+    free(root);
+    if (added != 0) {
+        goto error;
+    }
+
+    double start = ToolNowSeconds();
+    int levelCount = 1;
+    levels[0] = 1;
+    for (int d = 1; d <= depth && explore.nextCount > 0; d++) {
+        // The states found last level become the frontier.
+        int *nodes = explore.frontier;
+        uint8_t *snapshots = explore.frontierSnapshots;
+        int capacity = explore.frontierCapacity;
+        explore.frontier = explore.next;
+        explore.frontierSnapshots = explore.nextSnapshots;
+        explore.frontierCount = explore.nextCount;
+        explore.frontierCapacity = explore.nextCapacity;
+        explore.next = nodes;
+        explore.nextSnapshots = snapshots;
+        explore.nextCount = 0;
+        explore.nextCapacity = capacity;
+
+        PoolRun(pool, explore.frontierCount, ExpandState, &explore);
+        if (MergeLevel(&explore) != 0) {
+            goto error;
+        }
+        levels[levelCount++] = explore.nextCount;
+        fprintf(stderr, "Depth %d: %d new states, %d in all\n", d,
+                explore.nextCount, explore.nodeCount);
+        if (explore.truncated) {
+            break;
+        }
+    }
+    double elapsed = ToolNowSeconds() - start;
+
+    out = outPath ? fopen(outPath, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Failed to open %s for writing!\n", outPath);
+        goto error;
+    }
+    char quirkText[128];
+    VMFormatQuirks(quirks, quirkText, sizeof(quirkText));
+    WriteResult(out, &explore, romPath, quirkText, levels, levelCount,
+                romSize, elapsed * 1000.0);
+    if (out != stdout && fclose(out) != 0) {
+        fprintf(stderr, "Failed to write %s!\n", outPath);
+        goto error;
+    }
+
+    fprintf(stderr,
+            "Search finished! %d states to depth %d on %d threads in "
+            "%.03fs, %d goal states%s\n",
+            explore.nodeCount, levelCount - 1, explore.workerCount, elapsed,
+            explore.goalCount,
+            explore.truncated ? ", stopped at --max-states" : "");
+    result = EXIT_SUCCESS;
+
+error:
+    VMDestroy(vm);
+    PoolDestroy(pool);
+    free(levels);
+    ExploreFree(&explore);
+    return result;
+}
+
+static int ParseKeys(Explore *explore, const char *str)
+{
+    uint8_t keys[16];
+    int keyCount;
+    if (ToolParseKeys(str, keys, &keyCount) != 0) {
+        return -1;
+    }
+
+    explore->actions[explore->actionCount++] = EXPLORE_NO_KEY;
+    for (int k = 0; k < keyCount; k++) {
+        explore->actions[explore->actionCount++] = keys[k];
+    }
+
+    return 0;
+}
+
+static int ParseGoal(Explore *explore, const char *str)
+{
+    static const char *opNames[EXPLORE_OP_MAX] = { "==", "!=", "<=",
+                                                   ">=", "<",  ">" };
+
+    const char *c = str;
+    while (*c) {
+        if (explore->termCount == EXPLORE_TERMS_MAX) {
+            fprintf(stderr, "Too many goal comparisons, at most %d!\n",
+                    EXPLORE_TERMS_MAX);
+            return -1;
+        }
+        ExploreTerm *term = &explore->terms[explore->termCount++];
+
+        char *end;
+        unsigned long address;
+        if ((c[0] == 'V' || c[0] == 'v') && isxdigit((unsigned char)c[1])) {
+            char digit[2] = { c[1], '\0' };
+            address = strtoul(digit, NULL, 16);
+            end = (char *)c + 2;
+        } else {
+            address = strtoul(c, &end, 0);
+            if (end == c || address > 0xFFF) {
+                fprintf(stderr, "Invalid goal address in \"%s\"!\n", str);
+                return -1;
+            }
+        }
+        term->address = (uint16_t)address;
+
+        int op = 0;
+        while (op < EXPLORE_OP_MAX &&
+               strncmp(end, opNames[op], strlen(opNames[op])) != 0) {
+            op++;
+        }
+        if (op == EXPLORE_OP_MAX) {
+            fprintf(stderr, "Invalid goal comparison in \"%s\"!\n", str);
+            return -1;
+        }
+        term->op = (ExploreOp)op;
+        c = end + strlen(opNames[op]);
+
+        unsigned long value = strtoul(c, &end, 0);
+        if (end == c || value > 0xFF) {
+            fprintf(stderr, "Invalid goal value in \"%s\"!\n", str);
+            return -1;
+        }
+        term->value = (uint8_t)value;
+        c = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0') {
+            fprintf(stderr, "Invalid goal \"%s\"!\n", str);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static bool MatchesGoal(const Explore *explore, VM *vm)
+{
+    if (explore->termCount == 0) {
+        return false;
+    }
+
+    for (int i = 0; i < explore->termCount; i++) {
+        const ExploreTerm *term = &explore->terms[i];
+        uint8_t value = VMPeek(vm, term->address);
+        bool holds = false;
+        switch (term->op) {
+        case EXPLORE_OP_EQ:
+            holds = value == term->value;
+            break;
+        case EXPLORE_OP_NE:
+            holds = value != term->value;
+            break;
+        case EXPLORE_OP_LE:
+            holds = value <= term->value;
+            break;
+        case EXPLORE_OP_GE:
+            holds = value >= term->value;
+            break;
+        case EXPLORE_OP_LT:
+            holds = value < term->value;
+            break;
+        case EXPLORE_OP_GT:
+            holds = value > term->value;
+            break;
+        default:
+            break;
+        }
+        if (!holds) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Hashes of 0 are stored as 1, 0 marking free entries.
+static bool Visited(const Explore *explore, uint64_t hash)
+{
+    hash = hash ? hash : 1;
+    for (size_t i = hash & explore->visitedMask; explore->visited[i];
+         i = (i + 1) & explore->visitedMask) {
+        if (explore->visited[i] == hash) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void Visit(Explore *explore, uint64_t hash)
+{
+    hash = hash ? hash : 1;
+    size_t i = hash & explore->visitedMask;
+    while (explore->visited[i] && explore->visited[i] != hash) {
+        i = (i + 1) & explore->visitedMask;
+    }
+    explore->visited[i] = hash;
+}
+
+// Records a new state and queues it for the next level. Returns 0 on success
+// and -1 on failure.
+static int AddState(Explore *explore, uint64_t hash, int parent, int key,
+                    bool goal, const void *snapshot)
+{
+    if (explore->nextCount == explore->nextCapacity) {
+        int capacity = explore->nextCapacity ? explore->nextCapacity * 2 : 64;
+        capacity = MIN(capacity, explore->maxStates);
+        int *next = realloc(explore->next, capacity * sizeof(int));
+        if (next) {
+            explore->next = next;
+        }
+        uint8_t *nextSnapshots =
+            realloc(explore->nextSnapshots, capacity * explore->snapshotSize);
+        if (nextSnapshots) {
+            explore->nextSnapshots = nextSnapshots;
+        }
+        if (!next || !nextSnapshots) {
+            fprintf(stderr, "Failed to allocate %d states!\n", capacity);
+            return -1;
+        }
+        explore->nextCapacity = capacity;
+    }
+
+    int node = explore->nodeCount++;
+    explore->nodes[node] = (ExploreNode){ .parent = parent, .key = key };
+    Visit(explore, hash);
+    if (goal) {
+        if (explore->goalCount < EXPLORE_GOALS_MAX) {
+            explore->goals[explore->goalCount] = node;
+        }
+        explore->goalCount++;
+    }
+
+    explore->next[explore->nextCount] = node;
+    memcpy(explore->nextSnapshots + explore->nextCount * explore->snapshotSize,
+           snapshot, explore->snapshotSize);
+    explore->nextCount++;
+
+    return 0;
+}
+
+// Runs every action from one frontier state, keeping the states that are
+// neither found already nor reached by an earlier action.
+static void ExpandState(void *user, int job, int worker)
+{
+    Explore *explore = user;
+    ExploreWorker *w = &explore->workers[worker];
+    const uint8_t *parent =
+        explore->frontierSnapshots + job * explore->snapshotSize;
+
+    if (w->childCount + explore->actionCount > w->childCapacity) {
+        int capacity = MAX(w->childCapacity * 2, 64);
+        ExploreChild *children =
+            realloc(w->children, capacity * sizeof(ExploreChild));
+        if (children) {
+            w->children = children;
+        }
+        uint8_t *snapshots =
+            realloc(w->snapshots, capacity * explore->snapshotSize);
+        if (snapshots) {
+            w->snapshots = snapshots;
+        }
+        if (!children || !snapshots) {
+            w->failed = true;
+            return;
+        }
+        w->childCapacity = capacity;
+    }
+
+    int first = w->childCount;
+    for (int a = 0; a < explore->actionCount; a++) {
+        int key = explore->actions[a];
+        VMRestoreSnapshot(w->vm, parent);
+        if (key != EXPLORE_NO_KEY) {
+            VMSetKey(w->vm, (uint8_t)key);
+        }
+        for (int f = 0; f < explore->frames; f++) {
+            VMTick(w->vm);
+        }
+        if (key != EXPLORE_NO_KEY) {
+            VMClearKey(w->vm, (uint8_t)key);
+        }
+
+        uint64_t hash = VMHashMachine(w->vm);
+        bool seen = Visited(explore, hash);
+        for (int i = first; i < w->childCount && !seen; i++) {
+            seen = w->children[i].hash == hash;
+        }
+        if (seen) {
+            continue;
+        }
+
+        int index = w->childCount++;
+        w->children[index] = (ExploreChild){
+            .hash = hash,
+            .parent = job,
+            .action = a,
+            .goal = MatchesGoal(explore, w->vm),
+            .worker = worker,
+            .snapshot = index,
+        };
+        VMTakeSnapshot(w->vm,
+                       w->snapshots + (size_t)index * explore->snapshotSize);
+    }
+}
+
+static int CompareChildren(const void *a, const void *b)
+{
+    const ExploreChild *x = a;
+    const ExploreChild *y = b;
+
+    if (x->parent != y->parent) {
+        return x->parent < y->parent ? -1 : 1;
+    }
+    return x->action - y->action;
+}
+
+// Adds the states the workers found to the search, in frontier and action
+// order so that the result does not depend on which thread found what.
+// Returns 0 on success and -1 on failure.
+static int MergeLevel(Explore *explore)
+{
+    int total = 0;
+    for (int i = 0; i < explore->workerCount; i++) {
+        if (explore->workers[i].failed) {
+            fprintf(stderr, "Failed to allocate the states of a level!\n");
+            return -1;
+        }
+        total += explore->workers[i].childCount;
+    }
+
+    ExploreChild *children = malloc(MAX(total, 1) * sizeof(ExploreChild));
+    if (!children) {
+        fprintf(stderr, "Failed to allocate the states of a level!\n");
+        return -1;
+    }
+    int count = 0;
+    for (int i = 0; i < explore->workerCount; i++) {
+        ExploreWorker *w = &explore->workers[i];
+        memcpy(children + count, w->children,
+               w->childCount * sizeof(ExploreChild));
+        count += w->childCount;
+    }
+    qsort(children, count, sizeof(ExploreChild), CompareChildren);
+
+    int result = 0;
+    for (int i = 0; i < count; i++) {
+        const ExploreChild *child = &children[i];
+        if (Visited(explore, child->hash)) {
+            continue;
+        }
+        if (explore->nodeCount == explore->maxStates) {
+            explore->truncated = true;
+            break;
+        }
+        const ExploreWorker *w = &explore->workers[child->worker];
+        if (AddState(explore, child->hash, explore->frontier[child->parent],
+                     explore->actions[child->action], child->goal,
+                     w->snapshots +
+                         (size_t)child->snapshot * explore->snapshotSize) !=
+            0) {
+            result = -1;
+            break;
+        }
+    }
+
+    free(children);
+    for (int i = 0; i < explore->workerCount; i++) {
+        explore->workers[i].childCount = 0;
+    }
+    return result;
+}
+
+static void ExploreFree(Explore *explore)
+{
+    if (explore->workers) {
+        for (int i = 0; i < explore->workerCount; i++) {
+            VMDestroy(explore->workers[i].vm);
+            free(explore->workers[i].children);
+            free(explore->workers[i].snapshots);
+        }
+    }
+    free(explore->workers);
+    free(explore->nodes);
+    free(explore->visited);
+    free(explore->frontier);
+    free(explore->frontierSnapshots);
+    free(explore->next);
+    free(explore->nextSnapshots);
+}
+
+static void WriteResult(FILE *out, const Explore *explore, const char *romPath,
+                        const char *quirks, const int *levels, int levelCount,
+                        size_t romSize, double wallMs)
+{
+    fputs("{\"rom\":", out);
+    ToolWriteJsonString(out, romPath);
+    fputs(",\"quirks\":", out);
+    ToolWriteJsonString(out, quirks);
+    fprintf(out, ",\"frames\":%d,\"keys\":\"", explore->frames);
+    for (int a = 0; a < explore->actionCount; a++) {
+        if (explore->actions[a] != EXPLORE_NO_KEY) {
+            fprintf(out, "%X", explore->actions[a]);
+        }
+    }
+    fprintf(out, "\",\"states\":%d,\"truncated\":%s,\"levels\":[",
+            explore->nodeCount, explore->truncated ? "true" : "false");
+    for (int i = 0; i < levelCount; i++) {
+        fprintf(out, "%s%d", i ? "," : "", levels[i]);
+    }
+
+    // Executed addresses are merged into ranges, an instruction apart at most.
+    uint8_t coverage[0x1000 / 8] = {0};
+    for (int i = 0; i < explore->workerCount; i++) {
+        for (size_t b = 0; b < sizeof(coverage); b++) {
+            coverage[b] |= explore->workers[i].coverage.addresses[b];
+        }
+    }
+    int addresses = 0;
+    int romAddresses = 0;
+    fputs("],\"coverage\":{\"ranges\":[", out);
+    int rangeStart = -1;
+    int rangeEnd = -1;
+    bool firstRange = true;
+    for (int address = 0; address <= 0x1000; address++) {
+        bool covered = address < 0x1000 &&
+                       coverage[address / 8] & (1 << (address % 8));
+        if (covered) {
+            addresses++;
+            romAddresses += address >= CHIP8_USERMEM_START &&
+                            (size_t)address < CHIP8_USERMEM_START + romSize;
+        }
+        if (rangeStart >= 0 && (address == 0x1000 || (covered &&
+                                address > rangeEnd + 2))) {
+            fprintf(out, "%s\"%03X-%03X\"", firstRange ? "" : ",", rangeStart,
+                    rangeEnd + 1);
+            firstRange = false;
+            rangeStart = -1;
+        }
+        if (covered) {
+            rangeStart = rangeStart < 0 ? address : rangeStart;
+            rangeEnd = address;
+        }
+    }
+    fprintf(out, "],\"addresses\":%d,\"rom_addresses\":%d,\"rom_size\":%zu}",
+            addresses, romAddresses, romSize);
+
+    // Inputs are listed from the start, one hex key or - per branch.
+    fprintf(out, ",\"goal_states\":%d,\"goals\":[", explore->goalCount);
+    for (int g = 0; g < MIN(explore->goalCount, EXPLORE_GOALS_MAX); g++) {
+        int length = 0;
+        for (int node = explore->goals[g]; explore->nodes[node].parent >= 0;
+             node = explore->nodes[node].parent) {
+            length++;
+        }
+        fprintf(out, "%s{\"depth\":%d,\"inputs\":\"", g ? "," : "", length);
+        for (int i = 0; i < length; i++) {
+            // Walk back from the goal to the input i branches in.
+            int node = explore->goals[g];
+            for (int up = length - 1; up > i; up--) {
+                node = explore->nodes[node].parent;
+            }
+            int key = explore->nodes[node].key;
+            fputc(key == EXPLORE_NO_KEY ? '-' : "0123456789ABCDEF"[key], out);
+        }
+        fputs("\"}", out);
+    }
+    fprintf(out, "],\"wall_ms\":%.3f}\n", wallMs);
+}
@@ -0,0 +1,937 @@
+// chip8-fuzz, mutates input movies to run as much of a ROM as it can.
+//
+// Every execution restores the ROM as loaded from a snapshot and replays an
+// input, a list of key transitions, in process with no window. Inputs are made
+// by mutating ones from the corpus, and an input that executes an address, or
+// takes a jump, call, return or skip between two addresses, that no input did
+// before joins the corpus. Executions run across every core in rounds, and the
+// corpus is merged between rounds in job order, so a given --seed and --execs
+// always give the same corpus whatever the thread count.
+//
+// With --corpus the corpus lives in a directory as movies that chip8-batch and
+// the frontend can replay, and a later run carries on from it. An input that
+// runs into a fault, an unknown instruction, PC leaving memory, the stack over
+// or underflowing or I reaching past memory, is saved once per fault and
+// address under crashes/.
+// The result is one JSON object with the coverage reached, the parts of the
+// ROM never executed and the faults found.
+
+#include "def.h"
+#include "adc_argp.h"
+#include "movie.h"
+#include "pool.h"
+#include "tool.h"
+#include "vm.h"
+
+#include <errno.h>
+#include <inttypes.h>
+
+#if defined(_WIN32)
+#include <direct.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+// Key transitions in an input, and faults reported.
+#define FUZZ_EVENTS_MAX 64
+#define FUZZ_CRASHES_MAX 256
+// Executions per round, the same whatever the thread count so that the corpus
+// is too.
+#define FUZZ_ROUND_JOBS 256
+#define FUZZ_PATH_MAX 1024
+
+typedef struct tFuzzInput {
+    uint64_t frames;
+    MovieEvent events[FUZZ_EVENTS_MAX];
+    int eventCount;
+} FuzzInput;
+
+// An execution of a round, and what it covered.
+typedef struct tFuzzRun {
+    FuzzInput input;
+    VMCoverage coverage;
+    uint64_t finalHash;
+    bool interesting;
+} FuzzRun;
+
+typedef struct tFuzzCrash {
+    uint32_t fault;
+    uint16_t address;
+    char path[FUZZ_PATH_MAX];
+} FuzzCrash;
+
+typedef struct tFuzz {
+    const char *corpusDir;
+    uint32_t romHash;
+    unsigned int seed;
+    int cyclesPerTick;
+    uint32_t quirks;
+    uint64_t frames;
+    uint8_t keys[16];
+    int keyCount;
+    uint8_t *root;
+
+    FuzzInput *corpus;
+    int corpusCount;
+    int corpusCapacity;
+    int corpusLoaded;
+    int nextId;
+    // Inputs run before fuzzing, nothing pressed and the corpus directory.
+    FuzzInput *queue;
+    int queueCount;
+
+    // Everything the corpus covers.
+    VMCoverage coverage;
+    FuzzCrash crashes[FUZZ_CRASHES_MAX];
+    int crashCount;
+
+    VM **vms;
+    int workerCount;
+    FuzzRun *runs;
+    uint64_t round;
+    uint64_t execs;
+} Fuzz;
+
+static int ParseKeys(Fuzz *fuzz, const char *str);
+static uint64_t NextRandom(uint64_t *state);
+static void SortEvents(FuzzInput *input);
+static void Mutate(const Fuzz *fuzz, FuzzInput *input, uint64_t *rng);
+static void Execute(const Fuzz *fuzz, VM *vm, FuzzRun *run);
+static uint64_t ReplayHash(const Fuzz *fuzz, VM *vm, const FuzzInput *input);
+static bool CoversMore(const VMCoverage *coverage, const VMCoverage *run);
+static int FindCrash(const Fuzz *fuzz, const VMCoverage *run);
+static void FuzzJob(void *user, int job, int worker);
+static int AddInput(Fuzz *fuzz, const FuzzRun *run, bool save);
+static int Merge(Fuzz *fuzz, int runCount, bool save);
+static int SaveInput(const Fuzz *fuzz, const FuzzRun *run,
+                     const char *filePath);
+static int MakeDir(const char *path);
+static int AddName(char ***names, int *count, const char *name);
+static int ListMovies(const char *dirPath, char ***names, int *count);
+static int CompareNames(const void *a, const void *b);
+static int QueueInput(Fuzz *fuzz, const FuzzInput *input);
+static int LoadCorpus(Fuzz *fuzz);
+static const char *FaultName(uint32_t faults);
+static int CountBits(const uint8_t *bits, size_t size);
+static void FuzzFree(Fuzz *fuzz);
+static void WriteResult(FILE *out, const Fuzz *fuzz, const char *romPath,
+                        const char *quirks, size_t romSize, double wallMs);
+
+int main(int argc, char *argv[])
+{
+    const char *romPath = NULL;
+    const char *outPath = NULL;
+    const char *corpusDir = NULL;
+    const char *keys = NULL;
+    const char *quirkNames = NULL;
+    int threadCount = 0;
+    int cyclesPerTick = 20;
+    unsigned int seed = 1;
+    int frames = 600;
+    int seconds = 60;
+    int execs = 0;
+
+    adc_argp_option opts[] = {
+        ADC_ARGP_HELP(),
+        ADC_ARGP_OPTION("rom", "r", ADC_ARGP_TYPE_STRING, &romPath,
+                        "ROM to fuzz. Required"),
+        ADC_ARGP_OPTION(
+            "out", "o", ADC_ARGP_TYPE_STRING, &outPath,
+            "Write the JSON result to this file. Defaults to stdout"),
+        ADC_ARGP_OPTION(
+            "corpus", "C", ADC_ARGP_TYPE_STRING, &corpusDir,
+            "Directory to keep the corpus in, created if missing. Defaults "
+            "to keeping it in memory"),
+        ADC_ARGP_OPTION(
+            "keys", "k", ADC_ARGP_TYPE_STRING, &keys,
+            "Keys to press as hex digits, e.g. 456. Defaults to all 16"),
+        ADC_ARGP_OPTION(
+            "frames", "f", ADC_ARGP_TYPE_UINT, &frames,
+            "Ticks each input runs for. Defaults to 600"),
+        ADC_ARGP_OPTION(
+            "seconds", "t", ADC_ARGP_TYPE_UINT, &seconds,
+            "Seconds to fuzz for, 0 for no limit. Defaults to 60"),
+        ADC_ARGP_OPTION(
+            "execs", "e", ADC_ARGP_TYPE_UINT, &execs,
+            "Executions to stop after, 0 for no limit. Defaults to 0"),
+        ADC_ARGP_OPTION(
+            "threads", "j", ADC_ARGP_TYPE_UINT, &threadCount,
+            "Worker threads. Defaults to 0, one per cpu"),
+        ADC_ARGP_OPTION(
+            "cycles", "c", ADC_ARGP_TYPE_UINT, &cyclesPerTick,
+            "Cycles per tick. Defaults to 20"),
+        ADC_ARGP_OPTION(
+            "seed", "s", ADC_ARGP_TYPE_UINT, &seed,
+            "Seed of the mutations and the rng. Defaults to 1"),
+        ADC_ARGP_OPTION(
+            "quirks", "q", ADC_ARGP_TYPE_STRING, &quirkNames,
+            "Quirks to emulate, as names or a number. Defaults to none")
+    };
+
+    adc_argp_parser *parser = adc_argp_new_parser(opts, ADC_ARGP_COUNT(opts));
+    if (!parser) {
+        fprintf(stderr, "Failed to create arg parser\n");
+        return EXIT_FAILURE;
+    }
+    int errors = adc_argp_parse(parser, argc, (const char **)argv);
+    if (errors > 0) {
+        adc_argp_print_errors(parser, stderr);
+    }
+    adc_argp_destroy_parser(&parser);
+    if (errors > 0) {
+        return EXIT_FAILURE;
+    }
+    if (!romPath) {
+        fprintf(stderr, "No rom given, use --rom!\n");
+        return EXIT_FAILURE;
+    }
+    if (cyclesPerTick <= 0 || frames <= 0) {
+        fprintf(stderr, "Cycles and frames must be positive!\n");
+        return EXIT_FAILURE;
+    }
+    if (seconds == 0 && execs == 0) {
+        fprintf(stderr, "Give --seconds or --execs a limit!\n");
+        return EXIT_FAILURE;
+    }
+    if (seed == 0) {
+        fprintf(stderr, "The seed must not be 0, inputs must replay!\n");
+        return EXIT_FAILURE;
+    }
+    uint32_t quirks = 0;
+    if (quirkNames && VMParseQuirks(quirkNames, &quirks) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    Fuzz fuzz = {0};
+    fuzz.corpusDir = corpusDir;
+    fuzz.seed = seed;
+    fuzz.cyclesPerTick = cyclesPerTick;
+    fuzz.quirks = quirks;
+    fuzz.frames = frames;
+    if (ParseKeys(&fuzz, keys ? keys : "0123456789ABCDEF") != 0) {
+        return EXIT_FAILURE;
+    }
+
+    int result = EXIT_FAILURE;
+    FILE *out = NULL;
+    Pool *pool = NULL;
+    VM *vm = NULL;
+    uint8_t rom[CHIP8_USERMEM_TOTAL + 1];
+    size_t romSize = sizeof(rom);
+    if (ToolReadRom(romPath, rom, &romSize) != 0) {
+        goto error;
+    }
+
+    // Every execution starts from the ROM as loaded.
+    vm = VMCreate(cyclesPerTick, VMCOLOR_PALETTE_ORIGINAL, seed);
+    if (!vm) {
+        goto error;
+    }
+    VMSetQuirks(vm, quirks);
+    if (VMLoadRomData(vm, rom, romSize) != 0) {
+        goto error;
+    }
+    fuzz.romHash = VMGetRomHash(vm);
+    fuzz.root = malloc(VMSnapshotSize());
+    if (!fuzz.root) {
+        fprintf(stderr, "Failed to allocate the fuzzer!\n");
+        goto error;
+    }
+    VMTakeSnapshot(vm, fuzz.root);
+
+    pool = PoolCreate(threadCount);
+    if (!pool) {
+        goto error;
+    }
+    fuzz.workerCount = PoolThreadCount(pool);
+    fuzz.vms = calloc(fuzz.workerCount, sizeof(VM *));
+    fuzz.runs = calloc(FUZZ_ROUND_JOBS, sizeof(FuzzRun));
+    if (!fuzz.vms || !fuzz.runs) {
+        fprintf(stderr, "Failed to allocate the fuzzer!\n");
+        goto error;
+    }
+    for (int i = 0; i < fuzz.workerCount; i++) {
+        fuzz.vms[i] = VMCreate(cyclesPerTick, VMCOLOR_PALETTE_ORIGINAL, seed);
+        if (!fuzz.vms[i]) {
+            goto error;
+        }
+    }
+
+    // The corpus starts from doing nothing, then whatever was kept before,
+    // merged a round of runs at a time.
+    FuzzInput idle = { .frames = fuzz.frames };
+    if (QueueInput(&fuzz, &idle) != 0 ||
+        (corpusDir && LoadCorpus(&fuzz) != 0)) {
+        goto error;
+    }
+    for (int first = 0; first < fuzz.queueCount; first += FUZZ_ROUND_JOBS) {
+        int runCount = MIN(FUZZ_ROUND_JOBS, fuzz.queueCount - first);
+        for (int i = 0; i < runCount; i++) {
+            fuzz.runs[i].input = fuzz.queue[first + i];
+            Execute(&fuzz, vm, &fuzz.runs[i]);
+            fuzz.runs[i].interesting = true;
+        }
+        if (Merge(&fuzz, runCount, false) != 0) {
+            goto error;
+        }
+    }
+    fuzz.corpusLoaded = fuzz.corpusCount;
+
+    double start = ToolNowSeconds();
+    double lastStatus = start;
+    uint64_t execLimit = execs > 0 ? (uint64_t)execs : UINT64_MAX;
+    while (fuzz.execs < execLimit &&
+           (seconds == 0 || ToolNowSeconds() - start < seconds)) {
+        int jobCount =
+            (int)MIN((uint64_t)FUZZ_ROUND_JOBS, execLimit - fuzz.execs);
+        PoolRun(pool, jobCount, FuzzJob, &fuzz);
+        fuzz.execs += jobCount;
+        fuzz.round++;
+        if (Merge(&fuzz, jobCount, corpusDir != NULL) != 0) {
+            goto error;
+        }
+
+        double now = ToolNowSeconds();
+        if (now - lastStatus >= 1.0) {
+            fprintf(stderr,
+                    "%.0fs: %" PRIu64 " execs, %.0f/s, corpus %d, "
+                    "addresses %d, edges %d, faults %d\n",
+                    now - start, fuzz.execs, fuzz.execs / (now - start),
+                    fuzz.corpusCount,
+                    CountBits(fuzz.coverage.addresses,
+                              sizeof(fuzz.coverage.addresses)),
+                    CountBits(fuzz.coverage.edges,
+                              sizeof(fuzz.coverage.edges)),
+                    fuzz.crashCount);
+            lastStatus = now;
+        }
+    }
+    double elapsed = ToolNowSeconds() - start;
+
+    out = outPath ? fopen(outPath, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Failed to open %s for writing!\n", outPath);
+        goto error;
+    }
+    char quirkText[128];
+    VMFormatQuirks(quirks, quirkText, sizeof(quirkText));
+    WriteResult(out, &fuzz, romPath, quirkText, romSize, elapsed * 1000.0);
+    if (out != stdout && fclose(out) != 0) {
+        fprintf(stderr, "Failed to write %s!\n", outPath);
+        goto error;
+    }
+
+    fprintf(stderr,
+            "Fuzzing finished! %" PRIu64 " execs on %d threads in %.03fs, "
+            "corpus %d with %d new, %d faults\n",
+            fuzz.execs, fuzz.workerCount, elapsed, fuzz.corpusCount,
+            fuzz.corpusCount - fuzz.corpusLoaded, fuzz.crashCount);
+    result = EXIT_SUCCESS;
+
+error:
+    VMDestroy(vm);
+    PoolDestroy(pool);
+    FuzzFree(&fuzz);
+    return result;
+}
+
+static int ParseKeys(Fuzz *fuzz, const char *str)
+{
+    if (ToolParseKeys(str, fuzz->keys, &fuzz->keyCount) != 0) {
+        return -1;
+    }
+    if (fuzz->keyCount == 0) {
+        fprintf(stderr, "No keys given to press!\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// splitmix64.
+static uint64_t NextRandom(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Insertion sort, stable so transitions on the same cycle keep their order.
+static void SortEvents(FuzzInput *input)
+{
+    for (int i = 1; i < input->eventCount; i++) {
+        MovieEvent event = input->events[i];
+        int j = i;
+        while (j > 0 && (input->events[j - 1].tick > event.tick ||
+                         (input->events[j - 1].tick == event.tick &&
+                          input->events[j - 1].cycle > event.cycle))) {
+            input->events[j] = input->events[j - 1];
+            j--;
+        }
+        input->events[j] = event;
+    }
+}
+
+// Applies a few random edits to an input: pressing a key for a while,
+// dropping, moving or changing a transition, splicing in the tail of another
+// input or cutting the input short.
+static void Mutate(const Fuzz *fuzz, FuzzInput *input, uint64_t *rng)
+{
+    int edits = 1 + (int)(NextRandom(rng) % 4);
+    for (int e = 0; e < edits; e++) {
+        uint64_t tick = NextRandom(rng) % fuzz->frames;
+        int cycle = (int)(NextRandom(rng) % fuzz->cyclesPerTick);
+        int pick = input->eventCount > 0 ?
+                       (int)(NextRandom(rng) % input->eventCount) : -1;
+        MovieEvent *event = pick >= 0 ? &input->events[pick] : NULL;
+
+        switch (NextRandom(rng) % 6) {
+        case 0:
+            if (input->eventCount + 2 <= FUZZ_EVENTS_MAX) {
+                uint8_t key = fuzz->keys[NextRandom(rng) % fuzz->keyCount];
+                uint64_t held = 1 + NextRandom(rng) % 30;
+                input->events[input->eventCount++] = (MovieEvent){
+                    .tick = tick, .cycle = cycle, .key = key, .pressed = true
+                };
+                input->events[input->eventCount++] = (MovieEvent){
+                    .tick = MIN(tick + held, fuzz->frames - 1),
+                    .cycle = cycle,
+                    .key = key,
+                    .pressed = false
+                };
+            }
+            break;
+        case 1:
+            if (event) {
+                *event = input->events[--input->eventCount];
+            }
+            break;
+        case 2:
+            if (event) {
+                int64_t shift = (int64_t)(NextRandom(rng) % 61) - 30;
+                int64_t moved = (int64_t)event->tick + shift;
+                event->tick = (uint64_t)MIN(
+                    MAX(moved, 0), (int64_t)fuzz->frames - 1);
+                event->cycle = cycle;
+            }
+            break;
+        case 3:
+            if (event) {
+                event->key = fuzz->keys[NextRandom(rng) % fuzz->keyCount];
+            }
+            break;
+        case 4: {
+            const FuzzInput *other =
+                &fuzz->corpus[NextRandom(rng) % fuzz->corpusCount];
+            int kept = 0;
+            for (int i = 0; i < input->eventCount; i++) {
+                if (input->events[i].tick < tick) {
+                    input->events[kept++] = input->events[i];
+                }
+            }
+            for (int i = 0; i < other->eventCount && kept < FUZZ_EVENTS_MAX;
+                 i++) {
+                if (other->events[i].tick >= tick) {
+                    input->events[kept++] = other->events[i];
+                }
+            }
+            input->eventCount = kept;
+            break;
+        }
+        default: {
+            int kept = 0;
+            for (int i = 0; i < input->eventCount; i++) {
+                if (input->events[i].tick < tick) {
+                    input->events[kept++] = input->events[i];
+                }
+            }
+            input->eventCount = kept;
+            break;
+        }
+        }
+        SortEvents(input);
+    }
+}
+
+// Runs an input from the ROM as loaded, for its frames or until the tick it
+// faults on, and records what it covers. Waits for the delay timer are
+// skipped rather than run.
+static void Execute(const Fuzz *fuzz, VM *vm, FuzzRun *run)
+{
+    FuzzInput *input = &run->input;
+
+    memset(&run->coverage, 0, sizeof(run->coverage));
+    VMSetCoverage(vm, &run->coverage);
+    VMRestoreSnapshot(vm, fuzz->root);
+
+    uint64_t tick = 0;
+    int next = 0;
+    while (tick < input->frames && !run->coverage.faults) {
+        while (next < input->eventCount && input->events[next].tick <= tick) {
+            const MovieEvent *event = &input->events[next++];
+            VMScheduleKeyAt(vm, event->key, event->pressed, event->tick,
+                            event->cycle);
+        }
+
+        uint64_t until =
+            next < input->eventCount ? input->events[next].tick : input->frames;
+        uint64_t idle = MIN(VMGetIdleTicks(vm), until - tick);
+        if (idle > 0) {
+            VMSkipTicks(vm, idle);
+            tick += idle;
+        } else {
+            VMTick(vm);
+            tick++;
+        }
+    }
+
+    // An input that faulted ends there, so that its movie replays to it.
+    input->frames = tick;
+    while (input->eventCount > 0 &&
+           input->events[input->eventCount - 1].tick >= tick) {
+        input->eventCount--;
+    }
+    VMSetCoverage(vm, NULL);
+    // The faulting cycle ended its tick early, which a replay does not do.
+    run->finalHash =
+        run->coverage.faults ? ReplayHash(fuzz, vm, input)
+                             : VMHashMovieState(vm);
+}
+
+// Runs an input from the ROM as loaded the way a replay does, and returns the
+// VMHashMovieState() it ends on.
+static uint64_t ReplayHash(const Fuzz *fuzz, VM *vm, const FuzzInput *input)
+{
+    VMRestoreSnapshot(vm, fuzz->root);
+
+    int next = 0;
+    for (uint64_t tick = 0; tick < input->frames; tick++) {
+        while (next < input->eventCount && input->events[next].tick <= tick) {
+            const MovieEvent *event = &input->events[next++];
+            VMScheduleKeyAt(vm, event->key, event->pressed, event->tick,
+                            event->cycle);
+        }
+        VMTick(vm);
+    }
+
+    return VMHashMovieState(vm);
+}
+
+static bool CoversMore(const VMCoverage *coverage, const VMCoverage *run)
+{
+    for (size_t i = 0; i < sizeof(run->addresses); i++) {
+        if (run->addresses[i] & ~coverage->addresses[i]) {
+            return true;
+        }
+    }
+    for (size_t i = 0; i < sizeof(run->edges); i++) {
+        if (run->edges[i] & ~coverage->edges[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns the index of the crash a faulting run matches, or -1 if it is new.
+static int FindCrash(const Fuzz *fuzz, const VMCoverage *run)
+{
+    uint32_t fault = run->faults & -run->faults;
+    for (int i = 0; i < fuzz->crashCount; i++) {
+        if (fuzz->crashes[i].fault == fault &&
+            fuzz->crashes[i].address == run->faultAddress) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Mutates an input from the corpus and runs it. Each job draws from its own
+// rng so that what it runs does not depend on the thread it runs on.
+static void FuzzJob(void *user, int job, int worker)
+{
+    Fuzz *fuzz = user;
+    FuzzRun *run = &fuzz->runs[job];
+    uint64_t rng = ((uint64_t)fuzz->seed << 32) ^
+                   (fuzz->round * 0x100000001B3ull) ^ (uint64_t)job;
+    NextRandom(&rng);
+
+    run->input = fuzz->corpus[NextRandom(&rng) % fuzz->corpusCount];
+    run->input.frames = fuzz->frames;
+    Mutate(fuzz, &run->input, &rng);
+    Execute(fuzz, fuzz->vms[worker], run);
+
+    run->interesting =
+        CoversMore(&fuzz->coverage, &run->coverage) ||
+        (run->coverage.faults && FindCrash(fuzz, &run->coverage) < 0);
+}
+
+// Adds an input to the corpus, and to the corpus directory if save is set.
+// Returns 0 on success and -1 on failure.
+static int AddInput(Fuzz *fuzz, const FuzzRun *run, bool save)
+{
+    if (fuzz->corpusCount == fuzz->corpusCapacity) {
+        int capacity = fuzz->corpusCapacity ? fuzz->corpusCapacity * 2 : 64;
+        FuzzInput *corpus =
+            realloc(fuzz->corpus, capacity * sizeof(FuzzInput));
+        if (!corpus) {
+            fprintf(stderr, "Failed to grow the corpus to %d inputs!\n",
+                    capacity);
+            return -1;
+        }
+        fuzz->corpus = corpus;
+        fuzz->corpusCapacity = capacity;
+    }
+    fuzz->corpus[fuzz->corpusCount++] = run->input;
+
+    if (save) {
+        char path[FUZZ_PATH_MAX];
+        snprintf(path, sizeof(path), "%s/id-%06d.movie", fuzz->corpusDir,
+                 fuzz->nextId++);
+        return SaveInput(fuzz, run, path);
+    }
+    return 0;
+}
+
+// Adds the runs that cover more than the corpus, in job order, and records
+// the faults they found. Returns 0 on success and -1 on failure.
+static int Merge(Fuzz *fuzz, int runCount, bool save)
+{
+    for (int i = 0; i < runCount; i++) {
+        const FuzzRun *run = &fuzz->runs[i];
+        if (!run->interesting) {
+            continue;
+        }
+
+        if (CoversMore(&fuzz->coverage, &run->coverage)) {
+            for (size_t b = 0; b < sizeof(fuzz->coverage.addresses); b++) {
+                fuzz->coverage.addresses[b] |= run->coverage.addresses[b];
+            }
+            for (size_t b = 0; b < sizeof(fuzz->coverage.edges); b++) {
+                fuzz->coverage.edges[b] |= run->coverage.edges[b];
+            }
+            if (AddInput(fuzz, run, save) != 0) {
+                return -1;
+            }
+        }
+
+        if (run->coverage.faults && FindCrash(fuzz, &run->coverage) < 0 &&
+            fuzz->crashCount < FUZZ_CRASHES_MAX) {
+            FuzzCrash *crash = &fuzz->crashes[fuzz->crashCount++];
+            crash->fault = run->coverage.faults & -run->coverage.faults;
+            crash->address = run->coverage.faultAddress;
+            crash->path[0] = '\0';
+            if (fuzz->corpusDir) {
+                snprintf(crash->path, sizeof(crash->path),
+                         "%s/crashes/%s-%03X.movie", fuzz->corpusDir,
+                         FaultName(crash->fault), crash->address);
+                if (SaveInput(fuzz, run, crash->path) != 0) {
+                    return -1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int SaveInput(const Fuzz *fuzz, const FuzzRun *run,
+                     const char *filePath)
+{
+    Movie movie;
+    MovieInit(&movie, fuzz->romHash, fuzz->seed, fuzz->cyclesPerTick,
+              fuzz->quirks);
+    movie.frames = run->input.frames;
+    movie.finalHash = run->finalHash;
+    for (int i = 0; i < run->input.eventCount; i++) {
+        if (MovieAppend(&movie, run->input.events[i]) != 0) {
+            MovieFree(&movie);
+            return -1;
+        }
+    }
+
+    int result = MovieSave(&movie, filePath);
+    MovieFree(&movie);
+    return result;
+}
+
+// Creates a directory if it is missing. Returns 0 on success and -1 on
+// failure.
+static int MakeDir(const char *path)
+{
+#if defined(_WIN32)
+    int made = _mkdir(path);
+#else
+    int made = mkdir(path, 0777);
+#endif
+    if (made != 0 && errno != EEXIST) {
+        fprintf(stderr, "Failed to create directory %s!\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// Adds a copy of a name to a growing list. Returns 0 on success and -1 on
+// failure.
+static int AddName(char ***names, int *count, const char *name)
+{
+    if ((*count & (*count - 1)) == 0) {
+        char **grown = realloc(*names, MAX(*count * 2, 1) * sizeof(char *));
+        if (!grown) {
+            return -1;
+        }
+        *names = grown;
+    }
+
+    char *copy = malloc(strlen(name) + 1);
+    if (!copy) {
+        return -1;
+    }
+    strcpy(copy, name);
+    (*names)[(*count)++] = copy;
+    return 0;
+}
+
+#if defined(_WIN32)
+
+// Lists the names of the movies in a directory, to be freed by the caller.
+// Returns 0 on success and -1 on failure.
+static int ListMovies(const char *dirPath, char ***names, int *count)
+{
+    char pattern[FUZZ_PATH_MAX];
+    snprintf(pattern, sizeof(pattern), "%s/*.movie", dirPath);
+
+    WIN32_FIND_DATAA found;
+    HANDLE find = FindFirstFileA(pattern, &found);
+    if (find == INVALID_HANDLE_VALUE) {
+        return GetLastError() == ERROR_FILE_NOT_FOUND ? 0 : -1;
+    }
+    int result = 0;
+    do {
+        result = AddName(names, count, found.cFileName);
+    } while (result == 0 && FindNextFileA(find, &found));
+    FindClose(find);
+
+    return result;
+}
+
+#else
+
+// Lists the names of the movies in a directory, to be freed by the caller.
+// Returns 0 on success and -1 on failure.
+static int ListMovies(const char *dirPath, char ***names, int *count)
+{
+    DIR *dir = opendir(dirPath);
+    if (!dir) {
+        return -1;
+    }
+
+    int result = 0;
+    for (struct dirent *entry = readdir(dir); entry && result == 0;
+         entry = readdir(dir)) {
+        size_t length = strlen(entry->d_name);
+        if (length > 6 && strcmp(entry->d_name + length - 6, ".movie") == 0) {
+            result = AddName(names, count, entry->d_name);
+        }
+    }
+    closedir(dir);
+
+    return result;
+}
+
+#endif
+
+static int CompareNames(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Adds an input to the ones run before fuzzing. Returns 0 on success and -1
+// on failure.
+static int QueueInput(Fuzz *fuzz, const FuzzInput *input)
+{
+    if ((fuzz->queueCount & (fuzz->queueCount - 1)) == 0) {
+        FuzzInput *grown = realloc(
+            fuzz->queue, MAX(fuzz->queueCount * 2, 1) * sizeof(FuzzInput));
+        if (!grown) {
+            fprintf(stderr, "Failed to load the corpus!\n");
+            return -1;
+        }
+        fuzz->queue = grown;
+    }
+    fuzz->queue[fuzz->queueCount++] = *input;
+    return 0;
+}
+
+// Queues the movies of the corpus directory that replay the same way in this
+// run, recorded with its ROM, seed, cycles and quirks, in name order, and
+// picks the id of the next movie saved. Returns 0 on success and -1 on failure.
+static int LoadCorpus(Fuzz *fuzz)
+{
+    char path[FUZZ_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/crashes", fuzz->corpusDir);
+    if (MakeDir(fuzz->corpusDir) != 0 || MakeDir(path) != 0) {
+        return -1;
+    }
+
+    char **names = NULL;
+    int nameCount = 0;
+    int result = ListMovies(fuzz->corpusDir, &names, &nameCount);
+    if (result != 0) {
+        fprintf(stderr, "Failed to list the corpus in %s!\n",
+                fuzz->corpusDir);
+    } else {
+        qsort(names, nameCount, sizeof(char *), CompareNames);
+    }
+
+    int skipped = 0;
+    for (int i = 0; i < nameCount && result == 0; i++) {
+        int id;
+        if (sscanf(names[i], "id-%d", &id) == 1) {
+            fuzz->nextId = MAX(fuzz->nextId, id + 1);
+        }
+
+        Movie movie;
+        snprintf(path, sizeof(path), "%s/%s", fuzz->corpusDir, names[i]);
+        if (MovieLoad(&movie, path) != 0) {
+            continue;
+        }
+        bool sameRom = movie.romHash == fuzz->romHash;
+        if (sameRom && (movie.seed != fuzz->seed ||
+                        movie.cyclesPerTick != fuzz->cyclesPerTick ||
+                        movie.quirks != fuzz->quirks)) {
+            skipped++;
+        } else if (sameRom) {
+            FuzzInput input = { .frames = fuzz->frames };
+            for (int e = 0; e < movie.eventCount &&
+                            input.eventCount < FUZZ_EVENTS_MAX; e++) {
+                if (movie.events[e].tick < fuzz->frames) {
+                    input.events[input.eventCount++] = movie.events[e];
+                }
+            }
+            result = QueueInput(fuzz, &input);
+        }
+        MovieFree(&movie);
+    }
+    if (skipped > 0) {
+        fprintf(stderr,
+                "Skipped %d movies in %s recorded with another seed, "
+                "cycles or quirks setting\n",
+                skipped, fuzz->corpusDir);
+    }
+
+    for (int i = 0; i < nameCount; i++) {
+        free(names[i]);
+    }
+    free(names);
+    return result;
+}
+
+static const char *FaultName(uint32_t faults)
+{
+    if (faults & VMFAULT_OPCODE) {
+        return "opcode";
+    }
+    if (faults & VMFAULT_PC) {
+        return "pc";
+    }
+    if (faults & VMFAULT_STACK_OVERFLOW) {
+        return "stack-overflow";
+    }
+    if (faults & VMFAULT_STACK_UNDERFLOW) {
+        return "stack-underflow";
+    }
+    if (faults & VMFAULT_MEMORY) {
+        return "memory";
+    }
+    return "none";
+}
+
+static int CountBits(const uint8_t *bits, size_t size)
+{
+    int count = 0;
+    for (size_t i = 0; i < size; i++) {
+        for (uint8_t b = bits[i]; b; b &= b - 1) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static void FuzzFree(Fuzz *fuzz)
+{
+    if (fuzz->vms) {
+        for (int i = 0; i < fuzz->workerCount; i++) {
+            VMDestroy(fuzz->vms[i]);
+        }
+    }
+    free(fuzz->vms);
+    free(fuzz->runs);
+    free(fuzz->corpus);
+    free(fuzz->queue);
+    free(fuzz->root);
+}
+
+static void WriteResult(FILE *out, const Fuzz *fuzz, const char *romPath,
+                        const char *quirks, size_t romSize, double wallMs)
+{
+    const uint8_t *addresses = fuzz->coverage.addresses;
+
+    fputs("{\"rom\":", out);
+    ToolWriteJsonString(out, romPath);
+    fputs(",\"quirks\":", out);
+    ToolWriteJsonString(out, quirks);
+    fprintf(out,
+            ",\"frames\":%" PRIu64 ",\"execs\":%" PRIu64
+            ",\"execs_per_sec\":%.1f,\"corpus\":%d,\"corpus_new\":%d",
+            fuzz->frames, fuzz->execs,
+            wallMs > 0 ? fuzz->execs / (wallMs / 1000.0) : 0.0,
+            fuzz->corpusCount, fuzz->corpusCount - fuzz->corpusLoaded);
+
+    // A byte of the ROM was executed if an instruction starts on it or the
+    // byte before it. Those never executed are listed as ranges.
+    int romAddresses = 0;
+    fprintf(out, ",\"coverage\":{\"addresses\":%d,\"edges\":%d,",
+            CountBits(addresses, sizeof(fuzz->coverage.addresses)),
+            CountBits(fuzz->coverage.edges, sizeof(fuzz->coverage.edges)));
+    fputs("\"unexecuted\":[", out);
+    size_t end = CHIP8_USERMEM_START + romSize;
+    int rangeStart = -1;
+    bool firstRange = true;
+    for (size_t address = CHIP8_USERMEM_START; address <= end; address++) {
+        bool executed = false;
+        if (address < end) {
+            executed = addresses[address / 8] & (1 << (address % 8)) ||
+                       addresses[(address - 1) / 8] &
+                           (1 << ((address - 1) % 8));
+            romAddresses += (addresses[address / 8] >> (address % 8)) & 1;
+        }
+        if (!executed && address < end && rangeStart < 0) {
+            rangeStart = (int)address;
+        }
+        if ((executed || address == end) && rangeStart >= 0) {
+            fprintf(out, "%s\"%03X-%03X\"", firstRange ? "" : ",", rangeStart,
+                    (int)address);
+            firstRange = false;
+            rangeStart = -1;
+        }
+    }
+    fprintf(out, "],\"rom_addresses\":%d,\"rom_size\":%zu}", romAddresses,
+            romSize);
+
+    fputs(",\"faults\":[", out);
+    for (int i = 0; i < fuzz->crashCount; i++) {
+        const FuzzCrash *crash = &fuzz->crashes[i];
+        fprintf(out, "%s{\"fault\":\"%s\",\"address\":\"%03X\",\"movie\":",
+                i ? "," : "", FaultName(crash->fault), crash->address);
+        if (crash->path[0]) {
+            ToolWriteJsonString(out, crash->path);
+        } else {
+            fputs("null", out);
+        }
+        fputc('}', out);
+    }
+    fprintf(out, "],\"wall_ms\":%.3f}\n", wallMs);
+}
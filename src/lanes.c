@@ -0,0 +1,1214 @@
+#include "lanes.h"
+
+#include "arena.h"
+
+#include <stddef.h>
+#include <time.h>
+
+// Lane vectors hold one byte of LANE_VEC_BYTES lanes. Without SSE2 they are
+// single bytes, which runs the same code one lane at a time.
+#if defined(__AVX2__)
+#include <immintrin.h>
+typedef __m256i LaneVec;
+#define LANE_VEC_BYTES 32
+#elif defined(__SSE2__) || defined(_M_X64) ||                                  \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+typedef __m128i LaneVec;
+#define LANE_VEC_BYTES 16
+#else
+typedef uint8_t LaneVec;
+#define LANE_VEC_BYTES 1
+#endif
+
+// The bytes of a Chip8 below the font and from PC to the end of the rng are
+// its registers and display. The lanes keep those in the block instead, so an
+// instruction touching their addresses runs on a copy of the lane's Chip8.
+#define REGS_LOW_END offsetof(Chip8, font)
+#define REGS_HIGH_BEGIN offsetof(Chip8, PC)
+#define REGS_HIGH_END (offsetof(Chip8, rng) + sizeof(uint32_t))
+
+#define LANES_PAGES (0x1000 / ARENA_PAGE_SIZE)
+#define LANES_GRANULE 16
+
+typedef union tOpcode {
+    uint16_t val;
+
+    struct {
+        unsigned int n : 4;
+        unsigned int y : 4;
+        unsigned int x : 4;
+        unsigned int u : 4;
+    };
+} Opcode;
+
+typedef struct tLaneBlock {
+    uint8_t V[16][LANES_WIDTH];
+    uint8_t delayTimer[LANES_WIDTH];
+    uint8_t soundTimer[LANES_WIDTH];
+    uint8_t SP[LANES_WIDTH];
+    uint8_t waitReg[LANES_WIDTH];
+    uint16_t keys[LANES_WIDTH];
+    uint16_t PC[LANES_WIDTH];
+    uint16_t I[LANES_WIDTH];
+    uint16_t stack[CHIP8_STACK_MAX][LANES_WIDTH];
+    uint32_t rng[LANES_WIDTH];
+    uint32_t seed[LANES_WIDTH];
+    uint64_t cycles[LANES_WIDTH];
+
+    // Bit n of each mask is lane n. used are the lanes that exist and waiting
+    // those blocked on Fx0A.
+    uint32_t used;
+    uint32_t waiting;
+    // The lanes that have written each LANES_GRANULE bytes of memory. Lanes
+    // only need their opcodes compared when they may have rewritten the code
+    // they are running, and programs often keep variables right next to it.
+    uint32_t writers[0x1000 / LANES_GRANULE];
+
+    // The memory of each lane, as the arena page holding each ARENA_PAGE_SIZE
+    // bytes of it. Lanes start on the pages of the ROM, which they all share,
+    // and get a copy of their own the first time they write to a page. The
+    // bytes of the registers and display in the pages are only current around
+    // LaneFallback().
+    uint32_t pages[LANES_PAGES][LANES_WIDTH];
+    uint8_t display[LANES_WIDTH][(CHIP8_W * CHIP8_H) / 8];
+} LaneBlock;
+
+struct tLanes {
+    LaneBlock *blocks;
+    int blockCount;
+    int laneCount;
+    int cyclesPerTick;
+    uint32_t quirks;
+
+    Arena arena;
+    // The pages of the ROM, loaded into a fresh Chip8.
+    uint32_t romPages[LANES_PAGES];
+    // Set when a lane could not get a page of its own.
+    bool outOfMemory;
+};
+
+static int LanesReset(Lanes *lanes, const uint8_t *data, size_t size);
+static void BlockCycle(Lanes *lanes, LaneBlock *b);
+static bool IsLockstep(Opcode op);
+static void ExecGroup(Lanes *lanes, LaneBlock *b, uint32_t group, Opcode op);
+static void ExecLane(Lanes *lanes, LaneBlock *b, int l, Opcode op);
+static void LaneFallback(Lanes *lanes, LaneBlock *b, int l);
+static void LaneSyncOut(Lanes *lanes, LaneBlock *b, int l, Chip8 *c);
+static void LaneSyncIn(Lanes *lanes, LaneBlock *b, int l, const Chip8 *c);
+static void LaneStore(Lanes *lanes, LaneBlock *b, int l, uint32_t address,
+                      uint8_t value);
+static uint8_t *LanePageCopy(Lanes *lanes, LaneBlock *b, int l, int page);
+static void MarkWritten(LaneBlock *b, int l, uint32_t address, uint32_t size);
+static inline uint8_t LaneLoad(const Lanes *lanes, const LaneBlock *b, int l,
+                               uint32_t address);
+static inline bool AliasesRegisters(uint32_t address, uint32_t size);
+static inline int FirstLane(uint32_t lanes);
+static inline void ExpandMask(uint32_t lanes, uint8_t mask[LANES_WIDTH]);
+
+static inline LaneVec VecLoad(const uint8_t *p);
+static inline void VecStore(uint8_t *p, LaneVec a);
+static inline LaneVec VecSet1(uint8_t v);
+static inline LaneVec VecAdd(LaneVec a, LaneVec b);
+static inline LaneVec VecSub(LaneVec a, LaneVec b);
+static inline LaneVec VecAnd(LaneVec a, LaneVec b);
+static inline LaneVec VecOr(LaneVec a, LaneVec b);
+static inline LaneVec VecXor(LaneVec a, LaneVec b);
+static inline LaneVec VecAndNot(LaneVec a, LaneVec b);
+static inline LaneVec VecCmpEq(LaneVec a, LaneVec b);
+static inline LaneVec VecMin(LaneVec a, LaneVec b);
+static inline LaneVec VecShr1(LaneVec a);
+static inline LaneVec VecBlend(LaneVec mask, LaneVec a, LaneVec b);
+static inline uint32_t VecMoveMask(LaneVec a);
+static inline LaneVec VecGt(LaneVec a, LaneVec b);
+
+Lanes *LanesCreate(int laneCount, int cyclesPerTick, unsigned int seed)
+{
+    if (laneCount <= 0 || cyclesPerTick <= 0) {
+        fprintf(stderr, "Lanes need a positive lane count and cycles!\n");
+        return NULL;
+    }
+
+    Lanes *lanes = calloc(1, sizeof(Lanes));
+    if (!lanes) {
+        goto error;
+    }
+    ArenaInit(&lanes->arena);
+    lanes->laneCount = laneCount;
+    lanes->cyclesPerTick = cyclesPerTick;
+    lanes->blockCount = (laneCount + LANES_WIDTH - 1) / LANES_WIDTH;
+    lanes->blocks = calloc(lanes->blockCount, sizeof(LaneBlock));
+    if (!lanes->blocks) {
+        goto error;
+    }
+
+    uint32_t base = seed != 0 ? seed : (uint32_t)time(NULL);
+    for (int i = 0; i < lanes->blockCount; i++) {
+        LaneBlock *b = &lanes->blocks[i];
+        int count = MIN(laneCount - i * LANES_WIDTH, LANES_WIDTH);
+        b->used = count == LANES_WIDTH ? ~(uint32_t)0 :
+                                         ((uint32_t)1 << count) - 1;
+        for (int l = 0; l < LANES_WIDTH; l++) {
+            // Chip8Init() swaps a zero seed for one that is never zero.
+            Chip8 seeded;
+            Chip8Init(&seeded, base + (uint32_t)(i * LANES_WIDTH + l));
+            b->seed[l] = seeded.rng;
+        }
+    }
+
+    if (LanesReset(lanes, NULL, 0) < 0) {
+        goto error;
+    }
+
+    return lanes;
+
+error:
+    fprintf(stderr, "Failed to allocate %d lanes!\n", laneCount);
+    LanesDestroy(lanes);
+    return NULL;
+}
+
+void LanesDestroy(Lanes *lanes)
+{
+    if (!lanes) {
+        return;
+    }
+
+    ArenaDestroy(&lanes->arena);
+    free(lanes->blocks);
+    free(lanes);
+}
+
+int LanesGetCount(const Lanes *lanes)
+{
+    assert(lanes != NULL);
+
+    return lanes->laneCount;
+}
+
+void LanesSetQuirks(Lanes *lanes, uint32_t quirks)
+{
+    assert(lanes != NULL);
+
+    lanes->quirks = quirks & CHIP8_QUIRK_ALL;
+}
+
+void LanesSetSeed(Lanes *lanes, int lane, unsigned int seed)
+{
+    assert(lanes != NULL);
+    assert(lane >= 0 && lane < lanes->laneCount);
+
+    LaneBlock *b = &lanes->blocks[lane / LANES_WIDTH];
+    int l = lane % LANES_WIDTH;
+
+    Chip8 seeded;
+    Chip8Init(&seeded, seed);
+    b->seed[l] = seeded.rng;
+    b->rng[l] = seeded.rng;
+}
+
+int LanesLoadRom(Lanes *lanes, const uint8_t *data, size_t size)
+{
+    assert(lanes != NULL);
+    assert(data != NULL);
+
+    if (size > CHIP8_USERMEM_TOTAL) {
+        fprintf(stderr, "Rom is too large for CHIP8! Got %zu, must be < %d\n",
+                size, CHIP8_USERMEM_TOTAL);
+        return -1;
+    }
+
+    return LanesReset(lanes, data, size);
+}
+
+void LanesSetKeys(Lanes *lanes, int lane, uint16_t keys)
+{
+    assert(lanes != NULL);
+    assert(lane >= 0 && lane < lanes->laneCount);
+
+    LaneBlock *b = &lanes->blocks[lane / LANES_WIDTH];
+    int l = lane % LANES_WIDTH;
+    uint32_t bit = (uint32_t)1 << l;
+
+    uint16_t released = b->keys[l] & ~keys;
+    b->keys[l] = keys;
+
+    if (released && (b->waiting & bit)) {
+        int key = FirstLane(released);
+        b->V[b->waitReg[l]][l] = (uint8_t)key;
+        b->waiting &= ~bit;
+    }
+}
+
+uint16_t LanesGetKeys(Lanes *lanes, int lane)
+{
+    assert(lanes != NULL);
+    assert(lane >= 0 && lane < lanes->laneCount);
+
+    return lanes->blocks[lane / LANES_WIDTH].keys[lane % LANES_WIDTH];
+}
+
+int LanesTick(Lanes *lanes)
+{
+    assert(lanes != NULL);
+
+    if (lanes->outOfMemory) {
+        return -1;
+    }
+
+    for (int i = 0; i < lanes->blockCount; i++) {
+        LaneBlock *b = &lanes->blocks[i];
+
+        for (int c = 0; c < lanes->cyclesPerTick; c++) {
+            BlockCycle(lanes, b);
+        }
+
+        // Count the timers down, stopping at zero.
+        LaneVec one = VecSet1(1);
+        for (int o = 0; o < LANES_WIDTH; o += LANE_VEC_BYTES) {
+            LaneVec dt = VecLoad(b->delayTimer + o);
+            LaneVec st = VecLoad(b->soundTimer + o);
+            VecStore(b->delayTimer + o, VecSub(dt, VecMin(dt, one)));
+            VecStore(b->soundTimer + o, VecSub(st, VecMin(st, one)));
+        }
+    }
+
+    if (lanes->outOfMemory) {
+        fprintf(stderr, "Lanes ran out of memory for their pages!\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+const uint8_t *LanesGetDisplay(Lanes *lanes, int lane)
+{
+    assert(lanes != NULL);
+    assert(lane >= 0 && lane < lanes->laneCount);
+
+    return lanes->blocks[lane / LANES_WIDTH].display[lane % LANES_WIDTH];
+}
+
+int LanesGetSoundTimer(Lanes *lanes, int lane)
+{
+    assert(lanes != NULL);
+    assert(lane >= 0 && lane < lanes->laneCount);
+
+    return lanes->blocks[lane / LANES_WIDTH].soundTimer[lane % LANES_WIDTH];
+}
+
+uint64_t LanesGetCycleCount(Lanes *lanes, int lane)
+{
+    assert(lanes != NULL);
+    assert(lane >= 0 && lane < lanes->laneCount);
+
+    return lanes->blocks[lane / LANES_WIDTH].cycles[lane % LANES_WIDTH];
+}
+
+size_t LanesGetMemoryUsage(const Lanes *lanes)
+{
+    assert(lanes != NULL);
+
+    return sizeof(Lanes) + lanes->blockCount * sizeof(LaneBlock) +
+           ArenaBytes(&lanes->arena);
+}
+
+void LanesExport(Lanes *lanes, int lane, Chip8 *chip8)
+{
+    assert(lanes != NULL);
+    assert(lane >= 0 && lane < lanes->laneCount);
+    assert(chip8 != NULL);
+
+    LaneSyncOut(lanes, &lanes->blocks[lane / LANES_WIDTH], lane % LANES_WIDTH,
+                chip8);
+    chip8->dirty = ~(uint64_t)0;
+}
+
+// Loads the ROM into the pages of a fresh Chip8, and starts every lane on them
+// with its registers as Chip8Init() leaves them.
+static int LanesReset(Lanes *lanes, const uint8_t *data, size_t size)
+{
+    Chip8 image;
+    Chip8Init(&image, 1);
+    if (size > 0) {
+        memcpy(image.memory + CHIP8_USERMEM_START, data, size);
+    }
+
+    ArenaReset(&lanes->arena);
+    lanes->outOfMemory = false;
+    for (int p = 0; p < LANES_PAGES; p++) {
+        uint32_t page = ArenaAlloc(&lanes->arena);
+        if (page == ARENA_NONE) {
+            fprintf(stderr, "Failed to allocate the ROM pages!\n");
+            return -1;
+        }
+        memcpy(ArenaPage(&lanes->arena, page),
+               image.memory + p * ARENA_PAGE_SIZE, ARENA_PAGE_SIZE);
+        lanes->romPages[p] = page;
+    }
+
+    for (int i = 0; i < lanes->blockCount; i++) {
+        LaneBlock *b = &lanes->blocks[i];
+        for (int l = 0; l < LANES_WIDTH; l++) {
+            for (int r = 0; r < 16; r++) {
+                b->V[r][l] = 0;
+            }
+            for (int s = 0; s < CHIP8_STACK_MAX; s++) {
+                b->stack[s][l] = 0;
+            }
+            for (int p = 0; p < LANES_PAGES; p++) {
+                b->pages[p][l] = lanes->romPages[p];
+            }
+            b->delayTimer[l] = 0;
+            b->soundTimer[l] = 0;
+            b->SP[l] = 0;
+            b->waitReg[l] = 0;
+            b->keys[l] = 0;
+            b->PC[l] = data ? CHIP8_USERMEM_START : 0;
+            b->I[l] = 0;
+            b->rng[l] = b->seed[l];
+            b->cycles[l] = 0;
+        }
+        memset(b->display, 0, sizeof(b->display));
+        memset(b->writers, 0, sizeof(b->writers));
+        b->waiting = 0;
+    }
+
+    return 0;
+}
+
+// Runs one cycle of every lane in the block that is not waiting for a key.
+static void BlockCycle(Lanes *lanes, LaneBlock *b)
+{
+    uint32_t pending = b->used & ~b->waiting;
+
+    for (int l = 0; l < LANES_WIDTH; l++) {
+        b->cycles[l] += (pending >> l) & 1;
+    }
+
+    while (pending) {
+        // Group the lanes at the same PC as the first one left.
+        int lead = FirstLane(pending);
+        uint16_t pc = b->PC[lead];
+        uint32_t group = 0;
+        for (int l = 0; l < LANES_WIDTH; l++) {
+            group |= (uint32_t)(b->PC[l] == pc) << l;
+        }
+        group &= pending;
+
+        if (AliasesRegisters(pc, 2)) {
+            pending &= ~group;
+            for (uint32_t g = group; g; g &= g - 1) {
+                LaneFallback(lanes, b, FirstLane(g));
+            }
+            continue;
+        }
+
+        // Lanes that rewrote their code here may be at another opcode.
+        uint8_t hi = LaneLoad(lanes, b, lead, pc);
+        uint8_t lo = LaneLoad(lanes, b, lead, pc + 1);
+        Opcode op = { .val = (uint16_t)((hi << 8) | lo) };
+        uint32_t writers = b->writers[pc / LANES_GRANULE] |
+                           b->writers[(pc + 1) / LANES_GRANULE];
+        uint32_t check = (writers >> lead) & 1 ? group : group & writers;
+        for (uint32_t g = check; g; g &= g - 1) {
+            int l = FirstLane(g);
+            if (LaneLoad(lanes, b, l, pc) != hi ||
+                LaneLoad(lanes, b, l, pc + 1) != lo) {
+                group &= ~((uint32_t)1 << l);
+            }
+        }
+        pending &= ~group;
+
+        if ((group & (group - 1)) != 0 && IsLockstep(op)) {
+            ExecGroup(lanes, b, group, op);
+        } else {
+            for (uint32_t g = group; g; g &= g - 1) {
+                ExecLane(lanes, b, FirstLane(g), op);
+            }
+        }
+    }
+}
+
+// Returns if every lane can run the opcode together. The rest read or write
+// memory at addresses that differ per lane, or use the stack.
+static bool IsLockstep(Opcode op)
+{
+    uint8_t kk = op.val & 0xFF;
+
+    switch (op.u) {
+    case 0x0:
+        return op.val != 0x00EE;
+    case 0x2:
+    case 0xD:
+        return false;
+    case 0xE:
+        return kk != 0x9E && kk != 0xA1;
+    case 0xF:
+        return kk != 0x33 && kk != 0x55 && kk != 0x65;
+    default:
+        return true;
+    }
+}
+
+// Runs an opcode on a group of lanes at the same PC, matching what
+// DecodeAndExecOpcode() does to each of them.
+static void ExecGroup(Lanes *lanes, LaneBlock *b, uint32_t group, Opcode op)
+{
+    uint8_t mask[LANES_WIDTH];
+    uint8_t skipMask[LANES_WIDTH];
+    uint8_t x = op.x;
+    uint8_t y = op.y;
+    uint8_t n = op.n;
+    uint8_t kk = op.val & 0xFF;
+    uint16_t nnn = op.val & 0xFFF;
+    bool shiftVy = (lanes->quirks & CHIP8_QUIRK_SHIFT_VY) != 0;
+    bool vfReset = (lanes->quirks & CHIP8_QUIRK_VF_RESET) != 0;
+    uint32_t skip = 0;
+
+    ExpandMask(group, mask);
+
+    // The byte registers, one vector of lanes at a time.
+    LaneVec zero = VecSet1(0);
+    LaneVec one = VecSet1(1);
+    for (int o = 0; o < LANES_WIDTH; o += LANE_VEC_BYTES) {
+        LaneVec m = VecLoad(mask + o);
+        uint8_t *vx = b->V[x] + o;
+        uint8_t *vy = b->V[y] + o;
+        uint8_t *vf = b->V[0xF] + o;
+        LaneVec a = VecLoad(vx);
+        LaneVec c = VecLoad(vy);
+        LaneVec src = shiftVy ? c : a;
+
+        switch (op.u) {
+        case 0x3:
+            skip |= VecMoveMask(VecAnd(m, VecCmpEq(a, VecSet1(kk)))) << o;
+            break;
+        case 0x4:
+            skip |= VecMoveMask(VecAndNot(VecCmpEq(a, VecSet1(kk)), m)) << o;
+            break;
+        case 0x5:
+            skip |= VecMoveMask(VecAnd(m, VecCmpEq(a, c))) << o;
+            break;
+        case 0x9:
+            if (n == 0) {
+                skip |= VecMoveMask(VecAndNot(VecCmpEq(a, c), m)) << o;
+            }
+            break;
+        case 0x6:
+            VecStore(vx, VecBlend(m, VecSet1(kk), a));
+            break;
+        case 0x7:
+            VecStore(vx, VecBlend(m, VecAdd(a, VecSet1(kk)), a));
+            break;
+        case 0x8:
+            // x and y may be F, so each write is reloaded from.
+            switch (n) {
+            case 0x0:
+                VecStore(vx, VecBlend(m, c, a));
+                break;
+            case 0x1:
+            case 0x2:
+            case 0x3:
+                VecStore(vx, VecBlend(m,
+                                      n == 1   ? VecOr(a, c) :
+                                      n == 2   ? VecAnd(a, c) :
+                                                 VecXor(a, c),
+                                      a));
+                if (vfReset) {
+                    VecStore(vf, VecBlend(m, zero, VecLoad(vf)));
+                }
+                break;
+            case 0x4:
+                // The carry is never set, V[x] > 255 is always false.
+                VecStore(vx, VecBlend(m, VecAdd(a, c), a));
+                VecStore(vf, VecBlend(m, zero, VecLoad(vf)));
+                break;
+            case 0x5:
+                VecStore(vf, VecBlend(m, VecAnd(VecGt(a, c), one),
+                                      VecLoad(vf)));
+                a = VecLoad(vx);
+                c = VecLoad(vy);
+                VecStore(vx, VecBlend(m, VecSub(a, c), a));
+                break;
+            case 0x6:
+                VecStore(vf, VecBlend(m, VecAnd(src, one), VecLoad(vf)));
+                VecStore(vx, VecBlend(m, VecShr1(src), VecLoad(vx)));
+                break;
+            case 0x7:
+                VecStore(vf, VecBlend(m, VecAnd(VecGt(c, a), one),
+                                      VecLoad(vf)));
+                a = VecLoad(vx);
+                c = VecLoad(vy);
+                VecStore(vx, VecBlend(m, VecSub(c, a), a));
+                break;
+            case 0xE:
+                VecStore(vf, VecBlend(m, VecAnd(VecGt(src, VecSet1(0x7F)), one),
+                                      VecLoad(vf)));
+                VecStore(vx, VecBlend(m, VecAdd(src, src), VecLoad(vx)));
+                break;
+            }
+            break;
+        case 0xF:
+            if (kk == 0x07) {
+                VecStore(vx, VecBlend(m, VecLoad(b->delayTimer + o), a));
+            } else if (kk == 0x15) {
+                LaneVec dt = VecLoad(b->delayTimer + o);
+                VecStore(b->delayTimer + o, VecBlend(m, a, dt));
+            } else if (kk == 0x18) {
+                LaneVec st = VecLoad(b->soundTimer + o);
+                VecStore(b->soundTimer + o, VecBlend(m, a, st));
+            }
+            break;
+        }
+    }
+
+    // The wider registers, written so the compiler can vectorise them.
+    ExpandMask(skip, skipMask);
+    switch (op.u) {
+    case 0x1:
+        for (int l = 0; l < LANES_WIDTH; l++) {
+            b->PC[l] = mask[l] ? nnn : b->PC[l];
+        }
+        break;
+    case 0xB: {
+        uint8_t r = (lanes->quirks & CHIP8_QUIRK_JUMP_VX) ? x : 0;
+        for (int l = 0; l < LANES_WIDTH; l++) {
+            b->PC[l] = mask[l] ? (uint16_t)(nnn + b->V[r][l]) : b->PC[l];
+        }
+        break;
+    }
+    default:
+        for (int l = 0; l < LANES_WIDTH; l++) {
+            b->PC[l] += (mask[l] & 2) + (skipMask[l] & 2);
+        }
+        break;
+    }
+
+    if (op.val == 0x00E0) {
+        for (uint32_t g = group; g; g &= g - 1) {
+            memset(b->display[FirstLane(g)], 0, sizeof(b->display[0]));
+        }
+    } else if (op.u == 0xA) {
+        for (int l = 0; l < LANES_WIDTH; l++) {
+            b->I[l] = mask[l] ? nnn : b->I[l];
+        }
+    } else if (op.u == 0xC) {
+        for (int l = 0; l < LANES_WIDTH; l++) {
+            uint32_t r = b->rng[l];
+            r ^= r << 13;
+            r ^= r >> 17;
+            r ^= r << 5;
+            b->rng[l] = mask[l] ? r : b->rng[l];
+            b->V[x][l] = mask[l] ? (uint8_t)(r >> 24) & kk : b->V[x][l];
+        }
+    } else if (op.u == 0xF && kk == 0x0A) {
+        b->waiting |= group;
+        for (int l = 0; l < LANES_WIDTH; l++) {
+            b->waitReg[l] = mask[l] ? x : b->waitReg[l];
+        }
+    } else if (op.u == 0xF && kk == 0x1E) {
+        for (int l = 0; l < LANES_WIDTH; l++) {
+            b->I[l] = mask[l] ? (uint16_t)(b->I[l] + b->V[x][l]) : b->I[l];
+        }
+    } else if (op.u == 0xF && kk == 0x29) {
+        for (int l = 0; l < LANES_WIDTH; l++) {
+            uint16_t font = offsetof(Chip8, font) + (b->V[x][l] & 15) * 5;
+            b->I[l] = mask[l] ? font : b->I[l];
+        }
+    }
+}
+
+// Runs an opcode on one lane, matching DecodeAndExecOpcode().
+static void ExecLane(Lanes *lanes, LaneBlock *b, int l, Opcode op)
+{
+    uint8_t x = op.x;
+    uint8_t y = op.y;
+    uint8_t n = op.n;
+    uint8_t kk = op.val & 0xFF;
+    uint16_t nnn = op.val & 0xFFF;
+    uint32_t quirks = lanes->quirks;
+    uint8_t *display = b->display[l];
+    uint16_t I = b->I[l];
+    uint8_t V[16];
+    for (int r = 0; r < 16; r++) {
+        V[r] = b->V[r][l];
+    }
+
+    // Accesses to the addresses of the registers need the real layout.
+    int rows = 0;
+    if (op.u == 0xD) {
+        // VF is cleared before the coordinates are read.
+        int startY = (y == 0xF ? 0 : V[y]) % CHIP8_H;
+        bool wrap = (quirks & CHIP8_QUIRK_SPRITE_WRAP) != 0;
+        rows = (wrap ? startY + n : MIN(startY + n, CHIP8_H)) - startY;
+    }
+    if ((op.u == 0x2 && (uint8_t)(b->SP[l] + 1) >= CHIP8_STACK_MAX) ||
+        (op.u == 0xD && rows > 0 && AliasesRegisters(I, rows)) ||
+        (op.u == 0xE && (kk == 0x9E || kk == 0xA1) && V[x] >= 16) ||
+        (op.u == 0xF && kk == 0x33 && AliasesRegisters(I, 3)) ||
+        (op.u == 0xF && (kk == 0x55 || kk == 0x65) &&
+         AliasesRegisters(I, x + 1))) {
+        LaneFallback(lanes, b, l);
+        return;
+    }
+
+    uint16_t PC = b->PC[l] + 2;
+    uint8_t SP = b->SP[l];
+
+    switch (op.u) {
+    case 0x0:
+        if (op.val == 0x00E0) {
+            memset(display, 0, sizeof(b->display[0]));
+        } else if (op.val == 0x00EE) {
+            PC = b->stack[SP % CHIP8_STACK_MAX][l];
+            SP--;
+        }
+        break;
+    case 0x1:
+        PC = nnn;
+        break;
+    case 0x2:
+        SP++;
+        b->stack[SP][l] = PC;
+        PC = nnn;
+        break;
+    case 0x3:
+        PC += V[x] == kk ? 2 : 0;
+        break;
+    case 0x4:
+        PC += V[x] != kk ? 2 : 0;
+        break;
+    case 0x5:
+        PC += V[x] == V[y] ? 2 : 0;
+        break;
+    case 0x6:
+        V[x] = kk;
+        break;
+    case 0x7:
+        V[x] += kk;
+        break;
+    case 0x8: {
+        uint8_t src = (quirks & CHIP8_QUIRK_SHIFT_VY) ? V[y] : V[x];
+        switch (n) {
+        case 0x0:
+            V[x] = V[y];
+            break;
+        case 0x1:
+        case 0x2:
+        case 0x3:
+            V[x] = n == 1 ? V[x] | V[y] : n == 2 ? V[x] & V[y] : V[x] ^ V[y];
+            if (quirks & CHIP8_QUIRK_VF_RESET)
+                V[0xF] = 0;
+            break;
+        case 0x4:
+            V[x] += V[y];
+            V[0xF] = 0;
+            break;
+        case 0x5:
+            V[0xF] = V[x] > V[y];
+            V[x] -= V[y];
+            break;
+        case 0x6:
+            V[0xF] = src & 1;
+            V[x] = src >> 1;
+            break;
+        case 0x7:
+            V[0xF] = V[y] > V[x];
+            V[x] = V[y] - V[x];
+            break;
+        case 0xE:
+            V[0xF] = (src & 0x80) ? 1 : 0;
+            V[x] = src << 1;
+            break;
+        }
+        break;
+    }
+    case 0x9:
+        PC += (n == 0 && V[x] != V[y]) ? 2 : 0;
+        break;
+    case 0xA:
+        I = nnn;
+        break;
+    case 0xB:
+        PC = nnn + V[(quirks & CHIP8_QUIRK_JUMP_VX) ? x : 0];
+        break;
+    case 0xC: {
+        uint32_t r = b->rng[l];
+        r ^= r << 13;
+        r ^= r >> 17;
+        r ^= r << 5;
+        b->rng[l] = r;
+        V[x] = (uint8_t)(r >> 24) & kk;
+        break;
+    }
+    case 0xD: {
+        V[0xF] = 0;
+        int startX = V[x] % CHIP8_W;
+        int startY = V[y] % CHIP8_H;
+        bool wrap = (quirks & CHIP8_QUIRK_SPRITE_WRAP) != 0;
+        int endX = wrap ? startX + 8 : MIN(startX + 8, CHIP8_W);
+        for (int row = 0; row < rows; row++) {
+            uint8_t sprite = LaneLoad(lanes, b, l, I + row);
+            int line = ((startY + row) % CHIP8_H) * CHIP8_W;
+            for (int xline = startX; xline < endX; xline++) {
+                if (!(sprite & (0x80 >> (xline - startX)))) {
+                    continue;
+                }
+                int index = line + (xline % CHIP8_W);
+                uint8_t bit = 0x80 >> (index % 8);
+                if (display[index / 8] & bit) {
+                    V[0xF] = 1;
+                }
+                display[index / 8] ^= bit;
+            }
+        }
+        break;
+    }
+    case 0xE:
+        if (kk == 0x9E) {
+            PC += (b->keys[l] >> V[x]) & 1 ? 2 : 0;
+        } else if (kk == 0xA1) {
+            PC += (b->keys[l] >> V[x]) & 1 ? 0 : 2;
+        }
+        break;
+    case 0xF:
+        switch (kk) {
+        case 0x07:
+            V[x] = b->delayTimer[l];
+            break;
+        case 0x0A:
+            b->waiting |= (uint32_t)1 << l;
+            b->waitReg[l] = x;
+            break;
+        case 0x15:
+            b->delayTimer[l] = V[x];
+            break;
+        case 0x18:
+            b->soundTimer[l] = V[x];
+            break;
+        case 0x1E:
+            I += V[x];
+            break;
+        case 0x29:
+            I = offsetof(Chip8, font) + (V[x] & 15) * 5;
+            break;
+        case 0x33:
+            LaneStore(lanes, b, l, I, V[x] / 100);
+            LaneStore(lanes, b, l, I + 1, (V[x] / 10) % 10);
+            LaneStore(lanes, b, l, I + 2, V[x] % 10);
+            MarkWritten(b, l, I, 3);
+            break;
+        case 0x55:
+            for (int r = 0; r <= x; r++) {
+                LaneStore(lanes, b, l, I + r, V[r]);
+            }
+            MarkWritten(b, l, I, x + 1);
+            if (quirks & CHIP8_QUIRK_LOAD_STORE_I)
+                I += x + 1;
+            break;
+        case 0x65:
+            for (int r = 0; r <= x; r++) {
+                V[r] = LaneLoad(lanes, b, l, I + r);
+            }
+            if (quirks & CHIP8_QUIRK_LOAD_STORE_I)
+                I += x + 1;
+            break;
+        }
+        break;
+    }
+
+    for (int r = 0; r < 16; r++) {
+        b->V[r][l] = V[r];
+    }
+    b->PC[l] = PC;
+    b->SP[l] = SP;
+    b->I[l] = I;
+}
+
+// Runs the next instruction of a lane on a copy of its Chip8, for the
+// instructions that touch the addresses its registers would be at.
+static void LaneFallback(Lanes *lanes, LaneBlock *b, int l)
+{
+    Chip8 c;
+
+    LaneSyncOut(lanes, b, l, &c);
+    c.dirty = 0;
+    Chip8Cycle(&c);
+    LaneSyncIn(lanes, b, l, &c);
+}
+
+// Copies a lane out into a Chip8. Bytes of the register fields that the lane
+// does not track, like the padding of waitingKey and the value of a held key,
+// come from its pages, as the program last wrote them.
+static void LaneSyncOut(Lanes *lanes, LaneBlock *b, int l, Chip8 *c)
+{
+    for (int p = 0; p < LANES_PAGES; p++) {
+        memcpy(c->memory + p * ARENA_PAGE_SIZE,
+               ArenaPage(&lanes->arena, b->pages[p][l]), ARENA_PAGE_SIZE);
+    }
+    memcpy(c->display, b->display[l], sizeof(c->display));
+
+    for (int r = 0; r < 16; r++) {
+        c->V[r] = b->V[r][l];
+    }
+    for (int k = 0; k < 16; k++) {
+        if (!((b->keys[l] >> k) & 1)) {
+            c->keys[k] = 0;
+        } else if (c->keys[k] == 0) {
+            c->keys[k] = 1;
+        }
+    }
+    for (int s = 0; s < CHIP8_STACK_MAX; s++) {
+        c->stack[s] = b->stack[s][l];
+    }
+    c->delayTimer = b->delayTimer[l];
+    c->soundTimer = b->soundTimer[l];
+    c->SP = b->SP[l];
+    c->waitingKey.waiting = (b->waiting >> l) & 1;
+    c->waitingKey.reg = b->waitReg[l];
+    c->PC = b->PC[l];
+    c->I = b->I[l];
+    c->rng = b->rng[l];
+    c->quirks = lanes->quirks;
+}
+
+// Copies a Chip8 back into a lane, writing the pages that c->dirty marks and
+// that have changed.
+static void LaneSyncIn(Lanes *lanes, LaneBlock *b, int l, const Chip8 *c)
+{
+    uint32_t bit = (uint32_t)1 << l;
+
+    for (int p = 0; p < LANES_PAGES; p++) {
+        uint64_t blocks = ((uint64_t)1 << (ARENA_PAGE_SIZE /
+                                           CHIP8_DIRTY_BLOCK_SIZE)) - 1;
+        blocks <<= p * ARENA_PAGE_SIZE / CHIP8_DIRTY_BLOCK_SIZE;
+        const uint8_t *bytes = c->memory + p * ARENA_PAGE_SIZE;
+        if (!(c->dirty & blocks) ||
+            !memcmp(ArenaPage(&lanes->arena, b->pages[p][l]), bytes,
+                    ARENA_PAGE_SIZE)) {
+            continue;
+        }
+        uint8_t *page = LanePageCopy(lanes, b, l, p);
+        if (page) {
+            memcpy(page, bytes, ARENA_PAGE_SIZE);
+        }
+        MarkWritten(b, l, p * ARENA_PAGE_SIZE, ARENA_PAGE_SIZE);
+    }
+    memcpy(b->display[l], c->display, sizeof(c->display));
+
+    for (int r = 0; r < 16; r++) {
+        b->V[r][l] = c->V[r];
+    }
+    b->keys[l] = 0;
+    for (int k = 0; k < 16; k++) {
+        b->keys[l] |= (uint16_t)(c->keys[k] != 0) << k;
+    }
+    for (int s = 0; s < CHIP8_STACK_MAX; s++) {
+        b->stack[s][l] = c->stack[s];
+    }
+    b->delayTimer[l] = c->delayTimer;
+    b->soundTimer[l] = c->soundTimer;
+    b->SP[l] = c->SP;
+    b->waiting = c->waitingKey.waiting ? b->waiting | bit : b->waiting & ~bit;
+    b->waitReg[l] = c->waitingKey.reg;
+    b->PC[l] = c->PC;
+    b->I[l] = c->I;
+    b->rng[l] = c->rng;
+}
+
+static void LaneStore(Lanes *lanes, LaneBlock *b, int l, uint32_t address,
+                      uint8_t value)
+{
+    // Wraps as Chip8 does, though the instructions that reach past memory
+    // fall back to it before getting here.
+    address &= 0xFFF;
+    uint8_t *page = LanePageCopy(lanes, b, l, address / ARENA_PAGE_SIZE);
+    if (page) {
+        page[address % ARENA_PAGE_SIZE] = value;
+    }
+}
+
+// Returns a page of a lane's memory that only the lane uses, copying the ROM's
+// page the first time, or NULL when out of memory.
+static uint8_t *LanePageCopy(Lanes *lanes, LaneBlock *b, int l, int page)
+{
+    uint32_t rom = lanes->romPages[page];
+    if (b->pages[page][l] == rom) {
+        uint32_t copy = ArenaAlloc(&lanes->arena);
+        if (copy == ARENA_NONE) {
+            lanes->outOfMemory = true;
+            return NULL;
+        }
+        memcpy(ArenaPage(&lanes->arena, copy), ArenaPage(&lanes->arena, rom),
+               ARENA_PAGE_SIZE);
+        b->pages[page][l] = copy;
+    }
+    return ArenaPage(&lanes->arena, b->pages[page][l]);
+}
+
+static void MarkWritten(LaneBlock *b, int l, uint32_t address, uint32_t size)
+{
+    uint32_t last = MIN(address + size, 0x1000u) - 1;
+    for (uint32_t g = address / LANES_GRANULE; g <= last / LANES_GRANULE; g++) {
+        b->writers[g] |= (uint32_t)1 << l;
+    }
+}
+
+static inline uint8_t LaneLoad(const Lanes *lanes, const LaneBlock *b, int l,
+                               uint32_t address)
+{
+    address &= 0xFFF;
+    const uint8_t *page =
+        ArenaPage(&lanes->arena, b->pages[address / ARENA_PAGE_SIZE][l]);
+    return page[address % ARENA_PAGE_SIZE];
+}
+
+// Returns if size bytes from address overlap the registers or display of a
+// Chip8 or run past the end of its memory.
+static inline bool AliasesRegisters(uint32_t address, uint32_t size)
+{
+    return address < REGS_LOW_END ||
+           (address < REGS_HIGH_END && address + size > REGS_HIGH_BEGIN) ||
+           address + size > 0x1000;
+}
+
+static inline int FirstLane(uint32_t lanes)
+{
+    int l = 0;
+    while (!((lanes >> l) & 1)) {
+        l++;
+    }
+    return l;
+}
+
+static inline void ExpandMask(uint32_t lanes, uint8_t mask[LANES_WIDTH])
+{
+    for (int l = 0; l < LANES_WIDTH; l++) {
+        mask[l] = (uint8_t)(0 - ((lanes >> l) & 1));
+    }
+}
+
+#if defined(__AVX2__)
+
+static inline LaneVec VecLoad(const uint8_t *p)
+{
+    return _mm256_loadu_si256((const __m256i *)p);
+}
+
+static inline void VecStore(uint8_t *p, LaneVec a)
+{
+    _mm256_storeu_si256((__m256i *)p, a);
+}
+
+static inline LaneVec VecSet1(uint8_t v)
+{
+    return _mm256_set1_epi8((char)v);
+}
+
+static inline LaneVec VecAdd(LaneVec a, LaneVec b)
+{
+    return _mm256_add_epi8(a, b);
+}
+
+static inline LaneVec VecSub(LaneVec a, LaneVec b)
+{
+    return _mm256_sub_epi8(a, b);
+}
+
+static inline LaneVec VecAnd(LaneVec a, LaneVec b)
+{
+    return _mm256_and_si256(a, b);
+}
+
+static inline LaneVec VecOr(LaneVec a, LaneVec b)
+{
+    return _mm256_or_si256(a, b);
+}
+
+static inline LaneVec VecXor(LaneVec a, LaneVec b)
+{
+    return _mm256_xor_si256(a, b);
+}
+
+static inline LaneVec VecAndNot(LaneVec a, LaneVec b)
+{
+    return _mm256_andnot_si256(a, b);
+}
+
+static inline LaneVec VecCmpEq(LaneVec a, LaneVec b)
+{
+    return _mm256_cmpeq_epi8(a, b);
+}
+
+static inline LaneVec VecMin(LaneVec a, LaneVec b)
+{
+    return _mm256_min_epu8(a, b);
+}
+
+static inline LaneVec VecShr1(LaneVec a)
+{
+    return _mm256_and_si256(_mm256_srli_epi16(a, 1), _mm256_set1_epi8(0x7F));
+}
+
+static inline LaneVec VecBlend(LaneVec mask, LaneVec a, LaneVec b)
+{
+    return _mm256_blendv_epi8(b, a, mask);
+}
+
+static inline uint32_t VecMoveMask(LaneVec a)
+{
+    return (uint32_t)_mm256_movemask_epi8(a);
+}
+
+#elif LANE_VEC_BYTES == 16
+
+static inline LaneVec VecLoad(const uint8_t *p)
+{
+    return _mm_loadu_si128((const __m128i *)p);
+}
+
+static inline void VecStore(uint8_t *p, LaneVec a)
+{
+    _mm_storeu_si128((__m128i *)p, a);
+}
+
+static inline LaneVec VecSet1(uint8_t v)
+{
+    return _mm_set1_epi8((char)v);
+}
+
+static inline LaneVec VecAdd(LaneVec a, LaneVec b)
+{
+    return _mm_add_epi8(a, b);
+}
+
+static inline LaneVec VecSub(LaneVec a, LaneVec b)
+{
+    return _mm_sub_epi8(a, b);
+}
+
+static inline LaneVec VecAnd(LaneVec a, LaneVec b)
+{
+    return _mm_and_si128(a, b);
+}
+
+static inline LaneVec VecOr(LaneVec a, LaneVec b)
+{
+    return _mm_or_si128(a, b);
+}
+
+static inline LaneVec VecXor(LaneVec a, LaneVec b)
+{
+    return _mm_xor_si128(a, b);
+}
+
+static inline LaneVec VecAndNot(LaneVec a, LaneVec b)
+{
+    return _mm_andnot_si128(a, b);
+}
+
+static inline LaneVec VecCmpEq(LaneVec a, LaneVec b)
+{
+    return _mm_cmpeq_epi8(a, b);
+}
+
+static inline LaneVec VecMin(LaneVec a, LaneVec b)
+{
+    return _mm_min_epu8(a, b);
+}
+
+static inline LaneVec VecShr1(LaneVec a)
+{
+    return _mm_and_si128(_mm_srli_epi16(a, 1), _mm_set1_epi8(0x7F));
+}
+
+static inline LaneVec VecBlend(LaneVec mask, LaneVec a, LaneVec b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline uint32_t VecMoveMask(LaneVec a)
+{
+    return (uint32_t)_mm_movemask_epi8(a);
+}
+
+#else
+
+static inline LaneVec VecLoad(const uint8_t *p)
+{
+    return *p;
+}
+
+static inline void VecStore(uint8_t *p, LaneVec a)
+{
+    *p = a;
+}
+
+static inline LaneVec VecSet1(uint8_t v)
+{
+    return v;
+}
+
+static inline LaneVec VecAdd(LaneVec a, LaneVec b)
+{
+    return (uint8_t)(a + b);
+}
+
+static inline LaneVec VecSub(LaneVec a, LaneVec b)
+{
+    return (uint8_t)(a - b);
+}
+
+static inline LaneVec VecAnd(LaneVec a, LaneVec b)
+{
+    return a & b;
+}
+
+static inline LaneVec VecOr(LaneVec a, LaneVec b)
+{
+    return a | b;
+}
+
+static inline LaneVec VecXor(LaneVec a, LaneVec b)
+{
+    return a ^ b;
+}
+
+static inline LaneVec VecAndNot(LaneVec a, LaneVec b)
+{
+    return (uint8_t)(~a & b);
+}
+
+static inline LaneVec VecCmpEq(LaneVec a, LaneVec b)
+{
+    return a == b ? 0xFF : 0;
+}
+
+static inline LaneVec VecMin(LaneVec a, LaneVec b)
+{
+    return MIN(a, b);
+}
+
+static inline LaneVec VecShr1(LaneVec a)
+{
+    return a >> 1;
+}
+
+static inline LaneVec VecBlend(LaneVec mask, LaneVec a, LaneVec b)
+{
+    return (uint8_t)((mask & a) | (~mask & b));
+}
+
+static inline uint32_t VecMoveMask(LaneVec a)
+{
+    return a >> 7;
+}
+
+#endif
+
+// Unsigned a > b, there is no unsigned byte compare before AVX-512.
+static inline LaneVec VecGt(LaneVec a, LaneVec b)
+{
+    return VecXor(VecCmpEq(VecMin(a, b), a), VecSet1(0xFF));
+}
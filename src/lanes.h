@@ -0,0 +1,78 @@
+#ifndef CHIP8_LANES_H
+#define CHIP8_LANES_H
+
+// Lanes module.
+// Runs many copies of one ROM in lockstep. The registers of the copies, or
+// lanes, are stored as arrays indexed by lane, so an instruction that a group
+// of lanes are all at runs once for the whole group with SIMD operations. Lanes
+// whose PCs branch apart run in smaller groups, down to one lane at a time,
+// and join up again when their PCs meet. Each lane behaves exactly like a VM
+// with the same ROM, seed, quirks and keys set between ticks, including
+// programs that run or reach past the end of memory, which wrap around to its
+// start.
+//
+// The lanes share the pages of the ROM, and a lane only gets its own copy of
+// a page when it writes to it, so an idle lane costs a few hundred bytes
+// rather than a whole Chip8.
+
+#include "chip8.h"
+#include "def.h"
+
+// Lanes are stepped in blocks of this many, one AVX2 register of bytes.
+#define LANES_WIDTH 32
+
+typedef struct tLanes Lanes;
+
+// LanesCreate() - Creates laneCount lanes. Lane n is seeded with seed + n, or
+// from the current time if seed is 0. Returns NULL on failure.
+Lanes *LanesCreate(int laneCount, int cyclesPerTick, unsigned int seed);
+
+// LanesDestroy() - Frees lanes created by LanesCreate().
+void LanesDestroy(Lanes *lanes);
+
+// LanesGetCount() - Returns the number of lanes.
+int LanesGetCount(const Lanes *lanes);
+
+// LanesSetQuirks() - Sets the Chip8Quirk bits that every lane emulates.
+void LanesSetQuirks(Lanes *lanes, uint32_t quirks);
+
+// LanesSetSeed() - Reseeds the rng of one lane, as Chip8Init() would. The seed
+// is kept for LanesLoadRom().
+void LanesSetSeed(Lanes *lanes, int lane, unsigned int seed);
+
+// LanesLoadRom() - Resets every lane and loads the ROM into all of them.
+// Returns 0 on success and -1 on failure.
+int LanesLoadRom(Lanes *lanes, const uint8_t *data, size_t size);
+
+// LanesSetKeys() - Sets the keys held on a lane as a bitmask, bit n for key n.
+// Keys released while the lane waits on Fx0A end the wait in ascending order,
+// like VMClearKey() calls made in that order.
+void LanesSetKeys(Lanes *lanes, int lane, uint16_t keys);
+
+// LanesGetKeys() - Returns the keys held on a lane.
+uint16_t LanesGetKeys(Lanes *lanes, int lane);
+
+// LanesTick() - Runs one tick on every lane, see VMTick(). Returns 0 on success
+// and -1 if a lane ran out of memory for its pages, after which the lanes are
+// undefined until LanesLoadRom().
+int LanesTick(Lanes *lanes);
+
+// LanesGetDisplay() - Returns the display of a lane, laid out like
+// Chip8.display. The pointer stays valid for the life of the lanes.
+const uint8_t *LanesGetDisplay(Lanes *lanes, int lane);
+
+// LanesGetSoundTimer() - Returns the sound timer of a lane.
+int LanesGetSoundTimer(Lanes *lanes, int lane);
+
+// LanesGetCycleCount() - Returns the instructions a lane has executed, see
+// VMGetCycleCount().
+uint64_t LanesGetCycleCount(Lanes *lanes, int lane);
+
+// LanesGetMemoryUsage() - Returns the bytes allocated for the lanes, including
+// the pages copied for lanes that wrote to them.
+size_t LanesGetMemoryUsage(const Lanes *lanes);
+
+// LanesExport() - Writes a lane out as the Chip8 it is equivalent to.
+void LanesExport(Lanes *lanes, int lane, Chip8 *chip8);
+
+#endif // CHIP8_LANES_H
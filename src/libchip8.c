@@ -0,0 +1,468 @@
+#include "libchip8.h"
+
+#include "env.h"
+#include "lanes.h"
+#include "sched.h"
+#include "synth.h"
+#include "vm.h"
+
+struct tLibChip8 {
+    VM *vm;
+    Synth synth;
+};
+
+struct tLibChip8Lanes {
+    Lanes *lanes;
+};
+
+struct tLibChip8Env {
+    Env *env;
+};
+
+// Machines are kept by index so a woken VM can be handed back as its machine.
+struct tLibChip8Sched {
+    Sched *sched;
+    LibChip8 **machines;
+    int machineCapacity;
+};
+
+// The public constants are spelled out so the header stands alone.
+_Static_assert(LIBCHIP8_DISPLAY_WIDTH == CHIP8_W &&
+                   LIBCHIP8_DISPLAY_HEIGHT == CHIP8_H,
+               "display size differs from the core");
+_Static_assert(LIBCHIP8_TICK_FREQUENCY == VM_TICK_FREQUENCY,
+               "tick frequency differs from the core");
+_Static_assert(LIBCHIP8_AUDIO_SAMPLE_RATE == SYNTH_SAMPLE_RATE,
+               "audio sample rate differs from the core");
+_Static_assert(LIBCHIP8_QUIRK_VF_RESET == CHIP8_QUIRK_VF_RESET &&
+                   LIBCHIP8_QUIRK_SHIFT_VY == CHIP8_QUIRK_SHIFT_VY &&
+                   LIBCHIP8_QUIRK_LOAD_STORE_I == CHIP8_QUIRK_LOAD_STORE_I &&
+                   LIBCHIP8_QUIRK_JUMP_VX == CHIP8_QUIRK_JUMP_VX &&
+                   LIBCHIP8_QUIRK_SPRITE_WRAP == CHIP8_QUIRK_SPRITE_WRAP,
+               "quirk bits differ from the core");
+_Static_assert(LIBCHIP8_VALUE_BYTE == ENVVALUE_BYTE &&
+                   LIBCHIP8_VALUE_WORD == ENVVALUE_WORD &&
+                   LIBCHIP8_VALUE_BCD == ENVVALUE_BCD,
+               "reward value types differ from the env");
+_Static_assert(LIBCHIP8_OBSERVE_BITS == ENVOBSERVATION_BITS &&
+                   LIBCHIP8_OBSERVE_BYTES == ENVOBSERVATION_BYTES,
+               "observation types differ from the env");
+
+int LibChip8Version(void)
+{
+    return LIBCHIP8_VERSION;
+}
+
+LibChip8 *LibChip8Create(int cyclesPerTick, unsigned int seed)
+{
+    if (cyclesPerTick <= 0) {
+        fprintf(stderr, "Cycles per tick must be positive, got %d!\n",
+                cyclesPerTick);
+        return NULL;
+    }
+
+    LibChip8 *c8 = malloc(sizeof(LibChip8));
+    if (!c8) {
+        fprintf(stderr, "Failed to allocate a libchip8 machine!\n");
+        return NULL;
+    }
+
+    c8->vm = VMCreate(cyclesPerTick, VMCOLOR_PALETTE_ORIGINAL, seed);
+    if (!c8->vm) {
+        free(c8);
+        return NULL;
+    }
+    SynthInit(&c8->synth);
+
+    return c8;
+}
+
+void LibChip8Destroy(LibChip8 *c8)
+{
+    if (!c8) {
+        return;
+    }
+
+    VMDestroy(c8->vm);
+    free(c8);
+}
+
+int LibChip8LoadRom(LibChip8 *c8, const uint8_t *data, size_t size)
+{
+    assert(c8 != NULL);
+
+    return VMLoadRomData(c8->vm, data, size);
+}
+
+void LibChip8SetQuirks(LibChip8 *c8, uint32_t quirks)
+{
+    assert(c8 != NULL);
+
+    VMSetQuirks(c8->vm, quirks & CHIP8_QUIRK_ALL);
+}
+
+void LibChip8Run(LibChip8 *c8, int ticks)
+{
+    assert(c8 != NULL);
+
+    for (int i = 0; i < ticks; i++) {
+        VMTick(c8->vm);
+    }
+}
+
+uint64_t LibChip8GetTickCount(LibChip8 *c8)
+{
+    assert(c8 != NULL);
+
+    return VMGetTickCount(c8->vm);
+}
+
+void LibChip8SetKey(LibChip8 *c8, uint8_t key, bool pressed)
+{
+    assert(c8 != NULL);
+
+    if (pressed) {
+        VMSetKey(c8->vm, key & 0xF);
+    } else {
+        VMClearKey(c8->vm, key & 0xF);
+    }
+}
+
+const uint8_t *LibChip8GetDisplay(LibChip8 *c8)
+{
+    assert(c8 != NULL);
+
+    return VMGetDisplayPixels(c8->vm);
+}
+
+uint64_t LibChip8HashDisplay(LibChip8 *c8)
+{
+    assert(c8 != NULL);
+
+    return VMHashDisplay(c8->vm);
+}
+
+uint64_t LibChip8HashState(LibChip8 *c8)
+{
+    assert(c8 != NULL);
+
+    return VMHashState(c8->vm);
+}
+
+bool LibChip8IsBuzzing(LibChip8 *c8)
+{
+    assert(c8 != NULL);
+
+    return VMGetSoundTimer(c8->vm) > 0;
+}
+
+bool LibChip8RenderAudio(LibChip8 *c8, int16_t *samples, int sampleCount)
+{
+    assert(c8 != NULL);
+    assert(samples != NULL);
+
+    if (VMGetSoundTimer(c8->vm) <= 0) {
+        memset(samples, 0, sampleCount * sizeof(int16_t));
+        return false;
+    }
+
+    SynthRender(&c8->synth, samples, sampleCount);
+    return true;
+}
+
+size_t LibChip8StateMaxSize(void)
+{
+    return VM_STATE_MAX_SIZE;
+}
+
+size_t LibChip8SaveState(LibChip8 *c8, void *buffer, size_t size)
+{
+    assert(c8 != NULL);
+
+    return VMSaveState(c8->vm, buffer, size);
+}
+
+int LibChip8LoadState(LibChip8 *c8, const void *buffer, size_t size)
+{
+    assert(c8 != NULL);
+
+    return VMLoadState(c8->vm, buffer, size);
+}
+
+LibChip8Lanes *LibChip8LanesCreate(int laneCount, int cyclesPerTick,
+                                   unsigned int seed)
+{
+    LibChip8Lanes *lanes = malloc(sizeof(LibChip8Lanes));
+    if (!lanes) {
+        fprintf(stderr, "Failed to allocate libchip8 lanes!\n");
+        return NULL;
+    }
+
+    lanes->lanes = LanesCreate(laneCount, cyclesPerTick, seed);
+    if (!lanes->lanes) {
+        free(lanes);
+        return NULL;
+    }
+
+    return lanes;
+}
+
+void LibChip8LanesDestroy(LibChip8Lanes *lanes)
+{
+    if (!lanes) {
+        return;
+    }
+
+    LanesDestroy(lanes->lanes);
+    free(lanes);
+}
+
+void LibChip8LanesSetQuirks(LibChip8Lanes *lanes, uint32_t quirks)
+{
+    assert(lanes != NULL);
+
+    LanesSetQuirks(lanes->lanes, quirks);
+}
+
+int LibChip8LanesLoadRom(LibChip8Lanes *lanes, const uint8_t *data,
+                         size_t size)
+{
+    assert(lanes != NULL);
+
+    return LanesLoadRom(lanes->lanes, data, size);
+}
+
+void LibChip8LanesSetKeys(LibChip8Lanes *lanes, int lane, uint16_t keys)
+{
+    assert(lanes != NULL);
+
+    LanesSetKeys(lanes->lanes, lane, keys);
+}
+
+int LibChip8LanesRun(LibChip8Lanes *lanes, int ticks)
+{
+    assert(lanes != NULL);
+
+    for (int i = 0; i < ticks; i++) {
+        if (LanesTick(lanes->lanes) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+const uint8_t *LibChip8LanesGetDisplay(LibChip8Lanes *lanes, int lane)
+{
+    assert(lanes != NULL);
+
+    return LanesGetDisplay(lanes->lanes, lane);
+}
+
+bool LibChip8LanesIsBuzzing(LibChip8Lanes *lanes, int lane)
+{
+    assert(lanes != NULL);
+
+    return LanesGetSoundTimer(lanes->lanes, lane) > 0;
+}
+
+LibChip8Env *LibChip8EnvCreate(int envCount, int cyclesPerTick,
+                               unsigned int seed)
+{
+    LibChip8Env *env = malloc(sizeof(LibChip8Env));
+    if (!env) {
+        fprintf(stderr, "Failed to allocate libchip8 environments!\n");
+        return NULL;
+    }
+
+    env->env = EnvCreate(envCount, cyclesPerTick, seed);
+    if (!env->env) {
+        free(env);
+        return NULL;
+    }
+
+    return env;
+}
+
+void LibChip8EnvDestroy(LibChip8Env *env)
+{
+    if (!env) {
+        return;
+    }
+
+    EnvDestroy(env->env);
+    free(env);
+}
+
+void LibChip8EnvSetQuirks(LibChip8Env *env, uint32_t quirks)
+{
+    assert(env != NULL);
+
+    EnvSetQuirks(env->env, quirks);
+}
+
+int LibChip8EnvLoadRom(LibChip8Env *env, const uint8_t *data, size_t size)
+{
+    assert(env != NULL);
+
+    return EnvLoadRom(env->env, data, size);
+}
+
+int LibChip8EnvSetActions(LibChip8Env *env, const uint16_t *keys, int count)
+{
+    assert(env != NULL);
+
+    return EnvSetActions(env->env, keys, count);
+}
+
+void LibChip8EnvSetFrameSkip(LibChip8Env *env, int frames)
+{
+    assert(env != NULL);
+
+    EnvSetFrameSkip(env->env, frames);
+}
+
+int LibChip8EnvAddReward(LibChip8Env *env, uint16_t address, int type,
+                         float weight)
+{
+    assert(env != NULL);
+
+    return EnvAddReward(env->env, address, (EnvValueType)type, weight);
+}
+
+int LibChip8EnvSetObservation(LibChip8Env *env, int type, int scale)
+{
+    assert(env != NULL);
+
+    return EnvSetObservation(env->env, (EnvObservationType)type, scale);
+}
+
+size_t LibChip8EnvGetObservationSize(LibChip8Env *env)
+{
+    assert(env != NULL);
+
+    return EnvGetObservationSize(env->env);
+}
+
+int LibChip8EnvStep(LibChip8Env *env, const int *actions,
+                    uint8_t *observations, float *rewards)
+{
+    assert(env != NULL);
+
+    return EnvStep(env->env, actions, observations, rewards);
+}
+
+void LibChip8EnvObserve(LibChip8Env *env, uint8_t *observations)
+{
+    assert(env != NULL);
+
+    EnvObserve(env->env, observations);
+}
+
+void LibChip8EnvReset(LibChip8Env *env, int index, unsigned int seed)
+{
+    assert(env != NULL);
+
+    EnvReset(env->env, index, seed);
+}
+
+void LibChip8EnvSetResetState(LibChip8Env *env, int index)
+{
+    assert(env != NULL);
+
+    EnvSetResetState(env->env, index);
+}
+
+LibChip8Sched *LibChip8SchedCreate(int threadCount)
+{
+    LibChip8Sched *sched = calloc(1, sizeof(LibChip8Sched));
+    if (!sched) {
+        fprintf(stderr, "Failed to allocate a libchip8 scheduler!\n");
+        return NULL;
+    }
+
+    sched->sched = SchedCreate(threadCount);
+    if (!sched->sched) {
+        free(sched);
+        return NULL;
+    }
+
+    return sched;
+}
+
+void LibChip8SchedDestroy(LibChip8Sched *sched)
+{
+    if (!sched) {
+        return;
+    }
+
+    SchedDestroy(sched->sched);
+    free(sched->machines);
+    free(sched);
+}
+
+int LibChip8SchedAdd(LibChip8Sched *sched, LibChip8 *c8)
+{
+    assert(sched != NULL);
+    assert(c8 != NULL);
+
+    int index = SchedAdd(sched->sched, c8->vm);
+    if (index < 0) {
+        return -1;
+    }
+
+    if (index >= sched->machineCapacity) {
+        int capacity = MAX(sched->machineCapacity * 2, index + 1);
+        LibChip8 **machines =
+            realloc(sched->machines, capacity * sizeof(LibChip8 *));
+        if (!machines) {
+            fprintf(stderr, "Failed to allocate %d scheduled machines!\n",
+                    capacity);
+            SchedRemove(sched->sched, index);
+            return -1;
+        }
+        sched->machines = machines;
+        sched->machineCapacity = capacity;
+    }
+    sched->machines[index] = c8;
+
+    return index;
+}
+
+void LibChip8SchedRemove(LibChip8Sched *sched, int index)
+{
+    assert(sched != NULL);
+
+    SchedRemove(sched->sched, index);
+    sched->machines[index] = NULL;
+}
+
+LibChip8 *LibChip8SchedWake(LibChip8Sched *sched, int index)
+{
+    assert(sched != NULL);
+
+    SchedWake(sched->sched, index);
+    return sched->machines[index];
+}
+
+void LibChip8SchedSetKey(LibChip8Sched *sched, int index, uint8_t key,
+                         bool pressed)
+{
+    assert(sched != NULL);
+
+    SchedSetKey(sched->sched, index, key, pressed);
+}
+
+void LibChip8SchedRun(LibChip8Sched *sched, int ticks)
+{
+    assert(sched != NULL);
+
+    SchedRun(sched->sched, MAX(ticks, 0));
+}
+
+int LibChip8SchedGetRunningCount(LibChip8Sched *sched)
+{
+    assert(sched != NULL);
+
+    return SchedGetRunningCount(sched->sched);
+}
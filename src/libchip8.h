@@ -0,0 +1,289 @@
+#ifndef LIBCHIP8_H
+#define LIBCHIP8_H
+
+// libchip8 public API.
+// Embeds the CHIP-8 core in other programs without the SDL frontend. This is
+// the only header needed to use the library, everything it declares keeps its
+// meaning and binary layout within a major version.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LIBCHIP8_VERSION_MAJOR 1
+#define LIBCHIP8_VERSION_MINOR 4
+#define LIBCHIP8_VERSION_PATCH 0
+#define LIBCHIP8_VERSION                                                       \
+    (LIBCHIP8_VERSION_MAJOR * 10000 + LIBCHIP8_VERSION_MINOR * 100 +           \
+     LIBCHIP8_VERSION_PATCH)
+
+#if defined(LIBCHIP8_SHARED)
+#if defined(_WIN32)
+#if defined(LIBCHIP8_BUILDING)
+#define LIBCHIP8_API __declspec(dllexport)
+#else
+#define LIBCHIP8_API __declspec(dllimport)
+#endif
+#else
+#define LIBCHIP8_API __attribute__((visibility("default")))
+#endif
+#else
+#define LIBCHIP8_API
+#endif
+
+// The display is 1 bit per pixel, 8 pixels to a byte with the leftmost in the
+// most significant bit, rows top to bottom.
+#define LIBCHIP8_DISPLAY_WIDTH 64
+#define LIBCHIP8_DISPLAY_HEIGHT 32
+#define LIBCHIP8_DISPLAY_SIZE                                                  \
+    (LIBCHIP8_DISPLAY_WIDTH * LIBCHIP8_DISPLAY_HEIGHT / 8)
+
+// Ticks per emulated second, each runs the CPU and counts the timers down.
+#define LIBCHIP8_TICK_FREQUENCY 60
+// Rate of the samples written by LibChip8RenderAudio().
+#define LIBCHIP8_AUDIO_SAMPLE_RATE 48000
+
+// Behaviours where CHIP-8 interpreters differ, for LibChip8SetQuirks(). With
+// none set the machine behaves as it always has.
+// VF_RESET:     8xy1, 8xy2 and 8xy3 clear VF.
+// SHIFT_VY:     8xy6 and 8xyE shift Vy into Vx rather than Vx itself.
+// LOAD_STORE_I: Fx55 and Fx65 leave I past the last register.
+// JUMP_VX:      Bxnn jumps to xnn + Vx rather than nnn + V0.
+// SPRITE_WRAP:  Sprites wrap around the display edges rather than clipping.
+#define LIBCHIP8_QUIRK_VF_RESET 0x01
+#define LIBCHIP8_QUIRK_SHIFT_VY 0x02
+#define LIBCHIP8_QUIRK_LOAD_STORE_I 0x04
+#define LIBCHIP8_QUIRK_JUMP_VX 0x08
+#define LIBCHIP8_QUIRK_SPRITE_WRAP 0x10
+
+// How LibChip8EnvAddReward() reads a value, starting at its address.
+// BYTE: One byte.
+// WORD: Two bytes, most significant first.
+// BCD:  Three decimal digits, hundreds first, as Fx33 writes them.
+#define LIBCHIP8_VALUE_BYTE 0
+#define LIBCHIP8_VALUE_WORD 1
+#define LIBCHIP8_VALUE_BCD 2
+
+// What LibChip8EnvStep() observes of each environment.
+// BITS:  The LIBCHIP8_DISPLAY_SIZE bytes of the display.
+// BYTES: One byte per square of scale by scale pixels, 0 with none lit to 255
+//        with all lit, rows top to bottom.
+#define LIBCHIP8_OBSERVE_BITS 0
+#define LIBCHIP8_OBSERVE_BYTES 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct tLibChip8 LibChip8;
+
+// LibChip8Version() - Returns LIBCHIP8_VERSION of the library that is loaded,
+// which may be newer than the header compiled against.
+LIBCHIP8_API int LibChip8Version(void);
+
+// LibChip8Create() - Creates a machine running cyclesPerTick instructions per
+// tick. A seed of 0 seeds the rng from the current time. Returns NULL on
+// failure. Machines share nothing, each can be used from its own thread.
+LIBCHIP8_API LibChip8 *LibChip8Create(int cyclesPerTick, unsigned int seed);
+
+// LibChip8Destroy() - Frees a machine created by LibChip8Create().
+LIBCHIP8_API void LibChip8Destroy(LibChip8 *c8);
+
+// LibChip8LoadRom() - Loads a ROM of size bytes from memory.
+// Returns 0 on success and -1 on failure.
+LIBCHIP8_API int LibChip8LoadRom(LibChip8 *c8, const uint8_t *data,
+                                 size_t size);
+
+// LibChip8SetQuirks() - Sets the LIBCHIP8_QUIRK_* bits to emulate. Since 1.1.
+LIBCHIP8_API void LibChip8SetQuirks(LibChip8 *c8, uint32_t quirks);
+
+// LibChip8Run() - Runs the given number of ticks.
+LIBCHIP8_API void LibChip8Run(LibChip8 *c8, int ticks);
+
+// LibChip8GetTickCount() - Returns the number of ticks run so far.
+LIBCHIP8_API uint64_t LibChip8GetTickCount(LibChip8 *c8);
+
+// LibChip8SetKey() - Presses or releases one of the 16 keys, 0x0 to 0xF.
+LIBCHIP8_API void LibChip8SetKey(LibChip8 *c8, uint8_t key, bool pressed);
+
+// LibChip8GetDisplay() - Returns the LIBCHIP8_DISPLAY_SIZE bytes of the
+// display. The pointer stays valid for the life of the machine.
+LIBCHIP8_API const uint8_t *LibChip8GetDisplay(LibChip8 *c8);
+
+// LibChip8HashDisplay() - Returns a 64-bit hash of the display.
+LIBCHIP8_API uint64_t LibChip8HashDisplay(LibChip8 *c8);
+
+// LibChip8HashState() - Returns a 64-bit hash of the whole machine state.
+LIBCHIP8_API uint64_t LibChip8HashState(LibChip8 *c8);
+
+// LibChip8IsBuzzing() - Returns if the buzzer is sounding.
+LIBCHIP8_API bool LibChip8IsBuzzing(LibChip8 *c8);
+
+// LibChip8RenderAudio() - Renders sampleCount mono samples of the buzzer at
+// LIBCHIP8_AUDIO_SAMPLE_RATE into samples. Returns false, with the samples
+// silenced, when the buzzer is off.
+LIBCHIP8_API bool LibChip8RenderAudio(LibChip8 *c8, int16_t *samples,
+                                      int sampleCount);
+
+// LibChip8StateMaxSize() - Returns a buffer size that fits any save state.
+LIBCHIP8_API size_t LibChip8StateMaxSize(void);
+
+// LibChip8SaveState() - Writes a versioned, endian independent save state to
+// buffer. Returns the number of bytes written, or 0 if the buffer is too small.
+LIBCHIP8_API size_t LibChip8SaveState(LibChip8 *c8, void *buffer,
+                                      size_t size);
+
+// LibChip8LoadState() - Restores a save state made with the same ROM.
+// Returns 0 on success and -1 on failure, leaving the machine untouched.
+LIBCHIP8_API int LibChip8LoadState(LibChip8 *c8, const void *buffer,
+                                   size_t size);
+
+// Lanes run many machines on one ROM in lockstep, several times faster per
+// core than as many separate machines. Each lane behaves like a machine made
+// with LibChip8Create() and driven the same way. Since 1.2.
+typedef struct tLibChip8Lanes LibChip8Lanes;
+
+// LibChip8LanesCreate() - Creates laneCount machines. Lane n is seeded with
+// seed + n, or from the current time if seed is 0. Returns NULL on failure.
+LIBCHIP8_API LibChip8Lanes *LibChip8LanesCreate(int laneCount,
+                                                int cyclesPerTick,
+                                                unsigned int seed);
+
+// LibChip8LanesDestroy() - Frees lanes created by LibChip8LanesCreate().
+LIBCHIP8_API void LibChip8LanesDestroy(LibChip8Lanes *lanes);
+
+// LibChip8LanesSetQuirks() - Sets the LIBCHIP8_QUIRK_* bits of every lane.
+LIBCHIP8_API void LibChip8LanesSetQuirks(LibChip8Lanes *lanes,
+                                         uint32_t quirks);
+
+// LibChip8LanesLoadRom() - Resets every lane and loads the ROM into all of
+// them. Returns 0 on success and -1 on failure.
+LIBCHIP8_API int LibChip8LanesLoadRom(LibChip8Lanes *lanes,
+                                      const uint8_t *data, size_t size);
+
+// LibChip8LanesSetKeys() - Sets the keys held on a lane, bit n for key n.
+LIBCHIP8_API void LibChip8LanesSetKeys(LibChip8Lanes *lanes, int lane,
+                                       uint16_t keys);
+
+// LibChip8LanesRun() - Runs the given number of ticks on every lane. Returns 0
+// on success and -1 if the lanes ran out of memory, after which they must be
+// reloaded with LibChip8LanesLoadRom().
+LIBCHIP8_API int LibChip8LanesRun(LibChip8Lanes *lanes, int ticks);
+
+// LibChip8LanesGetDisplay() - Returns the LIBCHIP8_DISPLAY_SIZE bytes of the
+// display of a lane. The pointer stays valid for the life of the lanes.
+LIBCHIP8_API const uint8_t *LibChip8LanesGetDisplay(LibChip8Lanes *lanes,
+                                                    int lane);
+
+// LibChip8LanesIsBuzzing() - Returns if the buzzer of a lane is sounding.
+LIBCHIP8_API bool LibChip8LanesIsBuzzing(LibChip8Lanes *lanes, int lane);
+
+// Environments step batches of machines for reinforcement learning. An agent
+// step holds the keys of each environment's action for a number of ticks,
+// then rewards it by the change in values in its memory and writes what its
+// display shows into buffers owned by the caller. Resets restore a snapshot.
+// Since 1.3.
+typedef struct tLibChip8Env LibChip8Env;
+
+// LibChip8EnvCreate() - Creates envCount environments. Environment n is
+// seeded with seed + n, or from the current time if seed is 0. Returns NULL on
+// failure.
+LIBCHIP8_API LibChip8Env *LibChip8EnvCreate(int envCount, int cyclesPerTick,
+                                            unsigned int seed);
+
+// LibChip8EnvDestroy() - Frees environments created by LibChip8EnvCreate().
+LIBCHIP8_API void LibChip8EnvDestroy(LibChip8Env *env);
+
+// LibChip8EnvSetQuirks() - Sets the LIBCHIP8_QUIRK_* bits of every
+// environment.
+LIBCHIP8_API void LibChip8EnvSetQuirks(LibChip8Env *env, uint32_t quirks);
+
+// LibChip8EnvLoadRom() - Loads the ROM into every environment and makes its
+// start the state they reset to. Returns 0 on success and -1 on failure.
+LIBCHIP8_API int LibChip8EnvLoadRom(LibChip8Env *env, const uint8_t *data,
+                                    size_t size);
+
+// LibChip8EnvSetActions() - Sets the keys held for each action, bit n for key
+// n. Without a table an action is the bitmask itself. Returns 0 on success and
+// -1 on failure.
+LIBCHIP8_API int LibChip8EnvSetActions(LibChip8Env *env, const uint16_t *keys,
+                                       int count);
+
+// LibChip8EnvSetFrameSkip() - Sets the ticks an agent step runs for, 1 by
+// default.
+LIBCHIP8_API void LibChip8EnvSetFrameSkip(LibChip8Env *env, int frames);
+
+// LibChip8EnvAddReward() - Adds weight times the change in the
+// LIBCHIP8_VALUE_* at an address to the reward of every step. Addresses below
+// 16 are the registers V0 to VF. Returns 0 on success and -1 on failure.
+LIBCHIP8_API int LibChip8EnvAddReward(LibChip8Env *env, uint16_t address,
+                                      int type, float weight);
+
+// LibChip8EnvSetObservation() - Sets the LIBCHIP8_OBSERVE_* type of the
+// observations, and the scale of LIBCHIP8_OBSERVE_BYTES, which must divide
+// LIBCHIP8_DISPLAY_HEIGHT. Returns 0 on success and -1 on failure.
+LIBCHIP8_API int LibChip8EnvSetObservation(LibChip8Env *env, int type,
+                                           int scale);
+
+// LibChip8EnvGetObservationSize() - Returns the bytes of one observation.
+LIBCHIP8_API size_t LibChip8EnvGetObservationSize(LibChip8Env *env);
+
+// LibChip8EnvStep() - Runs one agent step of every environment with one action
+// each. Writes the observations back to back and a reward per environment,
+// skipping either buffer that is NULL. Returns 0 on success and -1 on failure.
+LIBCHIP8_API int LibChip8EnvStep(LibChip8Env *env, const int *actions,
+                                 uint8_t *observations, float *rewards);
+
+// LibChip8EnvObserve() - Writes the observations of every environment, as
+// LibChip8EnvStep() does.
+LIBCHIP8_API void LibChip8EnvObserve(LibChip8Env *env, uint8_t *observations);
+
+// LibChip8EnvReset() - Restores an environment to the reset state. A seed
+// other than 0 reseeds its rng, 0 keeps that of the reset state.
+LIBCHIP8_API void LibChip8EnvReset(LibChip8Env *env, int index,
+                                   unsigned int seed);
+
+// LibChip8EnvSetResetState() - Makes the current state of an environment the
+// one they all reset to.
+LIBCHIP8_API void LibChip8EnvSetResetState(LibChip8Env *env, int index);
+
+// A scheduler runs thousands of machines off one clock over a few threads.
+// Machines waiting for a key, or for the delay timer to run down, are parked
+// until input or the end of the wait, so the cost of a tick follows the
+// machines doing work. Since 1.4.
+typedef struct tLibChip8Sched LibChip8Sched;
+
+// LibChip8SchedCreate() - Starts a scheduler with threadCount threads, or one
+// per cpu if threadCount is 0 or less. Returns NULL on failure.
+LIBCHIP8_API LibChip8Sched *LibChip8SchedCreate(int threadCount);
+
+// LibChip8SchedDestroy() - Stops a scheduler. Its machines are not destroyed.
+LIBCHIP8_API void LibChip8SchedDestroy(LibChip8Sched *sched);
+
+// LibChip8SchedAdd() - Adds a machine, which the scheduler runs from then on.
+// Returns its index, or -1 on failure.
+LIBCHIP8_API int LibChip8SchedAdd(LibChip8Sched *sched, LibChip8 *c8);
+
+// LibChip8SchedRemove() - Catches a machine up and hands it back. Its index
+// may be reused.
+LIBCHIP8_API void LibChip8SchedRemove(LibChip8Sched *sched, int index);
+
+// LibChip8SchedWake() - Catches a machine up to the scheduler's tick, so that
+// it can be read or changed directly until the next run.
+LIBCHIP8_API LibChip8 *LibChip8SchedWake(LibChip8Sched *sched, int index);
+
+// LibChip8SchedSetKey() - Wakes a machine and presses or releases a key on it.
+LIBCHIP8_API void LibChip8SchedSetKey(LibChip8Sched *sched, int index,
+                                      uint8_t key, bool pressed);
+
+// LibChip8SchedRun() - Runs every machine for the given number of ticks.
+LIBCHIP8_API void LibChip8SchedRun(LibChip8Sched *sched, int ticks);
+
+// LibChip8SchedGetRunningCount() - Returns the number of machines not parked.
+LIBCHIP8_API int LibChip8SchedGetRunningCount(LibChip8Sched *sched);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBCHIP8_H
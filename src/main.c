@@ -1,14 +1,32 @@
+#if defined(__linux__)
+// For sched_setaffinity() and the CPU_SET macros.
+#define _GNU_SOURCE
+#endif
+
 #include "SDL.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#include <math.h>
 #include <time.h>
 
+#if defined(__linux__)
+#include <sched.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
 #include "def.h"
+#include "movie.h"
 #include "options.h"
+#include "persist.h"
+#include "rewind.h"
+#include "synth.h"
 #include "vm.h"
+#include "wav.h"
 
 static void PollEvents();
+static void WaitEvents();
 static void ExitHandler();
 
 static inline int64_t GetPerformanceCounter()
@@ -28,6 +46,41 @@ static inline double GetElapsedSeconds(uint64_t start, uint64_t end)
     return (double)(end - start) / (double)globalPerformanceFreq;
 }
 
+// Tracks how far the OS oversleeps so that SleepUntil() can hand most of a
+// wait to the OS and spin only the last few hundred microseconds. Also keeps
+// statistics of how late each wakeup was against its deadline.
+struct SleepTimer {
+    double overshootMean;
+    double overshootVar;
+
+    int64_t jitterSum;
+    int64_t jitterMax;
+    int jitterCount;
+    int64_t totalJitterSum;
+    int64_t totalJitterMax;
+    int totalJitterCount;
+};
+
+static void InitSleepTimer(struct SleepTimer *timer);
+static void SleepUntil(struct SleepTimer *timer, int64_t deadline);
+static void TakeJitter(struct SleepTimer *timer, double *avgUs, double *maxUs);
+
+// Models the display refresh as a fixed period, measured from the times that
+// blocking presents return. Emulated time is advanced by whole refreshes,
+// which phase-locks the tick schedule to the display instead of to noisy wall
+// clock deltas.
+struct RefreshClock {
+    double period;
+    int64_t lastVblank;
+    int64_t lastObservedVblank;
+    double pendingTime;
+};
+
+static void ResetRefreshClock(struct RefreshClock *clock, int64_t now);
+static void RefreshClockVblank(struct RefreshClock *clock, int64_t time,
+                               bool observed);
+static int64_t RefreshClockTakeTime(struct RefreshClock *clock);
+
 //////////////////// BEGIN VIDEO INTERFACE ////////////////////
 
 struct Window {
@@ -36,6 +89,9 @@ struct Window {
     int height;
     bool fullscreen;
     bool closeRequested;
+    // Set when the window contents were lost or resized and must be presented
+    // again even if the VM has not produced a new frame.
+    bool redrawRequested;
 
     SDL_Window *window;
     SDL_Renderer *renderer;
@@ -60,7 +116,8 @@ struct UpscaleTexture {
 
 static bool InitVideo(int windowScale, bool fullscreen);
 static void DestroyVideo();
-static void PresentVideo();
+static int GetDisplayRefreshRate();
+static void PresentVideo(const uint8_t *display);
 static void ToggleFullscreen();
 void SetWindowTitle(const char *format, ...);
 static void CaptureScreenshot();
@@ -92,12 +149,14 @@ struct AudioDevice {
     int latencySampleCount;
     void *audioBuffer;
     int audioBufferLen;
-    uint32_t runningSampleIndex;
+    Synth synth;
 };
 
 static bool InitAudio();
 static void DestroyAudio();
 static void PushAudio();
+static bool GenerateAudio(VM *vm, Synth *synth, int16_t *buffer,
+                          int sampleCount);
 
 static struct AudioDevice globalAudioDevice = { .ID = 0,
                                                 .sampleCount = 0,
@@ -107,9 +166,201 @@ static struct AudioDevice globalAudioDevice = { .ID = 0,
 
 //////////////////// END AUDIO INTERFACE ////////////////////
 
+//////////////////// BEGIN HEADLESS INTERFACE ////////////////////
+
+// Samples produced by the buzzer during a single VM tick.
+#define HEADLESS_SAMPLES_PER_TICK (SYNTH_SAMPLE_RATE / VM_TICK_FREQUENCY)
+
+static int RunHeadless(const Options *options);
+
+//////////////////// END HEADLESS INTERFACE ////////////////////
+
+//////////////////// BEGIN EMULATION THREAD INTERFACE ////////////////////
+
+#define INPUT_QUEUE_LEN 64
+#define FRAME_BUFFER_SIZE ((CHIP8_W * CHIP8_H) / 8)
+// Set in the shared triple buffer slot when it holds a frame that the main
+// thread has not picked up yet. The low bits hold the buffer index.
+#define FRAME_FRESH_BIT 4
+
+typedef enum {
+    INPUT_EVENT_KEY_DOWN,
+    INPUT_EVENT_KEY_UP,
+    INPUT_EVENT_PAUSE,
+    INPUT_EVENT_RESUME,
+    INPUT_EVENT_FAST_FORWARD_ON,
+    INPUT_EVENT_FAST_FORWARD_OFF,
+    INPUT_EVENT_SAVE_STATE,
+    INPUT_EVENT_LOAD_STATE,
+    INPUT_EVENT_REWIND_ON,
+    INPUT_EVENT_REWIND_OFF
+} InputEventType;
+
+struct InputEvent {
+    uint8_t type;
+    // Key for key events, slot for save state events.
+    uint8_t key;
+    // SDL event time in ms, used to place key transitions within a tick.
+    uint32_t timestamp;
+};
+
+// Maps event timestamps onto the ticks about to run. Events from the wall time
+// between the previous poll (start) and this one (end) are spread over the
+// next `ticks` ticks with their spacing kept, so input lags by a constant
+// interval rather than being rounded up to the next batch of ticks.
+struct InputClock {
+    uint32_t start;
+    uint32_t end;
+    int ticks;
+};
+
+// Single producer (main thread), single consumer (emulation thread) ring.
+struct InputQueue {
+    struct InputEvent events[INPUT_QUEUE_LEN];
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+};
+
+// Lock-free triple buffer of 1bpp frames. The emulation thread owns the back
+// buffer and the main thread owns the front buffer. The third buffer is handed
+// over by atomically exchanging its index through the middle slot, so neither
+// side ever waits on the other.
+struct FrameTripleBuffer {
+    uint8_t frames[3][FRAME_BUFFER_SIZE];
+    SDL_atomic_t middle;
+    int back;
+    int front;
+};
+
+struct EmuThread {
+    SDL_Thread *thread;
+    SDL_atomic_t quitRequested;
+    // Posted with every input event, the thread blocks on it while idle.
+    SDL_sem *wakeup;
+    // Pushed to the main thread's event queue when a frame is published.
+    uint32_t frameEventType;
+    int cpu;
+    bool highPriority;
+    struct SleepTimer sleepTimer;
+
+    struct InputQueue input;
+    struct FrameTripleBuffer frames;
+};
+
+static bool StartEmuThread(int cpu, bool highPriority);
+static void StopEmuThread();
+static void RunThreadedLoop();
+static void SendKey(int key, bool pressed, uint32_t timestamp);
+static double MapInputTime(const struct InputClock *clock, uint32_t timestamp);
+static void SendPause(bool pause);
+static void SendFastForward(bool fastForward);
+static void SendSaveState(bool save, int slot);
+static void SendRewind(bool rewind);
+
+static struct EmuThread globalEmuThread = { .thread = NULL };
+// Used to place key events when the VM runs on the main thread.
+static struct InputClock globalInputClock = { .ticks = 0 };
+
+//////////////////// END EMULATION THREAD INTERFACE ////////////////////
+
+//////////////////// BEGIN RUN-AHEAD INTERFACE ////////////////////
+
+// Presents show the VM `frames` ticks into the future with the keys currently
+// held, which hides the ticks a game takes to react to input. The speculative
+// ticks run from a snapshot that is restored afterwards and push no audio.
+struct RunAhead {
+    int frames;
+    void *snapshot;
+    uint8_t frame[FRAME_BUFFER_SIZE];
+    // Counter time spent on speculative ticks since the last TakeRunAheadCost().
+    int64_t cost;
+};
+
+static bool InitRunAhead(int frames);
+static void DestroyRunAhead();
+static const uint8_t *RunAheadFrame();
+static double TakeRunAheadCost(double elapsed);
+
+static struct RunAhead globalRunAhead = { .frames = 0, .snapshot = NULL };
+
+//////////////////// END RUN-AHEAD INTERFACE ////////////////////
+
+//////////////////// BEGIN REWIND INTERFACE ////////////////////
+
+// A snapshot of the VM is captured after every tick. Holding the rewind hotkey
+// steps back through them one per tick, muted.
+struct Rewind {
+    bool enabled;
+    RewindBuffer buffer;
+};
+
+static bool InitRewind(int megabytes);
+static void DestroyRewind();
+static void CaptureRewind();
+static bool StepRewind();
+
+static struct Rewind globalRewind = { .enabled = false };
+
+//////////////////// END REWIND INTERFACE ////////////////////
+
 //////////////////// BEGIN MAIN ENTRY POINT ////////////////////
 
 #define DELTA_TIME_HISTORY_COUNT 4
+// Largest backlog of ticks that is caught up on. Anything beyond this, e.g.
+// after the process was suspended, is dropped.
+#define MAX_TICK_BACKLOG (VM_TICK_FREQUENCY / 4)
+
+static void RunMainLoop(const Options *options);
+static void RunTick(bool rewinding, bool muted);
+
+// Save states live next to the rom, one file per slot.
+#define SAVE_STATE_SLOTS 10
+
+static bool SaveStateSlot(bool save, int slot);
+
+// The machine shown in the window. Headless runs create their own.
+static VM *globalVM = NULL;
+static const char *globalRomPath = NULL;
+static int globalSaveStateSlot = 0;
+
+// Every key transition is logged while recording and the movie is written out
+// on exit.
+struct Recording {
+    bool active;
+    const char *path;
+    Movie movie;
+};
+
+static void StartRecording(const char *path);
+static void FinishRecording();
+
+static struct Recording globalRecording = { .active = false };
+
+// With --persist the VM state is mirrored into a memory mapped file every
+// second and on exit, and the next launch with the same rom resumes from it.
+#define PERSIST_INTERVAL_TICKS VM_TICK_FREQUENCY
+
+struct Persist {
+    bool active;
+    PersistFile file;
+    int ticksSinceWrite;
+};
+
+static void StartPersist(const char *path, bool resume);
+static void WritePersist(bool wait);
+static void StopPersist();
+
+static struct Persist globalPersist = { .active = false };
+
+// Held hotkeys that change how the VM runs.
+struct PlaybackControls {
+    bool fastForward;
+    bool rewinding;
+};
+
+// Used when the VM shares this thread.
+static struct PlaybackControls globalPlayback = { .fastForward = false,
+                                                  .rewinding = false };
 
 int main(int argc, char *argv[])
 {
@@ -121,6 +372,23 @@ int main(int argc, char *argv[])
     printf("Option 'rom_path' set to %s\n", options.romPath);
     printf("Option 'cycles' set to %d\n", options.cyclesPerTick);
     printf("Option 'palette' set to %s\n", options.paletteName);
+    printf("Option 'seed' set to %u\n", options.seed);
+    printf("Option 'headless' set to %d\n", options.headless);
+    printf("Option 'emu_thread' set to %d\n", options.emuThread);
+    printf("Option 'pacing' set to %s\n", options.pacingName);
+    printf("Option 'frameskip' set to %d\n", options.frameSkip);
+    printf("Option 'runahead' set to %d\n", options.runAhead);
+    printf("Option 'rewind' set to %d\n", options.rewindMegabytes);
+    printf("Option 'record' set to %s\n",
+           options.recordPath ? options.recordPath : "off");
+    printf("Option 'replay' set to %s\n",
+           options.replayPath ? options.replayPath : "off");
+    printf("Option 'persist' set to %s\n",
+           options.persistPath ? options.persistPath : "off");
+
+    if (options.headless) {
+        return RunHeadless(&options);
+    }
 
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0) {
         fprintf(stderr, "Failed to init SDL! %s\n", SDL_GetError());
@@ -135,21 +403,62 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    VMInit(options.cyclesPerTick, options.palette);
-    if (VMLoadRom(options.romPath) != 0) {
+    globalVM = VMCreate(options.cyclesPerTick, options.palette, options.seed);
+    if (!globalVM) {
+        ExitHandler();
+        return EXIT_FAILURE;
+    }
+    if (VMLoadRom(globalVM, options.romPath) != 0) {
         fprintf(stderr, "Failed to load CHIP-8 rom %s!\n", options.romPath);
         ExitHandler();
         return EXIT_FAILURE;
     }
 
+    globalPerformanceFreq = GetPerformanceFrequency();
+    globalRomPath = options.romPath;
+
+    if (!InitRunAhead(options.runAhead) ||
+        !InitRewind(options.rewindMegabytes)) {
+        ExitHandler();
+        return EXIT_FAILURE;
+    }
+
+    // A movie has to start from a cold boot to replay.
+    if (options.persistPath) {
+        StartPersist(options.persistPath, options.recordPath == NULL);
+    }
+    if (options.recordPath) {
+        StartRecording(options.recordPath);
+    }
+
+    if (options.emuThread) {
+        if (!StartEmuThread(options.emuCpu, options.emuHighPriority)) {
+            ExitHandler();
+            return EXIT_FAILURE;
+        }
+        RunThreadedLoop();
+        StopEmuThread();
+        ExitHandler();
+        return EXIT_SUCCESS;
+    }
+
+    RunMainLoop(&options);
+
+    ExitHandler();
+
+    return EXIT_SUCCESS;
+}
+
+static void RunMainLoop(const Options *options)
+{
     // Credit to TylerGlaiel for the frame timing code that was used as a
     // reference.
     // https://github.com/TylerGlaiel/FrameTimingControl
-    globalPerformanceFreq = GetPerformanceFrequency();
     int64_t targetTimePerTick = globalPerformanceFreq / VM_TICK_FREQUENCY;
     int64_t tickAccumulator = 0;
     int64_t lastCounter = GetPerformanceCounter();
     int64_t lastMetricsUpdateCounter = GetPerformanceCounter();
+    int framesSinceMetricsUpdate = 0;
 
     int64_t vsyncMaxErr = globalPerformanceFreq * 0.0002;
     int64_t time60Hz = globalPerformanceFreq / 60;
@@ -167,70 +476,412 @@ int main(int argc, char *argv[])
         deltaTimeHistory[i] = targetTimePerTick;
     unsigned int historyIndx = 0;
 
+    // Sleep pacing is used when present does not block on vsync. In auto mode
+    // that is decided up front from the renderer flags, and again every second
+    // by checking whether the loop runs much faster than the display refresh.
+    // VRR pacing is sleep pacing that presents right at the tick boundaries.
+    struct SleepTimer sleepTimer;
+    InitSleepTimer(&sleepTimer);
+    int refreshRate = GetDisplayRefreshRate();
+    bool sleepPacing = options->pacing == PACING_SLEEP ||
+                       options->pacing == PACING_VRR;
+    if (options->pacing == PACING_AUTO &&
+        !(globalWindow.rendererInfo.flags & SDL_RENDERER_PRESENTVSYNC)) {
+        printf("Renderer has no vsync, using sleep frame pacing\n");
+        sleepPacing = true;
+    }
+    int64_t nextTickDeadline = GetPerformanceCounter() + targetTimePerTick;
+
+    // Display and VRR pacing only present when there is a new emulated frame,
+    // so a 144hz display is not sent the same frame two or three times.
+    bool displayPacing = options->pacing == PACING_DISPLAY;
+    bool presentOnlyNewFrames = displayPacing || options->pacing == PACING_VRR;
+    struct RefreshClock refreshClock;
+    refreshClock.period = (double)globalPerformanceFreq / refreshRate;
+    ResetRefreshClock(&refreshClock, GetPerformanceCounter());
+    uint8_t lastPresented[FRAME_BUFFER_SIZE];
+    memset(lastPresented, 0, sizeof(lastPresented));
+    globalWindow.redrawRequested = true;
+
+    int64_t refreshTime = globalPerformanceFreq / refreshRate;
+    int64_t fastForwardBudget = refreshTime * 3 / 4;
+    int ticksPerRefresh =
+        MAX(1, (VM_TICK_FREQUENCY + refreshRate - 1) / refreshRate);
+    int framesSkipped = 0;
+    int skippedSinceMetricsUpdate = 0;
+    uint32_t lastPollTime = SDL_GetTicks();
+    int64_t fastForwardTicks = 0;
+
     while (!globalWindow.closeRequested) {
+        // Nothing can change while the VM is idle, so sleep in the event queue
+        // and only redraw when the window asks for it. Timing restarts from
+        // the wakeup so the idle time is not caught up on afterwards.
+        if (VMIsIdle(globalVM) && !globalPlayback.rewinding) {
+            globalInputClock.ticks = 0;
+            while (VMIsIdle(globalVM) && !globalPlayback.rewinding &&
+                   !globalWindow.closeRequested) {
+                WaitEvents();
+                if (globalWindow.redrawRequested) {
+                    PresentVideo(VMGetDisplayPixels(globalVM));
+                    globalWindow.redrawRequested = false;
+                }
+            }
+            lastCounter = GetPerformanceCounter();
+            tickAccumulator = 0;
+            nextTickDeadline = lastCounter + targetTimePerTick;
+            ResetRefreshClock(&refreshClock, lastCounter);
+            lastPollTime = SDL_GetTicks();
+            continue;
+        }
+
         int64_t currentCounter = GetPerformanceCounter();
         int64_t deltaTime = currentCounter - lastCounter;
         lastCounter = currentCounter;
 
-        // Handle unexpected delta time anomalies.
-        if (deltaTime > targetTimePerTick * 8) {
-            deltaTime = targetTimePerTick;
-        }
-        if (deltaTime < 0) {
-            deltaTime = 0;
-        }
+        if (displayPacing) {
+            deltaTime = RefreshClockTakeTime(&refreshClock);
+        } else {
+            // Handle unexpected delta time anomalies.
+            if (deltaTime > targetTimePerTick * MAX_TICK_BACKLOG) {
+                deltaTime = targetTimePerTick;
+            }
+            if (deltaTime < 0) {
+                deltaTime = 0;
+            }
 
-        // VSync time snapping.
-        for (int i = 0; i < ARRAY_LEN(snapFrequencies); i++) {
-            if (llabs(deltaTime - snapFrequencies[i]) < vsyncMaxErr) {
-                deltaTime = snapFrequencies[i];
-                break;
+            // VSync time snapping.
+            for (int i = 0; i < ARRAY_LEN(snapFrequencies); i++) {
+                if (llabs(deltaTime - snapFrequencies[i]) < vsyncMaxErr) {
+                    deltaTime = snapFrequencies[i];
+                    break;
+                }
             }
-        }
 
-        // Average the delta time.
-        deltaTimeHistory[historyIndx] = deltaTime;
-        historyIndx = (historyIndx + 1) % DELTA_TIME_HISTORY_COUNT;
-        deltaTime = 0;
-        for (int i = 0; i < DELTA_TIME_HISTORY_COUNT; i++) {
-            deltaTime += deltaTimeHistory[i];
+            // Average the delta time.
+            deltaTimeHistory[historyIndx] = deltaTime;
+            historyIndx = (historyIndx + 1) % DELTA_TIME_HISTORY_COUNT;
+            deltaTime = 0;
+            for (int i = 0; i < DELTA_TIME_HISTORY_COUNT; i++) {
+                deltaTime += deltaTimeHistory[i];
+            }
+            deltaTime /= DELTA_TIME_HISTORY_COUNT;
         }
-        deltaTime /= DELTA_TIME_HISTORY_COUNT;
 
         tickAccumulator += deltaTime;
 
-        // Spiral of death protection.
-        if (tickAccumulator > targetTimePerTick * 8) {
-            tickAccumulator = 0;
-            deltaTime = targetTimePerTick;
+        // Spiral of death protection. The backlog is bounded but kept, and
+        // frame skipping below drops presents until it has been worked off.
+        if (tickAccumulator > targetTimePerTick * MAX_TICK_BACKLOG) {
+            tickAccumulator = targetTimePerTick * MAX_TICK_BACKLOG;
         }
 
+        int ticksDue = (int)(tickAccumulator / targetTimePerTick);
+
+        // Fast-forward runs an unknown number of ticks, so its input lands
+        // within the next one.
+        uint32_t pollTime = SDL_GetTicks();
+        globalInputClock.start = lastPollTime;
+        globalInputClock.end = pollTime;
+        globalInputClock.ticks = globalPlayback.fastForward ? 1 : ticksDue;
+        lastPollTime = pollTime;
+
         PollEvents();
 
-        // Ensure the main application logic ticks at the correct frequency
-        while (tickAccumulator >= targetTimePerTick) {
-            VMTick();
+        // Rewinding takes over while both hotkeys are held.
+        bool fastForward =
+            globalPlayback.fastForward && !globalPlayback.rewinding;
+        int64_t iterationStart = GetPerformanceCounter();
+        int ticksRun = 0;
+        if (fastForward) {
+            // Run muted for most of a refresh, then present once. Timing
+            // restarts afterwards so nothing is caught up when released.
+            int64_t budgetEnd = iterationStart + fastForwardBudget;
+            do {
+                RunTick(false, true);
+                ticksRun++;
+            } while (GetPerformanceCounter() < budgetEnd &&
+                     !VMIsIdle(globalVM));
+            tickAccumulator = 0;
+            nextTickDeadline = GetPerformanceCounter() + targetTimePerTick;
+            fastForwardTicks += ticksRun;
+        } else {
+            // Ensure the main application logic ticks at the correct frequency
+            while (tickAccumulator >= targetTimePerTick) {
+                RunTick(globalPlayback.rewinding, false);
 
-            PushAudio();
+                tickAccumulator -= targetTimePerTick;
+                ticksRun++;
+            }
+        }
 
-            tickAccumulator -= targetTimePerTick;
+        // More ticks were due than a refresh normally covers, so the loop is
+        // behind. Drop presents, which also skips blocking on vsync, until it
+        // has caught up or the skip limit is reached.
+        bool behind = !fastForward && ticksDue > ticksPerRefresh + 1;
+        bool skip = behind && framesSkipped < options->frameSkip;
+        framesSkipped = skip ? framesSkipped + 1 : 0;
+        skippedSinceMetricsUpdate += skip ? 1 : 0;
+
+        // Speculate only when real ticks ran, otherwise the last run-ahead
+        // frame is still current.
+        const uint8_t *display = VMGetDisplayPixels(globalVM);
+        if (globalRunAhead.frames > 0 && !fastForward &&
+            !globalPlayback.rewinding) {
+            display = ticksRun > 0 ? RunAheadFrame() : globalRunAhead.frame;
+        }
+        bool present = !skip &&
+                       (!presentOnlyNewFrames || globalWindow.redrawRequested ||
+                        (ticksRun > 0 &&
+                         memcmp(display, lastPresented, FRAME_BUFFER_SIZE) != 0));
+        if (present) {
+            PresentVideo(display);
+            memcpy(lastPresented, display, FRAME_BUFFER_SIZE);
+            globalWindow.redrawRequested = false;
+            framesSinceMetricsUpdate++;
         }
 
-        PresentVideo();
+        if (displayPacing) {
+            // A present blocks until the vblank. Without one, or if present
+            // returned early because vsync is not honoured, wait for where the
+            // next vblank should be.
+            int64_t now = GetPerformanceCounter();
+            int64_t predicted =
+                refreshClock.lastVblank + (int64_t)refreshClock.period;
+            if (present && now - refreshClock.lastVblank >
+                               (int64_t)(refreshClock.period / 2)) {
+                RefreshClockVblank(&refreshClock, now, true);
+            } else {
+                SleepUntil(&sleepTimer, predicted);
+                RefreshClockVblank(&refreshClock, predicted, false);
+            }
+        }
+
+        if (sleepPacing && fastForward) {
+            // Present at most once per refresh while fast-forwarding.
+            SleepUntil(&sleepTimer, iterationStart + refreshTime);
+        } else if (sleepPacing && !skip) {
+            SleepUntil(&sleepTimer, nextTickDeadline);
+            nextTickDeadline += targetTimePerTick;
+            // Start over from now if we fell far behind, e.g. while the window
+            // was being dragged, rather than skipping the sleeps to catch up.
+            int64_t now = GetPerformanceCounter();
+            if (now - nextTickDeadline > targetTimePerTick * 8) {
+                nextTickDeadline = now + targetTimePerTick;
+            }
+        }
+
+        double elapsed =
+            GetElapsedSeconds(lastMetricsUpdateCounter, GetPerformanceCounter());
+        if (elapsed > 1.0) {
+            if (options->pacing == PACING_AUTO && !sleepPacing &&
+                framesSinceMetricsUpdate / elapsed > refreshRate * 1.5) {
+                printf("Present is not blocking on vsync, using sleep frame "
+                       "pacing\n");
+                sleepPacing = true;
+                nextTickDeadline = GetPerformanceCounter() + targetTimePerTick;
+            }
 
-        if (GetElapsedSeconds(lastMetricsUpdateCounter,
-                              GetPerformanceCounter()) > 1.0) {
             double msPerFrame = (((1000.0 * (double)deltaTime) /
                                   (double)globalPerformanceFreq));
-            int64_t fps = globalPerformanceFreq / deltaTime;
-            SetWindowTitle("CHIP-8 | %.02fms/f, %d FPS", msPerFrame, fps);
+            int64_t fps = globalPerformanceFreq / MAX(deltaTime, 1);
+            char status[96] = "";
+            int statusLen = 0;
+            if (fastForwardTicks > 0) {
+                statusLen = snprintf(status, sizeof(status),
+                                     " | fast-forward %.01fx",
+                                     fastForwardTicks / elapsed /
+                                         VM_TICK_FREQUENCY);
+            } else if (globalPlayback.rewinding) {
+                statusLen = snprintf(status, sizeof(status),
+                                     " | rewinding, %.0fs left",
+                                     RewindSeconds(&globalRewind.buffer,
+                                                   VM_TICK_FREQUENCY));
+            } else if (skippedSinceMetricsUpdate > 0) {
+                statusLen = snprintf(status, sizeof(status),
+                                     " | %d frames skipped",
+                                     skippedSinceMetricsUpdate);
+            }
+            if (globalRunAhead.frames > 0) {
+                snprintf(status + statusLen, sizeof(status) - statusLen,
+                         " | run-ahead %d, %.01f%% cpu", globalRunAhead.frames,
+                         100.0 * TakeRunAheadCost(elapsed));
+            }
+
+            if (presentOnlyNewFrames) {
+                // Frame time is meaningless when presents are skipped, show
+                // the present rate instead.
+                double jitterAvg, jitterMax;
+                TakeJitter(&sleepTimer, &jitterAvg, &jitterMax);
+                SetWindowTitle(
+                    "CHIP-8 | %d presents/s, %.02fhz display | jitter %.0fus avg, %.0fus max%s",
+                    (int)(framesSinceMetricsUpdate / elapsed),
+                    globalPerformanceFreq / refreshClock.period, jitterAvg,
+                    jitterMax, status);
+            } else if (sleepPacing) {
+                double jitterAvg, jitterMax;
+                TakeJitter(&sleepTimer, &jitterAvg, &jitterMax);
+                SetWindowTitle(
+                    "CHIP-8 | %.02fms/f, %d FPS | jitter %.0fus avg, %.0fus max%s",
+                    msPerFrame, fps, jitterAvg, jitterMax, status);
+            } else {
+                SetWindowTitle("CHIP-8 | %.02fms/f, %d FPS%s", msPerFrame, fps,
+                               status);
+            }
             lastMetricsUpdateCounter = GetPerformanceCounter();
+            framesSinceMetricsUpdate = 0;
+            skippedSinceMetricsUpdate = 0;
+            fastForwardTicks = 0;
         }
     }
 
-    ExitHandler();
+    if (displayPacing) {
+        printf("Measured display refresh: %.03fhz\n",
+               globalPerformanceFreq / refreshClock.period);
+    }
+    if ((sleepPacing || displayPacing) && sleepTimer.totalJitterCount > 0) {
+        printf("Frame pacing jitter: %.0fus avg, %.0fus max\n",
+               1e6 * sleepTimer.totalJitterSum / sleepTimer.totalJitterCount /
+                   globalPerformanceFreq,
+               1e6 * sleepTimer.totalJitterMax / globalPerformanceFreq);
+    }
+}
 
-    return EXIT_SUCCESS;
+// Runs one tick forwards, or steps one tick back while rewinding. Muted ticks
+// queue no audio, but are otherwise recorded like any other.
+static void RunTick(bool rewinding, bool muted)
+{
+    if (rewinding) {
+        // Input recorded after the point rewound to never happened.
+        if (StepRewind() && globalRecording.active) {
+            MovieTruncate(&globalRecording.movie, VMGetTickCount(globalVM));
+        }
+        return;
+    }
+
+    VMTick(globalVM);
+    if (!muted)
+        PushAudio();
+    CaptureRewind();
+
+    if (globalPersist.active &&
+        ++globalPersist.ticksSinceWrite >= PERSIST_INTERVAL_TICKS) {
+        WritePersist(false);
+    }
+}
+
+// Returns if a state was loaded, which the caller must get on screen. The
+// window is left alone as this runs on the emulation thread when there is one.
+static bool SaveStateSlot(bool save, int slot)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s.state%d", globalRomPath, slot);
+
+    if (save) {
+        if (VMSaveStateFile(globalVM, path) == 0)
+            printf("State saved to %s!\n", path);
+        return false;
+    }
+
+    // A state from another timeline cannot be replayed from the recording.
+    if (globalRecording.active) {
+        printf("Loading states is disabled while recording\n");
+        return false;
+    }
+
+    if (VMLoadStateFile(globalVM, path) != 0)
+        return false;
+
+    printf("State loaded from %s!\n", path);
+    // The history leads up to the state that was replaced.
+    if (globalRewind.enabled)
+        RewindReset(&globalRewind.buffer);
+    return true;
+}
+
+static void RecordKey(uint64_t tick, int cycle, uint8_t key, bool pressed,
+                      void *user)
+{
+    Movie *movie = user;
+    MovieEvent event = {
+        .tick = tick, .cycle = cycle, .key = key, .pressed = pressed
+    };
+    MovieAppend(movie, event);
+}
+
+static void StartRecording(const char *path)
+{
+    MovieInit(&globalRecording.movie, VMGetRomHash(globalVM),
+              VMGetSeed(globalVM), VMGetCyclesPerTick(globalVM),
+              VMGetQuirks(globalVM));
+    VMSetKeyListener(globalVM, RecordKey, &globalRecording.movie);
+    globalRecording.path = path;
+    globalRecording.active = true;
+}
+
+// Must only run once the VM has stopped ticking.
+static void FinishRecording()
+{
+    if (!globalRecording.active) {
+        return;
+    }
+
+    Movie *movie = &globalRecording.movie;
+    movie->frames = VMGetTickCount(globalVM);
+    movie->finalHash = VMHashMovieState(globalVM);
+    if (MovieSave(movie, globalRecording.path) == 0) {
+        printf("Movie of %d key events over %llu ticks written to %s\n",
+               movie->eventCount, (unsigned long long)movie->frames,
+               globalRecording.path);
+    }
+
+    VMSetKeyListener(globalVM, NULL, NULL);
+    MovieFree(movie);
+    globalRecording.active = false;
+}
+
+static void StartPersist(const char *path, bool resume)
+{
+    int64_t start = GetPerformanceCounter();
+    if (PersistOpen(&globalPersist.file, path, VM_STATE_MAX_SIZE) != 0) {
+        return;
+    }
+    globalPersist.active = true;
+    globalPersist.ticksSinceWrite = 0;
+
+    // Anything that does not check out is a cold start.
+    size_t size;
+    const uint8_t *state =
+        PersistRead(&globalPersist.file, VMGetRomHash(globalVM), &size);
+    if (!resume || !state || VMLoadState(globalVM, state, size) != 0) {
+        printf("Cold start, persisting state to %s\n", path);
+        return;
+    }
+
+    printf("Resumed from %s in %.02fms\n", path,
+           1000.0 * GetElapsedSeconds(start, GetPerformanceCounter()));
+}
+
+// Must only run from the thread that owns the VM.
+static void WritePersist(bool wait)
+{
+    size_t maxSize;
+    uint8_t *buffer = PersistStateBuffer(&globalPersist.file, &maxSize);
+    size_t size = VMSaveState(globalVM, buffer, maxSize);
+    PersistCommit(&globalPersist.file, VMGetRomHash(globalVM), size);
+    PersistFlush(&globalPersist.file, wait);
+    globalPersist.ticksSinceWrite = 0;
+}
+
+// Must only run once the VM has stopped ticking.
+static void StopPersist()
+{
+    if (!globalPersist.active) {
+        return;
+    }
+
+    WritePersist(true);
+    PersistClose(&globalPersist.file);
+    globalPersist.active = false;
 }
 
 //////////////////// END MAIN ENTRY POINT ////////////////////
@@ -240,56 +891,125 @@ int main(int argc, char *argv[])
 static void KeyboardEventHandler(SDL_KeyboardEvent *event);
 static void WindowEventHandler(SDL_WindowEvent *event);
 
+static void HandleEvent(SDL_Event *event)
+{
+    switch (event->type) {
+    case SDL_QUIT:
+        globalWindow.closeRequested = true;
+        break;
+    case SDL_WINDOWEVENT:
+        WindowEventHandler(&event->window);
+        break;
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+        KeyboardEventHandler(&event->key);
+        break;
+    }
+}
+
 static void PollEvents()
 {
     SDL_Event event;
     while (SDL_PollEvent(&event)) {
-        switch (event.type) {
-        case SDL_QUIT:
-            globalWindow.closeRequested = true;
-            break;
-        case SDL_WINDOWEVENT:
-            WindowEventHandler(&event.window);
-            break;
-        case SDL_KEYDOWN:
-        case SDL_KEYUP:
-            KeyboardEventHandler(&event.key);
-            break;
-        }
+        HandleEvent(&event);
+    }
+}
+
+// Blocks until an event arrives, then handles it and anything else queued.
+static void WaitEvents()
+{
+    SDL_Event event;
+    if (SDL_WaitEvent(&event)) {
+        HandleEvent(&event);
+        PollEvents();
     }
 }
 
 static bool CheckFullscreenToggle(SDL_Keysym sym);
 static bool CheckScreenshot(SDL_Keysym sym);
+static bool CheckFastForward(SDL_Keysym sym);
+static bool CheckSaveStateHotkey(SDL_Keysym sym);
+static bool CheckRewind(SDL_Keysym sym);
 static int MapKey(SDL_Scancode sc);
 
 static void KeyboardEventHandler(SDL_KeyboardEvent *event)
 {
     switch (event->type) {
     case SDL_KEYDOWN: {
+        // Window operations can block for a while. Pause the VM around them
+        // when it shares this thread, the emulation thread keeps running.
         if (CheckFullscreenToggle(event->keysym)) {
-            VMTogglePause(true);
+            if (!globalEmuThread.thread)
+                VMTogglePause(globalVM, true);
             ToggleFullscreen();
-            VMTogglePause(false);
+            if (!globalEmuThread.thread)
+                VMTogglePause(globalVM, false);
             return;
         }
 
         if (CheckScreenshot(event->keysym)) {
-            VMTogglePause(true);
+            if (!globalEmuThread.thread)
+                VMTogglePause(globalVM, true);
             CaptureScreenshot();
-            VMTogglePause(false);
+            if (!globalEmuThread.thread)
+                VMTogglePause(globalVM, false);
+            return;
+        }
+
+        if (CheckFastForward(event->keysym)) {
+            if (!event->repeat)
+                SendFastForward(true);
+            return;
+        }
+
+        if (CheckRewind(event->keysym)) {
+            if (!event->repeat)
+                SendRewind(true);
+            return;
+        }
+
+        // F5 saves, F8 loads and F6/F7 step through the slots.
+        if (CheckSaveStateHotkey(event->keysym)) {
+            if (event->repeat)
+                return;
+            switch (event->keysym.sym) {
+            case SDLK_F5:
+                SendSaveState(true, globalSaveStateSlot);
+                break;
+            case SDLK_F8:
+                SendSaveState(false, globalSaveStateSlot);
+                break;
+            case SDLK_F6:
+            case SDLK_F7:
+                globalSaveStateSlot =
+                    (globalSaveStateSlot + SAVE_STATE_SLOTS +
+                     (event->keysym.sym == SDLK_F7 ? 1 : -1)) %
+                    SAVE_STATE_SLOTS;
+                printf("Save state slot %d selected\n", globalSaveStateSlot);
+                break;
+            }
             return;
         }
 
         int key = MapKey(event->keysym.sym);
         if (key >= 0) {
-            VMSetKey(key);
+            SendKey(key, true, event->timestamp);
         }
     } break;
     case SDL_KEYUP: {
+        if (CheckFastForward(event->keysym)) {
+            SendFastForward(false);
+            return;
+        }
+
+        if (CheckRewind(event->keysym)) {
+            SendRewind(false);
+            return;
+        }
+
         int key = MapKey(event->keysym.sym);
         if (key >= 0) {
-            VMClearKey(key);
+            SendKey(key, false, event->timestamp);
         }
     } break;
     }
@@ -300,17 +1020,32 @@ static void WindowEventHandler(SDL_WindowEvent *event)
     switch (event->type) {
     case SDL_WINDOWEVENT_SHOWN:
     case SDL_WINDOWEVENT_FOCUS_GAINED:
-        VMTogglePause(false);
+        SendPause(false);
         break;
     case SDL_WINDOWEVENT_HIDDEN:
     case SDL_WINDOWEVENT_FOCUS_LOST:
-        VMTogglePause(true);
+        SendPause(true);
+        break;
+    case SDL_WINDOWEVENT_EXPOSED:
+    case SDL_WINDOWEVENT_SIZE_CHANGED:
+        globalWindow.redrawRequested = true;
         break;
     }
 }
 
 static void ExitHandler()
 {
+    FinishRecording();
+
+    StopPersist();
+
+    DestroyRewind();
+
+    DestroyRunAhead();
+
+    VMDestroy(globalVM);
+    globalVM = NULL;
+
     DestroyAudio();
 
     DestroyVideo();
@@ -336,6 +1071,22 @@ static bool CheckScreenshot(SDL_Keysym sym)
     return (sym.sym == SDLK_PRINTSCREEN);
 }
 
+static bool CheckFastForward(SDL_Keysym sym)
+{
+    return (sym.sym == SDLK_TAB);
+}
+
+static bool CheckRewind(SDL_Keysym sym)
+{
+    return (sym.sym == SDLK_BACKSPACE);
+}
+
+static bool CheckSaveStateHotkey(SDL_Keysym sym)
+{
+    return (sym.sym == SDLK_F5 || sym.sym == SDLK_F6 || sym.sym == SDLK_F7 ||
+            sym.sym == SDLK_F8);
+}
+
 static int MapKey(SDL_Scancode sc)
 {
     // clang-format off
@@ -363,6 +1114,122 @@ static int MapKey(SDL_Scancode sc)
 
 //////////////////// END EVENTS IMPLEMENTATION ////////////////////
 
+//////////////////// BEGIN TIMING IMPLEMENTATION ////////////////////
+
+// Bounds for the margin left to spin after sleeping.
+#define SLEEP_MIN_MARGIN_US 50
+#define SLEEP_MAX_MARGIN_US 4000
+
+static void InitSleepTimer(struct SleepTimer *timer)
+{
+    memset(timer, 0, sizeof(*timer));
+    // Assume the OS can oversleep by a millisecond until we have measured it.
+    timer->overshootMean = globalPerformanceFreq / 1000.0;
+}
+
+static void SleepFor(int64_t counts)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    int64_t ns = counts * 1000000000 / globalPerformanceFreq;
+    struct timespec ts = { .tv_sec = ns / 1000000000,
+                           .tv_nsec = ns % 1000000000 };
+    nanosleep(&ts, NULL);
+#else
+    SDL_Delay((uint32_t)(counts * 1000 / globalPerformanceFreq));
+#endif
+}
+
+static void SleepUntil(struct SleepTimer *timer, int64_t deadline)
+{
+    // Spin margin is the expected overshoot plus two standard deviations.
+    double margin = timer->overshootMean + 2.0 * sqrt(timer->overshootVar);
+    margin = MAX(margin, SLEEP_MIN_MARGIN_US * globalPerformanceFreq / 1e6);
+    margin = MIN(margin, SLEEP_MAX_MARGIN_US * globalPerformanceFreq / 1e6);
+
+    int64_t now = GetPerformanceCounter();
+    int64_t request = deadline - now - (int64_t)margin;
+    if (request > 0) {
+        SleepFor(request);
+
+        // Exponentially weighted mean and variance of the overshoot, so the
+        // estimate follows changes in system load.
+        double overshoot = (double)(GetPerformanceCounter() - now - request);
+        double diff = overshoot - timer->overshootMean;
+        timer->overshootMean += diff / 16.0;
+        timer->overshootVar += (diff * diff - timer->overshootVar) / 16.0;
+    }
+
+    while ((now = GetPerformanceCounter()) < deadline) {
+    }
+
+    int64_t late = now - deadline;
+    timer->jitterSum += late;
+    timer->jitterMax = MAX(timer->jitterMax, late);
+    timer->jitterCount++;
+    timer->totalJitterSum += late;
+    timer->totalJitterMax = MAX(timer->totalJitterMax, late);
+    timer->totalJitterCount++;
+}
+
+// Returns the wakeup jitter since the last call in microseconds.
+static void TakeJitter(struct SleepTimer *timer, double *avgUs, double *maxUs)
+{
+    double toUs = 1e6 / globalPerformanceFreq;
+    *avgUs = timer->jitterCount > 0 ?
+                 toUs * timer->jitterSum / timer->jitterCount :
+                 0.0;
+    *maxUs = toUs * timer->jitterMax;
+
+    timer->jitterSum = 0;
+    timer->jitterMax = 0;
+    timer->jitterCount = 0;
+}
+
+static void ResetRefreshClock(struct RefreshClock *clock, int64_t now)
+{
+    clock->lastVblank = now;
+    clock->lastObservedVblank = 0;
+    clock->pendingTime = 0.0;
+}
+
+// Accounts for the refreshes since the previous vblank. Observed vblanks are
+// the return times of blocking presents and also refine the period estimate;
+// an interval is only used if it is close to a whole number of periods.
+static void RefreshClockVblank(struct RefreshClock *clock, int64_t time,
+                               bool observed)
+{
+    double elapsed = (double)(time - clock->lastVblank);
+    int vblanks = MAX(1, (int)floor(elapsed / clock->period + 0.5));
+    clock->pendingTime += vblanks * clock->period;
+
+    if (observed && clock->lastObservedVblank != 0) {
+        double interval = (double)(time - clock->lastObservedVblank);
+        int count = (int)floor(interval / clock->period + 0.5);
+        if (count >= 1) {
+            double measured = interval / count;
+            if (fabs(measured - clock->period) < clock->period / 4) {
+                clock->period += (measured - clock->period) / 32.0;
+            }
+        }
+    }
+    if (observed) {
+        clock->lastObservedVblank = time;
+    }
+
+    clock->lastVblank = time;
+}
+
+// Returns the emulated time covered by the refreshes since the last call.
+static int64_t RefreshClockTakeTime(struct RefreshClock *clock)
+{
+    int64_t time = (int64_t)clock->pendingTime;
+    clock->pendingTime -= (double)time;
+
+    return time;
+}
+
+//////////////////// END TIMING IMPLEMENTATION ////////////////////
+
 //////////////////// BEGIN VIDEO IMPLEMENTATION ////////////////////
 
 static bool InitWindowAndRenderer();
@@ -418,11 +1285,10 @@ static void DestroyVideo()
     printf("All video resources destroyed\n");
 }
 
-static void PresentVideo()
+static void PresentVideo(const uint8_t *display)
 {
     VMColorPalette palette;
-    VMGetColorPalette(palette);
-    uint8_t *display = VMGetDisplayPixels();
+    VMGetColorPalette(globalVM, palette);
     int len = CHIP8_W * CHIP8_H;
 
     for (int pos = 0; pos < len; pos++) {
@@ -453,6 +1319,21 @@ static void PresentVideo()
     SDL_RenderPresent(globalWindow.renderer);
 }
 
+// Returns the refresh rate of the display the window is on, or 60 if it is
+// unknown.
+static int GetDisplayRefreshRate()
+{
+    SDL_DisplayMode mode;
+    int displayIndex = SDL_GetWindowDisplayIndex(globalWindow.window);
+    if (displayIndex < 0 ||
+        SDL_GetCurrentDisplayMode(displayIndex, &mode) != 0 ||
+        mode.refresh_rate <= 0) {
+        return 60;
+    }
+
+    return mode.refresh_rate;
+}
+
 static void ToggleFullscreen()
 {
     globalWindow.fullscreen = !globalWindow.fullscreen;
@@ -717,7 +1598,7 @@ static bool InitAudio()
 
     SDL_AudioSpec want, have;
     SDL_memset(&want, 0, sizeof(want));
-    want.freq = 48000;
+    want.freq = SYNTH_SAMPLE_RATE;
     want.format = AUDIO_S16LSB;
     want.channels = 1;
     // The VM ticks at 60hz. So use this frequency to calculate how many samples
@@ -743,6 +1624,8 @@ static bool InitAudio()
     }
     globalAudioDevice.audioBufferLen = globalAudioDevice.latencySampleCount * 2;
 
+    SynthInit(&globalAudioDevice.synth);
+
     SDL_PauseAudioDevice(globalAudioDevice.ID, 0);
 
     printf(
@@ -768,23 +1651,706 @@ static void DestroyAudio()
 
 static void PushAudio()
 {
-    if (globalAudioDevice.ID == 0 || VMGetSoundTimer() <= 0) {
+    if (globalAudioDevice.ID == 0 || VMGetSoundTimer(globalVM) <= 0) {
         return;
     }
 
-    int halfSquareWavePeriod = (48000 / 256) / 2;
-    int toneVolume = 3000;
     int16_t *buffer = (int16_t *)globalAudioDevice.audioBuffer;
     int sampleCount = globalAudioDevice.latencySampleCount -
                       SDL_GetQueuedAudioSize(globalAudioDevice.ID) / 2;
+    if (sampleCount <= 0) {
+        return;
+    }
+
+    if (GenerateAudio(globalVM, &globalAudioDevice.synth, buffer,
+                      sampleCount)) {
+        SDL_QueueAudio(globalAudioDevice.ID, buffer, sampleCount * 2);
+    }
+}
 
-    for (int i = 0; i < sampleCount; i++) {
-        int16_t volume =
-            (++globalAudioDevice.runningSampleIndex / halfSquareWavePeriod) % 2;
-        buffer[i] = volume ? toneVolume : -toneVolume;
+// Fills the buffer with the buzzer output for the current sound timer. Both
+// the audio device and the WAV writer go through here so that they produce
+// identical samples. Returns false, with the buffer silenced, when the buzzer
+// is off.
+static bool GenerateAudio(VM *vm, Synth *synth, int16_t *buffer,
+                          int sampleCount)
+{
+    if (VMGetSoundTimer(vm) <= 0) {
+        memset(buffer, 0, sampleCount * sizeof(int16_t));
+        return false;
     }
 
-    SDL_QueueAudio(globalAudioDevice.ID, buffer, sampleCount * 2);
+    SynthRender(synth, buffer, sampleCount);
+    return true;
 }
 
 //////////////////// END AUDIO IMPLEMENTATION ////////////////////
+
+//////////////////// START HEADLESS IMPLEMENTATION ////////////////////
+
+static int RunHeadless(const Options *options)
+{
+    // A replay takes the seed, cycles, quirks and length from the movie.
+    Movie movie;
+    bool replay = options->replayPath != NULL;
+    int cyclesPerTick = options->cyclesPerTick;
+    unsigned int seed = options->seed;
+    uint32_t quirks = 0;
+    uint64_t frames = options->frames;
+    if (replay) {
+        if (MovieLoad(&movie, options->replayPath) != 0) {
+            return EXIT_FAILURE;
+        }
+        cyclesPerTick = movie.cyclesPerTick;
+        seed = movie.seed;
+        quirks = movie.quirks;
+        frames = movie.frames;
+    }
+
+    VM *vm = VMCreate(cyclesPerTick, options->palette, seed);
+    if (!vm) {
+        if (replay)
+            MovieFree(&movie);
+        return EXIT_FAILURE;
+    }
+    VMSetQuirks(vm, quirks);
+    if (VMLoadRom(vm, options->romPath) != 0) {
+        fprintf(stderr, "Failed to load CHIP-8 rom %s!\n", options->romPath);
+        if (replay)
+            MovieFree(&movie);
+        VMDestroy(vm);
+        return EXIT_FAILURE;
+    }
+    if (replay && movie.romHash != VMGetRomHash(vm)) {
+        fprintf(stderr, "Movie %s was recorded with a different rom!\n",
+                options->replayPath);
+        MovieFree(&movie);
+        VMDestroy(vm);
+        return EXIT_FAILURE;
+    }
+
+    // The buzzer is rendered tick by tick rather than against wall time, so
+    // the output is the same no matter how fast the run goes.
+    Synth synth;
+    WavWriter wav;
+    int16_t samples[HEADLESS_SAMPLES_PER_TICK];
+    bool audioOut = options->audioOutPath != NULL;
+    if (audioOut) {
+        SynthInit(&synth);
+        if (WavWriterOpen(&wav, options->audioOutPath, SYNTH_SAMPLE_RATE) !=
+            0) {
+            if (replay)
+                MovieFree(&movie);
+            VMDestroy(vm);
+            return EXIT_FAILURE;
+        }
+    }
+
+    globalPerformanceFreq = GetPerformanceFrequency();
+    int64_t startCounter = GetPerformanceCounter();
+    int result = EXIT_SUCCESS;
+
+    int nextEvent = 0;
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        // Queue this tick's input. The VM applies each event at its cycle.
+        while (replay && nextEvent < movie.eventCount &&
+               movie.events[nextEvent].tick <= frame) {
+            const MovieEvent *event = &movie.events[nextEvent++];
+            VMScheduleKeyAt(vm, event->key, event->pressed, event->tick,
+                            event->cycle);
+        }
+
+        VMTick(vm);
+
+        if (audioOut) {
+            GenerateAudio(vm, &synth, samples, HEADLESS_SAMPLES_PER_TICK);
+            if (WavWriterWrite(&wav, samples, HEADLESS_SAMPLES_PER_TICK) != 0) {
+                result = EXIT_FAILURE;
+                break;
+            }
+        }
+    }
+
+    if (audioOut) {
+        if (WavWriterClose(&wav) != 0) {
+            result = EXIT_FAILURE;
+        } else {
+            printf("Audio written to %s\n", options->audioOutPath);
+        }
+    }
+
+    printf("Headless run finished! %llu ticks in %.03fs\n",
+           (unsigned long long)frames,
+           GetElapsedSeconds(startCounter, GetPerformanceCounter()));
+    printf("State hash %016llx, display hash %016llx\n",
+           (unsigned long long)VMHashState(vm),
+           (unsigned long long)VMHashDisplay(vm));
+
+    if (replay) {
+        uint64_t hash = VMHashMovieState(vm);
+        if (hash == movie.finalHash) {
+            printf("Replay matches the recording, state hash %016llx\n",
+                   (unsigned long long)hash);
+        } else {
+            fprintf(stderr,
+                    "Replay diverged from the recording! State hash %016llx, "
+                    "expected %016llx\n",
+                    (unsigned long long)hash,
+                    (unsigned long long)movie.finalHash);
+            result = EXIT_FAILURE;
+        }
+        MovieFree(&movie);
+    }
+
+    VMDestroy(vm);
+    return result;
+}
+
+//////////////////// END HEADLESS IMPLEMENTATION ////////////////////
+
+//////////////////// START EMULATION THREAD IMPLEMENTATION ////////////////////
+
+static int EmuThreadMain(void *data);
+static bool SetThreadAffinity(int cpu);
+static bool PushInputEvent(struct InputQueue *queue, struct InputEvent event);
+static bool PopInputEvent(struct InputQueue *queue, struct InputEvent *event);
+static void PublishFrame(struct FrameTripleBuffer *fb, const uint8_t *display);
+static void PostFrame(const uint8_t *display);
+static bool AcquireFrame(struct FrameTripleBuffer *fb);
+
+static bool StartEmuThread(int cpu, bool highPriority)
+{
+    globalEmuThread.cpu = cpu;
+    globalEmuThread.highPriority = highPriority;
+    SDL_AtomicSet(&globalEmuThread.quitRequested, 0);
+    SDL_AtomicSet(&globalEmuThread.input.head, 0);
+    SDL_AtomicSet(&globalEmuThread.input.tail, 0);
+
+    // Every buffer starts out as the current display so the main thread has
+    // something valid to show before the first frame is published.
+    struct FrameTripleBuffer *fb = &globalEmuThread.frames;
+    for (int i = 0; i < 3; i++) {
+        memcpy(fb->frames[i], VMGetDisplayPixels(globalVM), FRAME_BUFFER_SIZE);
+    }
+    fb->back = 0;
+    SDL_AtomicSet(&fb->middle, 1);
+    fb->front = 2;
+
+    globalEmuThread.wakeup = SDL_CreateSemaphore(0);
+    if (!globalEmuThread.wakeup) {
+        fprintf(stderr, "Failed to create the emulation thread semaphore! %s\n",
+                SDL_GetError());
+        return false;
+    }
+    globalEmuThread.frameEventType = SDL_RegisterEvents(1);
+
+    globalEmuThread.thread =
+        SDL_CreateThread(EmuThreadMain, "CHIP-8 emulation", NULL);
+    if (!globalEmuThread.thread) {
+        fprintf(stderr, "Failed to create the emulation thread! %s\n",
+                SDL_GetError());
+        return false;
+    }
+
+    printf("Emulation thread started\n");
+    return true;
+}
+
+static void StopEmuThread()
+{
+    if (!globalEmuThread.thread) {
+        return;
+    }
+
+    SDL_AtomicSet(&globalEmuThread.quitRequested, 1);
+    SDL_SemPost(globalEmuThread.wakeup);
+    SDL_WaitThread(globalEmuThread.thread, NULL);
+    globalEmuThread.thread = NULL;
+    SDL_DestroySemaphore(globalEmuThread.wakeup);
+    globalEmuThread.wakeup = NULL;
+
+    struct SleepTimer *timer = &globalEmuThread.sleepTimer;
+    printf("Emulation thread stopped! Tick jitter: %.0fus avg, %.0fus max\n",
+           timer->totalJitterCount > 0 ?
+               1e6 * timer->totalJitterSum / timer->totalJitterCount /
+                   globalPerformanceFreq :
+               0.0,
+           1e6 * timer->totalJitterMax / globalPerformanceFreq);
+}
+
+// The main thread only handles events and presents whatever frame the
+// emulation thread published last, so a slow present never holds up a tick.
+// Published frames arrive as events, so the thread sleeps in the event queue
+// between them and stays asleep while the VM is idle.
+static void RunThreadedLoop()
+{
+    struct FrameTripleBuffer *fb = &globalEmuThread.frames;
+    int64_t lastMetricsUpdateCounter = GetPerformanceCounter();
+    int presentCount = 0;
+
+    while (!globalWindow.closeRequested) {
+        WaitEvents();
+
+        if (!AcquireFrame(fb) && !globalWindow.redrawRequested) {
+            continue;
+        }
+
+        PresentVideo(fb->frames[fb->front]);
+        globalWindow.redrawRequested = false;
+        presentCount++;
+
+        int64_t currentCounter = GetPerformanceCounter();
+        double elapsed = GetElapsedSeconds(lastMetricsUpdateCounter,
+                                           currentCounter);
+        if (elapsed > 1.0) {
+            SetWindowTitle("CHIP-8 | %.02fms/f, %d FPS",
+                           1000.0 * elapsed / presentCount,
+                           (int)(presentCount / elapsed));
+            lastMetricsUpdateCounter = currentCounter;
+            presentCount = 0;
+        }
+    }
+}
+
+static void SendKey(int key, bool pressed, uint32_t timestamp)
+{
+    if (!globalEmuThread.thread) {
+        VMScheduleKey(globalVM, key, pressed,
+                      MapInputTime(&globalInputClock, timestamp));
+        return;
+    }
+
+    struct InputEvent event = { .type = pressed ? INPUT_EVENT_KEY_DOWN :
+                                                  INPUT_EVENT_KEY_UP,
+                                .key = (uint8_t)key,
+                                .timestamp = timestamp };
+    if (!PushInputEvent(&globalEmuThread.input, event)) {
+        fprintf(stderr, "Input queue is full, dropping key event!\n");
+    }
+    SDL_SemPost(globalEmuThread.wakeup);
+}
+
+// Returns the offset in ticks at which an event with this timestamp should be
+// applied. With no ticks to map onto it lands at the start of the next tick.
+static double MapInputTime(const struct InputClock *clock, uint32_t timestamp)
+{
+    // Compare through signed differences so the ms counter may wrap.
+    int32_t span = (int32_t)(clock->end - clock->start);
+    if (clock->ticks <= 0 || span <= 0) {
+        return 0.0;
+    }
+
+    int32_t offset = (int32_t)(timestamp - clock->start);
+    offset = MAX(0, MIN(offset, span - 1));
+    return (double)offset / span * clock->ticks;
+}
+
+// Fast-forward runs muted, so anything already queued is cut off as well.
+static void SendFastForward(bool fastForward)
+{
+    if (fastForward && globalAudioDevice.ID > 0) {
+        SDL_ClearQueuedAudio(globalAudioDevice.ID);
+    }
+
+    if (!globalEmuThread.thread) {
+        globalPlayback.fastForward = fastForward;
+        return;
+    }
+
+    struct InputEvent event = { .type = fastForward ?
+                                            INPUT_EVENT_FAST_FORWARD_ON :
+                                            INPUT_EVENT_FAST_FORWARD_OFF };
+    if (!PushInputEvent(&globalEmuThread.input, event)) {
+        fprintf(stderr, "Input queue is full, dropping fast-forward event!\n");
+    }
+    SDL_SemPost(globalEmuThread.wakeup);
+}
+
+// Rewinding is muted like fast-forward.
+static void SendRewind(bool rewind)
+{
+    if (!globalRewind.enabled) {
+        return;
+    }
+    if (rewind && globalAudioDevice.ID > 0) {
+        SDL_ClearQueuedAudio(globalAudioDevice.ID);
+    }
+
+    if (!globalEmuThread.thread) {
+        globalPlayback.rewinding = rewind;
+        return;
+    }
+
+    struct InputEvent event = { .type = rewind ? INPUT_EVENT_REWIND_ON :
+                                                 INPUT_EVENT_REWIND_OFF };
+    if (!PushInputEvent(&globalEmuThread.input, event)) {
+        fprintf(stderr, "Input queue is full, dropping rewind event!\n");
+    }
+    SDL_SemPost(globalEmuThread.wakeup);
+}
+
+static void SendSaveState(bool save, int slot)
+{
+    if (!globalEmuThread.thread) {
+        if (SaveStateSlot(save, slot))
+            globalWindow.redrawRequested = true;
+        return;
+    }
+
+    struct InputEvent event = { .type = save ? INPUT_EVENT_SAVE_STATE :
+                                               INPUT_EVENT_LOAD_STATE,
+                                .key = (uint8_t)slot };
+    if (!PushInputEvent(&globalEmuThread.input, event)) {
+        fprintf(stderr, "Input queue is full, dropping save state event!\n");
+    }
+    SDL_SemPost(globalEmuThread.wakeup);
+}
+
+static void SendPause(bool pause)
+{
+    if (!globalEmuThread.thread) {
+        VMTogglePause(globalVM, pause);
+        return;
+    }
+
+    struct InputEvent event = { .type = pause ? INPUT_EVENT_PAUSE :
+                                                INPUT_EVENT_RESUME };
+    if (!PushInputEvent(&globalEmuThread.input, event)) {
+        fprintf(stderr, "Input queue is full, dropping pause event!\n");
+    }
+    SDL_SemPost(globalEmuThread.wakeup);
+}
+
+static void ApplyInputEvent(struct InputEvent event,
+                            const struct InputClock *clock,
+                            struct PlaybackControls *playback)
+{
+    switch (event.type) {
+    case INPUT_EVENT_KEY_DOWN:
+    case INPUT_EVENT_KEY_UP:
+        VMScheduleKey(globalVM, event.key, event.type == INPUT_EVENT_KEY_DOWN,
+                      MapInputTime(clock, event.timestamp));
+        break;
+    case INPUT_EVENT_PAUSE:
+        VMTogglePause(globalVM, true);
+        break;
+    case INPUT_EVENT_RESUME:
+        VMTogglePause(globalVM, false);
+        break;
+    case INPUT_EVENT_FAST_FORWARD_ON:
+        playback->fastForward = true;
+        break;
+    case INPUT_EVENT_FAST_FORWARD_OFF:
+        playback->fastForward = false;
+        break;
+    case INPUT_EVENT_REWIND_ON:
+        playback->rewinding = true;
+        break;
+    case INPUT_EVENT_REWIND_OFF:
+        playback->rewinding = false;
+        break;
+    case INPUT_EVENT_SAVE_STATE:
+    case INPUT_EVENT_LOAD_STATE:
+        // Publish the loaded state, the VM may be paused and publish no more.
+        if (SaveStateSlot(event.type == INPUT_EVENT_SAVE_STATE, event.key))
+            PostFrame(VMGetDisplayPixels(globalVM));
+        break;
+    }
+}
+
+// Ticks are scheduled against absolute deadlines rather than the time since
+// the last wakeup, so oversleeping one tick is made up on the next one instead
+// of accumulating drift.
+static int EmuThreadMain(void *data)
+{
+    if (globalEmuThread.highPriority &&
+        SDL_SetThreadPriority(SDL_THREAD_PRIORITY_TIME_CRITICAL) != 0) {
+        fprintf(stderr, "Failed to raise emulation thread priority! %s\n",
+                SDL_GetError());
+    }
+    if (globalEmuThread.cpu >= 0 && !SetThreadAffinity(globalEmuThread.cpu)) {
+        fprintf(stderr, "Failed to pin emulation thread to cpu %d!\n",
+                globalEmuThread.cpu);
+    }
+
+    struct SleepTimer *sleepTimer = &globalEmuThread.sleepTimer;
+    InitSleepTimer(sleepTimer);
+    int64_t targetTimePerTick = globalPerformanceFreq / VM_TICK_FREQUENCY;
+    int64_t deadline = GetPerformanceCounter() + targetTimePerTick;
+    struct PlaybackControls playback = { .fastForward = false,
+                                         .rewinding = false };
+    bool fastForward = false;
+    uint32_t lastDrainTime = SDL_GetTicks();
+
+    while (!SDL_AtomicGet(&globalEmuThread.quitRequested)) {
+        if (!fastForward) {
+            SleepUntil(sleepTimer, deadline);
+        }
+
+        // Catch up on every tick that is due. If the thread was not scheduled
+        // for a long time (e.g. the machine was suspended) start over from
+        // now rather than running a burst of ticks.
+        int64_t now = GetPerformanceCounter();
+        if (now - deadline > targetTimePerTick * MAX_TICK_BACKLOG) {
+            deadline = now;
+        }
+
+        // Input from since the last drain is spread over the ticks due now.
+        struct InputClock inputClock = {
+            .start = lastDrainTime,
+            .end = SDL_GetTicks(),
+            .ticks = fastForward ?
+                         1 :
+                         MAX(1, (int)((now - deadline) / targetTimePerTick) + 1)
+        };
+        lastDrainTime = inputClock.end;
+
+        struct InputEvent event;
+        while (PopInputEvent(&globalEmuThread.input, &event)) {
+            ApplyInputEvent(event, &inputClock, &playback);
+        }
+        fastForward = playback.fastForward && !playback.rewinding;
+
+        // Block until input arrives while the VM cannot make progress, then
+        // restart the tick schedule from the wakeup. Keys pressed meanwhile
+        // land at the start of the first tick.
+        if (VMIsIdle(globalVM) && !playback.rewinding) {
+            struct InputClock idleClock = { .ticks = 0 };
+            while (VMIsIdle(globalVM) && !playback.rewinding &&
+                   !SDL_AtomicGet(&globalEmuThread.quitRequested)) {
+                SDL_SemWait(globalEmuThread.wakeup);
+                while (PopInputEvent(&globalEmuThread.input, &event)) {
+                    ApplyInputEvent(event, &idleClock, &playback);
+                }
+            }
+            deadline = GetPerformanceCounter() + targetTimePerTick;
+            lastDrainTime = SDL_GetTicks();
+            continue;
+        }
+
+        if (fastForward) {
+            // Run muted for a tick's worth of wall time, then publish a
+            // single frame.
+            int64_t budgetEnd = GetPerformanceCounter() + targetTimePerTick;
+            do {
+                RunTick(false, true);
+            } while (GetPerformanceCounter() < budgetEnd &&
+                     !VMIsIdle(globalVM));
+            deadline = GetPerformanceCounter() + targetTimePerTick;
+        } else {
+            while (now >= deadline) {
+                RunTick(playback.rewinding, false);
+                deadline += targetTimePerTick;
+            }
+        }
+
+        const uint8_t *display = VMGetDisplayPixels(globalVM);
+        if (globalRunAhead.frames > 0 && !fastForward && !playback.rewinding) {
+            display = RunAheadFrame();
+        }
+        PostFrame(display);
+    }
+
+    return 0;
+}
+
+static bool SetThreadAffinity(int cpu)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    // A pid of 0 applies the mask to the calling thread.
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#else
+    (void)cpu;
+    fprintf(stderr, "Thread affinity is not supported on this platform!\n");
+    return false;
+#endif
+}
+
+static bool PushInputEvent(struct InputQueue *queue, struct InputEvent event)
+{
+    unsigned int tail = (unsigned int)SDL_AtomicGet(&queue->tail);
+    unsigned int head = (unsigned int)SDL_AtomicGet(&queue->head);
+    if (tail - head >= INPUT_QUEUE_LEN) {
+        return false;
+    }
+
+    queue->events[tail % INPUT_QUEUE_LEN] = event;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&queue->tail, (int)(tail + 1));
+
+    return true;
+}
+
+static bool PopInputEvent(struct InputQueue *queue, struct InputEvent *event)
+{
+    unsigned int head = (unsigned int)SDL_AtomicGet(&queue->head);
+    unsigned int tail = (unsigned int)SDL_AtomicGet(&queue->tail);
+    if (head == tail) {
+        return false;
+    }
+
+    SDL_MemoryBarrierAcquire();
+    *event = queue->events[head % INPUT_QUEUE_LEN];
+    SDL_AtomicSet(&queue->head, (int)(head + 1));
+
+    return true;
+}
+
+static void PublishFrame(struct FrameTripleBuffer *fb, const uint8_t *display)
+{
+    memcpy(fb->frames[fb->back], display, FRAME_BUFFER_SIZE);
+
+    SDL_MemoryBarrierRelease();
+    int old = SDL_AtomicSet(&fb->middle, fb->back | FRAME_FRESH_BIT);
+    fb->back = old & ~FRAME_FRESH_BIT;
+}
+
+// Publishes a frame and wakes the main thread to present it.
+static void PostFrame(const uint8_t *display)
+{
+    PublishFrame(&globalEmuThread.frames, display);
+
+    SDL_Event frameEvent;
+    SDL_memset(&frameEvent, 0, sizeof(frameEvent));
+    frameEvent.type = globalEmuThread.frameEventType;
+    SDL_PushEvent(&frameEvent);
+}
+
+static bool AcquireFrame(struct FrameTripleBuffer *fb)
+{
+    if (!(SDL_AtomicGet(&fb->middle) & FRAME_FRESH_BIT)) {
+        return false;
+    }
+
+    int old = SDL_AtomicSet(&fb->middle, fb->front);
+    SDL_MemoryBarrierAcquire();
+    fb->front = old & ~FRAME_FRESH_BIT;
+
+    return true;
+}
+
+//////////////////// END EMULATION THREAD IMPLEMENTATION ////////////////////
+
+//////////////////// START RUN-AHEAD IMPLEMENTATION ////////////////////
+
+static bool InitRunAhead(int frames)
+{
+    globalRunAhead.frames = frames;
+    globalRunAhead.cost = 0;
+    if (frames <= 0) {
+        return true;
+    }
+
+    globalRunAhead.snapshot = malloc(VMSnapshotSize());
+    if (!globalRunAhead.snapshot) {
+        fprintf(stderr, "Failed to allocate the run-ahead snapshot!\n");
+        return false;
+    }
+
+    return true;
+}
+
+static void DestroyRunAhead()
+{
+    free(globalRunAhead.snapshot);
+    globalRunAhead.snapshot = NULL;
+}
+
+// Runs the VM ahead from a snapshot and returns the display it reached. The
+// VM is left exactly as it was, including the synth, since no audio is pushed
+// for the speculative ticks, and the movie, since the key listener is detached
+// while they run.
+static const uint8_t *RunAheadFrame()
+{
+    int64_t start = GetPerformanceCounter();
+
+    VMTakeSnapshot(globalVM, globalRunAhead.snapshot);
+    VMSetKeyListener(globalVM, NULL, NULL);
+    for (int i = 0; i < globalRunAhead.frames; i++) {
+        VMTick(globalVM);
+    }
+    memcpy(globalRunAhead.frame, VMGetDisplayPixels(globalVM),
+           FRAME_BUFFER_SIZE);
+    VMRestoreSnapshot(globalVM, globalRunAhead.snapshot);
+    if (globalRecording.active) {
+        VMSetKeyListener(globalVM, RecordKey, &globalRecording.movie);
+    }
+
+    globalRunAhead.cost += GetPerformanceCounter() - start;
+    return globalRunAhead.frame;
+}
+
+// Returns the fraction of the elapsed seconds spent running ahead and resets
+// the count.
+static double TakeRunAheadCost(double elapsed)
+{
+    double cost = (double)globalRunAhead.cost / globalPerformanceFreq;
+    globalRunAhead.cost = 0;
+    return elapsed > 0.0 ? cost / elapsed : 0.0;
+}
+
+//////////////////// END RUN-AHEAD IMPLEMENTATION ////////////////////
+
+//////////////////// START REWIND IMPLEMENTATION ////////////////////
+
+static bool InitRewind(int megabytes)
+{
+    if (megabytes <= 0) {
+        return true;
+    }
+
+    assert(REWIND_SPAN_SIZE == VM_STATE_SPAN_SIZE);
+    if (RewindInit(&globalRewind.buffer, (size_t)megabytes << 20,
+                   VM_STATE_MAX_SIZE) != 0) {
+        return false;
+    }
+
+    globalRewind.enabled = true;
+    return true;
+}
+
+static void DestroyRewind()
+{
+    if (globalRewind.enabled) {
+        RewindDestroy(&globalRewind.buffer);
+        globalRewind.enabled = false;
+    }
+}
+
+static void CaptureRewind()
+{
+    if (!globalRewind.enabled) {
+        return;
+    }
+
+    // Only the parts of the state over memory the CPU wrote need comparing.
+    uint64_t changedSpans =
+        VMStateDirtySpans(VMTakeDirtyBlocks(globalVM, VMDIRTY_CONSUMER_REWIND));
+
+    uint8_t state[VM_STATE_MAX_SIZE];
+    size_t size = VMSaveState(globalVM, state, sizeof(state));
+    RewindCapture(&globalRewind.buffer, state, size, changedSpans);
+}
+
+// Returns false once the oldest snapshot has been reached.
+static bool StepRewind()
+{
+    if (!globalRewind.enabled) {
+        return false;
+    }
+
+    uint8_t state[VM_STATE_MAX_SIZE];
+    size_t size;
+    if (!RewindStep(&globalRewind.buffer, state, &size)) {
+        return false;
+    }
+
+    return VMLoadState(globalVM, state, size) == 0;
+}
+
+//////////////////// END REWIND IMPLEMENTATION ////////////////////
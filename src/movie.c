@@ -0,0 +1,151 @@
+#include "movie.h"
+
+#include <inttypes.h>
+
+#define MOVIE_MAGIC "CHIP8-MOVIE"
+
+void MovieInit(Movie *movie, uint32_t romHash, unsigned int seed,
+               int cyclesPerTick, uint32_t quirks)
+{
+    assert(movie != NULL);
+
+    memset(movie, 0, sizeof(*movie));
+    movie->romHash = romHash;
+    movie->seed = seed;
+    movie->cyclesPerTick = cyclesPerTick;
+    movie->quirks = quirks;
+}
+
+void MovieFree(Movie *movie)
+{
+    assert(movie != NULL);
+
+    free(movie->events);
+    movie->events = NULL;
+    movie->eventCount = 0;
+    movie->eventCapacity = 0;
+}
+
+int MovieAppend(Movie *movie, MovieEvent event)
+{
+    assert(movie != NULL);
+
+    if (movie->eventCount == movie->eventCapacity) {
+        int capacity = MAX(256, movie->eventCapacity * 2);
+        MovieEvent *events =
+            realloc(movie->events, capacity * sizeof(MovieEvent));
+        if (!events) {
+            fprintf(stderr, "Failed to grow the movie event list!\n");
+            return -1;
+        }
+        movie->events = events;
+        movie->eventCapacity = capacity;
+    }
+
+    movie->events[movie->eventCount++] = event;
+    return 0;
+}
+
+void MovieTruncate(Movie *movie, uint64_t tick)
+{
+    assert(movie != NULL);
+
+    while (movie->eventCount > 0 &&
+           movie->events[movie->eventCount - 1].tick >= tick) {
+        movie->eventCount--;
+    }
+}
+
+// The format is a header of "name value" lines followed by one line per event
+// of "tick cycle key down", with the key in hex and down as 1 or 0. The quirks
+// are the Chip8Quirk bits in hex.
+int MovieSave(const Movie *movie, const char *filePath)
+{
+    assert(movie != NULL);
+    assert(filePath != NULL);
+
+    FILE *file = fopen(filePath, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to fopen() movie file at %s!\n", filePath);
+        return -1;
+    }
+
+    fprintf(file, "%s %d\n", MOVIE_MAGIC, MOVIE_VERSION);
+    fprintf(file, "rom %08" PRIx32 "\n", movie->romHash);
+    fprintf(file, "seed %u\n", movie->seed);
+    fprintf(file, "cycles %d\n", movie->cyclesPerTick);
+    fprintf(file, "quirks %" PRIx32 "\n", movie->quirks);
+    fprintf(file, "frames %" PRIu64 "\n", movie->frames);
+    fprintf(file, "hash %016" PRIx64 "\n", movie->finalHash);
+    fprintf(file, "events %d\n", movie->eventCount);
+    for (int i = 0; i < movie->eventCount; i++) {
+        const MovieEvent *event = &movie->events[i];
+        fprintf(file, "%" PRIu64 " %d %x %d\n", event->tick, event->cycle,
+                event->key, event->pressed ? 1 : 0);
+    }
+
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Failed to write movie file %s!\n", filePath);
+        return -1;
+    }
+
+    return 0;
+}
+
+int MovieLoad(Movie *movie, const char *filePath)
+{
+    assert(movie != NULL);
+    assert(filePath != NULL);
+
+    memset(movie, 0, sizeof(*movie));
+
+    FILE *file = fopen(filePath, "r");
+    if (!file) {
+        fprintf(stderr, "Failed to fopen() movie file at %s!\n", filePath);
+        return -1;
+    }
+
+    int version = 0;
+    int eventCount = 0;
+    if (fscanf(file, MOVIE_MAGIC " %d", &version) != 1 ||
+        version != MOVIE_VERSION) {
+        fprintf(stderr, "Movie %s is not a version %d CHIP-8 movie!\n",
+                filePath, MOVIE_VERSION);
+        goto error;
+    }
+    if (fscanf(file, " rom %" SCNx32, &movie->romHash) != 1 ||
+        fscanf(file, " seed %u", &movie->seed) != 1 ||
+        fscanf(file, " cycles %d", &movie->cyclesPerTick) != 1 ||
+        fscanf(file, " quirks %" SCNx32, &movie->quirks) != 1 ||
+        fscanf(file, " frames %" SCNu64, &movie->frames) != 1 ||
+        fscanf(file, " hash %" SCNx64, &movie->finalHash) != 1 ||
+        fscanf(file, " events %d", &eventCount) != 1 || eventCount < 0) {
+        fprintf(stderr, "Movie %s has a malformed header!\n", filePath);
+        goto error;
+    }
+
+    for (int i = 0; i < eventCount; i++) {
+        MovieEvent event;
+        unsigned int key;
+        int pressed;
+        if (fscanf(file, " %" SCNu64 " %d %x %d", &event.tick, &event.cycle,
+                   &key, &pressed) != 4) {
+            fprintf(stderr, "Movie %s is truncated at event %d!\n", filePath,
+                    i);
+            goto error;
+        }
+        event.key = (uint8_t)(key & 0xF);
+        event.pressed = pressed != 0;
+        if (MovieAppend(movie, event) != 0) {
+            goto error;
+        }
+    }
+
+    fclose(file);
+    return 0;
+
+error:
+    fclose(file);
+    MovieFree(movie);
+    return -1;
+}
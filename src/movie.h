@@ -0,0 +1,59 @@
+#ifndef CHIP8_MOVIE_H
+#define CHIP8_MOVIE_H
+
+// Movie module.
+// Records the key transitions of a run, keyed by the tick and cycle they
+// reached the CPU at, together with everything else needed to replay the run
+// exactly: the rom hash, rng seed, cycles per tick and quirks. Movies are plain
+// text so they can be attached to bug reports and diffed.
+
+#include "def.h"
+
+#define MOVIE_VERSION 3
+
+typedef struct tMovieEvent {
+    uint64_t tick;
+    int cycle;
+    uint8_t key;
+    bool pressed;
+} MovieEvent;
+
+typedef struct tMovie {
+    uint32_t romHash;
+    unsigned int seed;
+    int cyclesPerTick;
+    // The Chip8Quirk bits the run emulated.
+    uint32_t quirks;
+    // Length of the run in ticks and the VMHashMovieState() it ended on.
+    uint64_t frames;
+    uint64_t finalHash;
+
+    MovieEvent *events;
+    int eventCount;
+    int eventCapacity;
+} Movie;
+
+// MovieInit() - Starts an empty movie for the given run settings.
+void MovieInit(Movie *movie, uint32_t romHash, unsigned int seed,
+               int cyclesPerTick, uint32_t quirks);
+
+// MovieFree() - Frees the events of the movie.
+void MovieFree(Movie *movie);
+
+// MovieAppend() - Appends a key transition. Events must be appended in the
+// order they were applied. Returns 0 on success and -1 on failure.
+int MovieAppend(Movie *movie, MovieEvent event);
+
+// MovieTruncate() - Drops every event from the given tick onwards, e.g. after
+// rewinding to that tick.
+void MovieTruncate(Movie *movie, uint64_t tick);
+
+// MovieSave() - Writes the movie to the given filepath.
+// Returns 0 on success and -1 on failure.
+int MovieSave(const Movie *movie, const char *filePath);
+
+// MovieLoad() - Reads a movie from the given filepath.
+// Returns 0 on success and -1 on failure.
+int MovieLoad(Movie *movie, const char *filePath);
+
+#endif // CHIP8_MOVIE_H
@@ -10,9 +10,25 @@
         (options)->cyclesPerTick = 20;                                         \
         (options)->paletteName = "nokia";                                      \
         (options)->palette = VMCOLOR_PALETTE_NOKIA;                            \
+        (options)->seed = 0;                                                   \
+        (options)->headless = false;                                           \
+        (options)->frames = 600;                                               \
+        (options)->audioOutPath = NULL;                                        \
+        (options)->emuThread = false;                                          \
+        (options)->emuCpu = -1;                                                \
+        (options)->emuHighPriority = false;                                    \
+        (options)->pacingName = "auto";                                        \
+        (options)->pacing = PACING_AUTO;                                       \
+        (options)->frameSkip = 4;                                              \
+        (options)->runAhead = 0;                                               \
+        (options)->rewindMegabytes = 4;                                        \
+        (options)->recordPath = NULL;                                          \
+        (options)->replayPath = NULL;                                          \
+        (options)->persistPath = NULL;                                         \
     }
 
 static bool OptionsSetPaletteFromString(Options *options, const char *str);
+static bool OptionsSetPacingFromString(Options *options, const char *str);
 
 void OptionsCreateFromArgv(Options *options, int argc, char *argv[])
 {
@@ -20,6 +36,10 @@ void OptionsCreateFromArgv(Options *options, int argc, char *argv[])
     OPTIONS_SET_DEFAULTS(options);
 
     const char *paletteName = options->paletteName;
+    const char *pacingName = options->pacingName;
+    int headless = options->headless;
+    int emuThread = options->emuThread;
+    int emuHighPriority = options->emuHighPriority;
 
     adc_argp_option opts[] = {
         ADC_ARGP_HELP(),
@@ -37,7 +57,49 @@ void OptionsCreateFromArgv(Options *options, int argc, char *argv[])
         ADC_ARGP_OPTION(
             "palette", "p", ADC_ARGP_TYPE_STRING, &paletteName,
             "Set the color palette. Defaults to 'nokia'. "
-            "Palettes: 'nokia','original','lcd','crt','borland','octo','gray','hotdog','cga0','cga1'")
+            "Palettes: 'nokia','original','lcd','crt','borland','octo','gray','hotdog','cga0','cga1'"),
+        ADC_ARGP_OPTION(
+            "seed", "s", ADC_ARGP_TYPE_UINT, &options->seed,
+            "Seed for the CHIP-8 rng. Defaults to 0, which seeds from the time"),
+        ADC_ARGP_OPTION("headless", "H", ADC_ARGP_TYPE_FLAG, &headless,
+                        "Run without a window or audio device. Defaults to off"),
+        ADC_ARGP_OPTION("frames", "n", ADC_ARGP_TYPE_UINT, &options->frames,
+                        "Ticks to run in headless mode. Defaults to 600"),
+        ADC_ARGP_OPTION(
+            "audio-out", "a", ADC_ARGP_TYPE_STRING, &options->audioOutPath,
+            "Render the buzzer to a WAV file. Implies --headless. Defaults to off"),
+        ADC_ARGP_OPTION(
+            "emu-thread", "t", ADC_ARGP_TYPE_FLAG, &emuThread,
+            "Run the VM on its own thread, decoupled from rendering. Defaults to off"),
+        ADC_ARGP_OPTION(
+            "emu-cpu", "tc", ADC_ARGP_TYPE_INT, &options->emuCpu,
+            "Pin the emulation thread to a cpu. Defaults to -1, no pinning"),
+        ADC_ARGP_OPTION(
+            "emu-priority", "tp", ADC_ARGP_TYPE_FLAG, &emuHighPriority,
+            "Run the emulation thread at time critical priority. Defaults to off"),
+        ADC_ARGP_OPTION(
+            "pacing", "fp", ADC_ARGP_TYPE_STRING, &pacingName,
+            "Set the frame pacing. Defaults to 'auto'. "
+            "Pacing: 'auto' (sleep if present does not block),'vsync','sleep',"
+            "'display' (lock ticks to the measured refresh),'vrr'"),
+        ADC_ARGP_OPTION(
+            "frameskip", "fs", ADC_ARGP_TYPE_UINT, &options->frameSkip,
+            "Max presents to drop in a row while catching up. Defaults to 4"),
+        ADC_ARGP_OPTION(
+            "runahead", "ra", ADC_ARGP_TYPE_UINT, &options->runAhead,
+            "Ticks to run ahead of the presented frame, up to 8. Defaults to 0"),
+        ADC_ARGP_OPTION(
+            "rewind", "rw", ADC_ARGP_TYPE_UINT, &options->rewindMegabytes,
+            "Megabytes of rewind history, 0 disables rewind. Defaults to 4"),
+        ADC_ARGP_OPTION("record", "rec", ADC_ARGP_TYPE_STRING,
+                        &options->recordPath,
+                        "Record the input to a movie file. Defaults to off"),
+        ADC_ARGP_OPTION(
+            "replay", "rep", ADC_ARGP_TYPE_STRING, &options->replayPath,
+            "Replay a movie file at full speed. Implies --headless. Defaults to off"),
+        ADC_ARGP_OPTION(
+            "persist", "ps", ADC_ARGP_TYPE_STRING, &options->persistPath,
+            "Keep the state in this file and resume from it on launch. Defaults to off")
     };
 
     adc_argp_parser *parser = adc_argp_new_parser(opts, ADC_ARGP_COUNT(opts));
@@ -52,8 +114,17 @@ void OptionsCreateFromArgv(Options *options, int argc, char *argv[])
         fprintf(stderr,
                 "Option '--palette' option has an unknown value of %s\n",
                 paletteName);
+    if (!OptionsSetPacingFromString(options, pacingName))
+        fprintf(stderr,
+                "Option '--pacing' option has an unknown value of %s\n",
+                pacingName);
+    options->headless = headless || options->audioOutPath != NULL ||
+                        options->replayPath != NULL;
+    options->emuThread = emuThread;
+    options->emuHighPriority = emuHighPriority;
     options->windowScale = MAX(1, options->windowScale);
     options->windowScale = MIN(16, options->windowScale);
+    options->runAhead = MIN(8, options->runAhead);
 }
 
 static bool OptionsSetPaletteFromString(Options *options, const char *str)
@@ -87,3 +158,27 @@ static bool OptionsSetPaletteFromString(Options *options, const char *str)
 
 #undef STR_EQL
 }
+
+static bool OptionsSetPacingFromString(Options *options, const char *str)
+{
+#define STR_EQL(a, b) (strcmp(a, b) == 0)
+
+    if (STR_EQL("auto", str)) {
+        options->pacing = PACING_AUTO;
+    } else if (STR_EQL("vsync", str)) {
+        options->pacing = PACING_VSYNC;
+    } else if (STR_EQL("sleep", str)) {
+        options->pacing = PACING_SLEEP;
+    } else if (STR_EQL("display", str)) {
+        options->pacing = PACING_DISPLAY;
+    } else if (STR_EQL("vrr", str)) {
+        options->pacing = PACING_VRR;
+    } else {
+        return false;
+    }
+
+    options->pacingName = str;
+    return true;
+
+#undef STR_EQL
+}
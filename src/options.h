@@ -3,6 +3,14 @@
 
 #include "vm.h"
 
+typedef enum {
+    PACING_AUTO,
+    PACING_VSYNC,
+    PACING_SLEEP,
+    PACING_DISPLAY,
+    PACING_VRR
+} PacingMode;
+
 typedef struct tOptions {
     int windowScale;
     bool fullscreen;
@@ -10,6 +18,21 @@ typedef struct tOptions {
     int cyclesPerTick;
     const char *paletteName;
     VMColorPaletteType palette;
+    unsigned int seed;
+    bool headless;
+    int frames;
+    const char *audioOutPath;
+    bool emuThread;
+    int emuCpu;
+    bool emuHighPriority;
+    const char *pacingName;
+    PacingMode pacing;
+    int frameSkip;
+    int runAhead;
+    int rewindMegabytes;
+    const char *recordPath;
+    const char *replayPath;
+    const char *persistPath;
 } Options;
 
 void OptionsCreateFromArgv(Options *options, int argc, char *argv[]);
@@ -0,0 +1,224 @@
+#include "persist.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define PERSIST_MAGIC 0x53503843 // "C8PS"
+#define PERSIST_VERSION 1
+
+typedef struct tPersistHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t romHash;
+    uint32_t stateSize;
+    // FNV-1a of the header, with this field zeroed, followed by the state.
+    uint32_t checksum;
+    uint32_t reserved;
+} PersistHeader;
+
+static uint32_t Checksum(const PersistHeader *header, const uint8_t *state);
+static int MapFile(PersistFile *pf, const char *filePath);
+static void UnmapFile(PersistFile *pf);
+
+int PersistOpen(PersistFile *pf, const char *filePath, size_t maxStateSize)
+{
+    assert(pf != NULL);
+    assert(filePath != NULL);
+
+    memset(pf, 0, sizeof(*pf));
+    pf->size = sizeof(PersistHeader) + maxStateSize;
+
+    if (MapFile(pf, filePath) != 0) {
+        fprintf(stderr, "Failed to map persistent state file %s!\n",
+                filePath);
+        return -1;
+    }
+
+    return 0;
+}
+
+void PersistClose(PersistFile *pf)
+{
+    assert(pf != NULL);
+
+    if (!pf->mapping) {
+        return;
+    }
+
+    PersistFlush(pf, true);
+    UnmapFile(pf);
+    pf->mapping = NULL;
+}
+
+const uint8_t *PersistRead(const PersistFile *pf, uint32_t romHash,
+                           size_t *size)
+{
+    assert(pf != NULL && pf->mapping != NULL);
+    assert(size != NULL);
+
+    const PersistHeader *header = (const PersistHeader *)pf->mapping;
+    const uint8_t *state = pf->mapping + sizeof(PersistHeader);
+
+    if (header->magic != PERSIST_MAGIC || header->version != PERSIST_VERSION ||
+        header->stateSize == 0 ||
+        header->stateSize > pf->size - sizeof(PersistHeader)) {
+        return NULL;
+    }
+    if (header->checksum != Checksum(header, state)) {
+        fprintf(stderr, "Persistent state is corrupt, ignoring it!\n");
+        return NULL;
+    }
+    if (header->romHash != romHash) {
+        return NULL;
+    }
+
+    *size = header->stateSize;
+    return state;
+}
+
+uint8_t *PersistStateBuffer(PersistFile *pf, size_t *maxSize)
+{
+    assert(pf != NULL && pf->mapping != NULL);
+    assert(maxSize != NULL);
+
+    // Invalidate the stored state first, so a crash while the new one is being
+    // written leaves a state that fails the checksum rather than a torn one.
+    PersistHeader *header = (PersistHeader *)pf->mapping;
+    header->stateSize = 0;
+
+    *maxSize = pf->size - sizeof(PersistHeader);
+    return pf->mapping + sizeof(PersistHeader);
+}
+
+void PersistCommit(PersistFile *pf, uint32_t romHash, size_t size)
+{
+    assert(pf != NULL && pf->mapping != NULL);
+    assert(size > 0 && size <= pf->size - sizeof(PersistHeader));
+
+    PersistHeader *header = (PersistHeader *)pf->mapping;
+    header->magic = PERSIST_MAGIC;
+    header->version = PERSIST_VERSION;
+    header->romHash = romHash;
+    header->stateSize = (uint32_t)size;
+    header->reserved = 0;
+    header->checksum = Checksum(header, pf->mapping + sizeof(PersistHeader));
+}
+
+static uint32_t Checksum(const PersistHeader *header, const uint8_t *state)
+{
+    PersistHeader copy = *header;
+    copy.checksum = 0;
+
+    uint32_t hash = 2166136261u;
+    const uint8_t *bytes = (const uint8_t *)&copy;
+    for (size_t i = 0; i < sizeof(copy); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    for (uint32_t i = 0; i < header->stateSize; i++) {
+        hash = (hash ^ state[i]) * 16777619u;
+    }
+    return hash;
+}
+
+#if defined(_WIN32)
+
+int PersistFlush(PersistFile *pf, bool wait)
+{
+    assert(pf != NULL && pf->mapping != NULL);
+
+    if (!FlushViewOfFile(pf->mapping, pf->size)) {
+        return -1;
+    }
+    if (wait && !FlushFileBuffers((HANDLE)pf->file)) {
+        return -1;
+    }
+    return 0;
+}
+
+static int MapFile(PersistFile *pf, const char *filePath)
+{
+    HANDLE file = CreateFileA(filePath, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                              OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+
+    // Creating the mapping grows the file to its size, zero filled.
+    HANDLE fileMapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, 0,
+                                            (DWORD)pf->size, NULL);
+    if (!fileMapping) {
+        CloseHandle(file);
+        return -1;
+    }
+
+    pf->mapping = MapViewOfFile(fileMapping, FILE_MAP_ALL_ACCESS, 0, 0,
+                                pf->size);
+    if (!pf->mapping) {
+        CloseHandle(fileMapping);
+        CloseHandle(file);
+        return -1;
+    }
+
+    pf->file = file;
+    pf->fileMapping = fileMapping;
+    return 0;
+}
+
+static void UnmapFile(PersistFile *pf)
+{
+    UnmapViewOfFile(pf->mapping);
+    CloseHandle((HANDLE)pf->fileMapping);
+    CloseHandle((HANDLE)pf->file);
+}
+
+#else
+
+int PersistFlush(PersistFile *pf, bool wait)
+{
+    assert(pf != NULL && pf->mapping != NULL);
+
+    return msync(pf->mapping, pf->size, wait ? MS_SYNC : MS_ASYNC) == 0 ? 0 :
+                                                                         -1;
+}
+
+static int MapFile(PersistFile *pf, const char *filePath)
+{
+    int fd = open(filePath, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // A new or short file is grown to size, the new bytes read as zero and so
+    // as an empty header.
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        ((size_t)st.st_size < pf->size && ftruncate(fd, pf->size) != 0)) {
+        close(fd);
+        return -1;
+    }
+
+    void *mapping =
+        mmap(NULL, pf->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    pf->mapping = mapping;
+    pf->fd = fd;
+    return 0;
+}
+
+static void UnmapFile(PersistFile *pf)
+{
+    munmap(pf->mapping, pf->size);
+    close(pf->fd);
+}
+
+#endif
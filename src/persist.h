@@ -0,0 +1,48 @@
+#ifndef CHIP8_PERSIST_H
+#define CHIP8_PERSIST_H
+
+// Persist module.
+// Keeps a save state in a memory mapped file so that a relaunch can resume
+// where the last run left off. Writing a state is a copy into the mapping, the
+// OS writes it back to disk in the background and on flush. The file is a
+// local cache in host byte order, use save states to move state between
+// machines.
+
+#include "def.h"
+
+typedef struct tPersistFile {
+    uint8_t *mapping;
+    size_t size;
+#if defined(_WIN32)
+    void *file;
+    void *fileMapping;
+#else
+    int fd;
+#endif
+} PersistFile;
+
+// PersistOpen() - Opens or creates the file at filePath, sized for states of up
+// to maxStateSize bytes, and maps it. Returns 0 on success and -1 on failure.
+int PersistOpen(PersistFile *pf, const char *filePath, size_t maxStateSize);
+
+// PersistClose() - Flushes and unmaps the file.
+void PersistClose(PersistFile *pf);
+
+// PersistRead() - Returns the stored state and its size if the file holds an
+// intact state for the rom with the given hash, otherwise NULL.
+const uint8_t *PersistRead(const PersistFile *pf, uint32_t romHash,
+                           size_t *size);
+
+// PersistStateBuffer() - Returns where to serialise the next state, and its
+// capacity in maxSize. The stored state is invalid until PersistCommit().
+uint8_t *PersistStateBuffer(PersistFile *pf, size_t *maxSize);
+
+// PersistCommit() - Marks the size bytes written to the state buffer as a
+// valid state for the rom with the given hash.
+void PersistCommit(PersistFile *pf, uint32_t romHash, size_t size);
+
+// PersistFlush() - Starts writing the mapping back to disk, and waits for it
+// to finish if wait is set. Returns 0 on success and -1 on failure.
+int PersistFlush(PersistFile *pf, bool wait);
+
+#endif // CHIP8_PERSIST_H
@@ -0,0 +1,377 @@
+#include "pool.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE Cond;
+typedef HANDLE Thread;
+#else
+#include <pthread.h>
+#include <unistd.h>
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Cond;
+typedef pthread_t Thread;
+#endif
+
+typedef struct tPoolWorker {
+    Pool *pool;
+    int index;
+    Thread thread;
+    // The jobs [begin, end) left in this worker's share. The owner takes them
+    // from the front, thieves take the back half.
+    Mutex lock;
+    int begin;
+    int end;
+} PoolWorker;
+
+struct tPool {
+    PoolWorker *workers;
+    int threadCount;
+
+    Mutex lock;
+    Cond wake;
+    Cond done;
+    PoolJobFunc func;
+    void *user;
+    uint64_t generation;
+    // Set while a batch is being run, workers only join a batch while it is.
+    bool running;
+    // Jobs of the batch not finished yet and workers still inside it.
+    int remaining;
+    int active;
+    bool quit;
+};
+
+static void MutexInit(Mutex *mutex);
+static void MutexDestroy(Mutex *mutex);
+static void MutexLock(Mutex *mutex);
+static void MutexUnlock(Mutex *mutex);
+static void CondInit(Cond *cond);
+static void CondDestroy(Cond *cond);
+static void CondWait(Cond *cond, Mutex *mutex);
+static void CondBroadcast(Cond *cond);
+static int ThreadStart(Thread *thread, PoolWorker *worker);
+static void ThreadJoin(Thread thread);
+
+static bool TakeJob(PoolWorker *worker, int *job);
+static bool StealJobs(PoolWorker *worker);
+static void WorkerMain(PoolWorker *worker);
+
+Pool *PoolCreate(int threadCount)
+{
+    if (threadCount <= 0) {
+        threadCount = PoolCpuCount();
+    }
+
+    Pool *pool = calloc(1, sizeof(Pool));
+    if (!pool) {
+        fprintf(stderr, "Failed to allocate a thread pool!\n");
+        return NULL;
+    }
+    pool->workers = calloc(threadCount, sizeof(PoolWorker));
+    if (!pool->workers) {
+        fprintf(stderr, "Failed to allocate a thread pool!\n");
+        free(pool);
+        return NULL;
+    }
+
+    MutexInit(&pool->lock);
+    CondInit(&pool->wake);
+    CondInit(&pool->done);
+
+    for (int i = 0; i < threadCount; i++) {
+        PoolWorker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        MutexInit(&worker->lock);
+
+        if (ThreadStart(&worker->thread, worker) != 0) {
+            fprintf(stderr, "Failed to start pool thread %d!\n", i);
+            MutexDestroy(&worker->lock);
+            PoolDestroy(pool);
+            return NULL;
+        }
+        pool->threadCount++;
+    }
+
+    return pool;
+}
+
+void PoolDestroy(Pool *pool)
+{
+    if (!pool) {
+        return;
+    }
+
+    MutexLock(&pool->lock);
+    pool->quit = true;
+    CondBroadcast(&pool->wake);
+    MutexUnlock(&pool->lock);
+
+    for (int i = 0; i < pool->threadCount; i++) {
+        ThreadJoin(pool->workers[i].thread);
+        MutexDestroy(&pool->workers[i].lock);
+    }
+
+    CondDestroy(&pool->done);
+    CondDestroy(&pool->wake);
+    MutexDestroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+int PoolThreadCount(const Pool *pool)
+{
+    assert(pool != NULL);
+
+    return pool->threadCount;
+}
+
+void PoolRun(Pool *pool, int jobCount, PoolJobFunc func, void *user)
+{
+    assert(pool != NULL);
+    assert(func != NULL);
+
+    if (jobCount <= 0) {
+        return;
+    }
+
+    // Workers are all idle between batches, so the shares can be set without
+    // taking their locks.
+    int n = pool->threadCount;
+    for (int i = 0; i < n; i++) {
+        pool->workers[i].begin = (int)((int64_t)jobCount * i / n);
+        pool->workers[i].end = (int)((int64_t)jobCount * (i + 1) / n);
+    }
+
+    MutexLock(&pool->lock);
+    pool->func = func;
+    pool->user = user;
+    pool->remaining = jobCount;
+    pool->running = true;
+    pool->generation++;
+    CondBroadcast(&pool->wake);
+
+    while (pool->remaining > 0 || pool->active > 0) {
+        CondWait(&pool->done, &pool->lock);
+    }
+    pool->running = false;
+    MutexUnlock(&pool->lock);
+}
+
+static bool TakeJob(PoolWorker *worker, int *job)
+{
+    bool taken = false;
+
+    MutexLock(&worker->lock);
+    if (worker->begin < worker->end) {
+        *job = worker->begin++;
+        taken = true;
+    }
+    MutexUnlock(&worker->lock);
+
+    return taken;
+}
+
+static bool StealJobs(PoolWorker *worker)
+{
+    Pool *pool = worker->pool;
+
+    // Start with the next worker so thieves spread over their victims.
+    for (int i = 1; i < pool->threadCount; i++) {
+        PoolWorker *victim =
+            &pool->workers[(worker->index + i) % pool->threadCount];
+
+        MutexLock(&victim->lock);
+        int left = victim->end - victim->begin;
+        if (left <= 0) {
+            MutexUnlock(&victim->lock);
+            continue;
+        }
+        int end = victim->end;
+        int begin = end - (left + 1) / 2;
+        victim->end = begin;
+        MutexUnlock(&victim->lock);
+
+        MutexLock(&worker->lock);
+        worker->begin = begin;
+        worker->end = end;
+        MutexUnlock(&worker->lock);
+        return true;
+    }
+
+    return false;
+}
+
+static void WorkerMain(PoolWorker *worker)
+{
+    Pool *pool = worker->pool;
+    uint64_t generation = 0;
+
+    MutexLock(&pool->lock);
+    for (;;) {
+        while (!pool->quit &&
+               (!pool->running || pool->generation == generation)) {
+            CondWait(&pool->wake, &pool->lock);
+        }
+        if (pool->quit) {
+            break;
+        }
+
+        generation = pool->generation;
+        PoolJobFunc func = pool->func;
+        void *user = pool->user;
+        pool->active++;
+        MutexUnlock(&pool->lock);
+
+        int finished = 0;
+        int job;
+        do {
+            while (TakeJob(worker, &job)) {
+                func(user, job, worker->index);
+                finished++;
+            }
+        } while (StealJobs(worker));
+
+        MutexLock(&pool->lock);
+        pool->remaining -= finished;
+        pool->active--;
+        if (pool->remaining == 0 && pool->active == 0) {
+            CondBroadcast(&pool->done);
+        }
+    }
+    MutexUnlock(&pool->lock);
+}
+
+#if defined(_WIN32)
+
+int PoolCpuCount()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return MAX((int)info.dwNumberOfProcessors, 1);
+}
+
+static void MutexInit(Mutex *mutex)
+{
+    InitializeCriticalSection(mutex);
+}
+
+static void MutexDestroy(Mutex *mutex)
+{
+    DeleteCriticalSection(mutex);
+}
+
+static void MutexLock(Mutex *mutex)
+{
+    EnterCriticalSection(mutex);
+}
+
+static void MutexUnlock(Mutex *mutex)
+{
+    LeaveCriticalSection(mutex);
+}
+
+static void CondInit(Cond *cond)
+{
+    InitializeConditionVariable(cond);
+}
+
+static void CondDestroy(Cond *cond)
+{
+    (void)cond;
+}
+
+static void CondWait(Cond *cond, Mutex *mutex)
+{
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+static void CondBroadcast(Cond *cond)
+{
+    WakeAllConditionVariable(cond);
+}
+
+static DWORD WINAPI ThreadEntry(LPVOID param)
+{
+    WorkerMain(param);
+    return 0;
+}
+
+static int ThreadStart(Thread *thread, PoolWorker *worker)
+{
+    *thread = CreateThread(NULL, 0, ThreadEntry, worker, 0, NULL);
+    return *thread ? 0 : -1;
+}
+
+static void ThreadJoin(Thread thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+#else
+
+int PoolCpuCount()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+static void MutexInit(Mutex *mutex)
+{
+    pthread_mutex_init(mutex, NULL);
+}
+
+static void MutexDestroy(Mutex *mutex)
+{
+    pthread_mutex_destroy(mutex);
+}
+
+static void MutexLock(Mutex *mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+static void MutexUnlock(Mutex *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+static void CondInit(Cond *cond)
+{
+    pthread_cond_init(cond, NULL);
+}
+
+static void CondDestroy(Cond *cond)
+{
+    pthread_cond_destroy(cond);
+}
+
+static void CondWait(Cond *cond, Mutex *mutex)
+{
+    pthread_cond_wait(cond, mutex);
+}
+
+static void CondBroadcast(Cond *cond)
+{
+    pthread_cond_broadcast(cond);
+}
+
+static void *ThreadEntry(void *param)
+{
+    WorkerMain(param);
+    return NULL;
+}
+
+static int ThreadStart(Thread *thread, PoolWorker *worker)
+{
+    return pthread_create(thread, NULL, ThreadEntry, worker) == 0 ? 0 : -1;
+}
+
+static void ThreadJoin(Thread thread)
+{
+    pthread_join(thread, NULL);
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef CHIP8_POOL_H
+#define CHIP8_POOL_H
+
+// Pool module.
+// A fixed set of worker threads that run batches of independent jobs. Each
+// worker starts on its own share of a batch and steals half of another
+// worker's remaining share once it runs out, so uneven jobs still keep every
+// thread busy. Used by the batch tools and the scheduler, the emulator core
+// never starts threads.
+
+#include "def.h"
+
+// Called once per job with the job index and the index of the worker running
+// it, from 0 to the thread count - 1.
+typedef void (*PoolJobFunc)(void *user, int job, int worker);
+
+typedef struct tPool Pool;
+
+// PoolCpuCount() - Returns the number of cpus available to the process.
+int PoolCpuCount();
+
+// PoolCreate() - Starts threadCount workers, or one per cpu if threadCount is
+// 0 or less. Returns NULL on failure.
+Pool *PoolCreate(int threadCount);
+
+// PoolDestroy() - Stops and joins the workers.
+void PoolDestroy(Pool *pool);
+
+// PoolThreadCount() - Returns the number of workers.
+int PoolThreadCount(const Pool *pool);
+
+// PoolRun() - Runs func for every job from 0 to jobCount - 1 across the
+// workers, and returns once all of them have finished. Only one thread may
+// run batches on a pool at a time.
+void PoolRun(Pool *pool, int jobCount, PoolJobFunc func, void *user);
+
+#endif // CHIP8_POOL_H
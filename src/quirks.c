@@ -0,0 +1,656 @@
+// chip8-quirks, works out which quirks a ROM was written for.
+//
+// The ROM is run under every combination of quirks at once, one variant per
+// pool job, with the same input: a movie given with --movie, whatever quirks
+// it was recorded with, or else each of --keys pressed in turn. Each variant
+// is checked for the symptoms of running under the wrong quirks: faults,
+// including I reaching past memory as a wrong load-store-i makes it, executing
+// outside the ROM, a display gone to garbage and a display frozen while other
+// variants still draw. Variants are ranked by those symptoms, then by the
+// fewest quirks, and the variants whose sequences of display hashes match are
+// grouped, as they cannot be told apart.
+// The best profile is cached by ROM hash in --cache, so a ROM is only run
+// again with --refresh.
+
+#include "def.h"
+#include "adc_argp.h"
+#include "movie.h"
+#include "pool.h"
+#include "tool.h"
+#include "vm.h"
+
+#include <inttypes.h>
+
+#define QUIRKS_VARIANTS (CHIP8_QUIRK_ALL + 1)
+#define QUIRKS_CACHE_MAGIC "CHIP8-QUIRKS"
+#define QUIRKS_CACHE_VERSION 1
+#define QUIRKS_DEFAULT_FRAMES 1200
+// Without a movie a key is pressed for QUIRKS_PRESS_TICKS out of every
+// QUIRKS_PRESS_EVERY.
+#define QUIRKS_PRESS_EVERY 60
+#define QUIRKS_PRESS_TICKS 6
+// A display with more pixels lit than this is taken as garbage.
+#define QUIRKS_GARBAGE_PIXELS (CHIP8_W * CHIP8_H / 2)
+
+// What each symptom adds to the score of a variant, lower being better.
+typedef enum {
+    QUIRKS_PENALTY_FROZEN = 10,
+    QUIRKS_PENALTY_GARBAGE = 100,
+    QUIRKS_PENALTY_RUNAWAY = 500,
+    QUIRKS_PENALTY_FAULT = 1000
+} QuirksPenalty;
+
+typedef struct tQuirksVariant {
+    uint32_t quirks;
+    VMCoverage coverage;
+    // Hash of the display hash of every tick, how many ticks changed it and
+    // the last that did.
+    uint64_t sequence;
+    int changes;
+    uint64_t lastChange;
+    // Ticks run, fewer than --frames if it faulted.
+    uint64_t ticks;
+    int mostLit;
+    // Addresses executed outside the ROM.
+    int outside;
+    bool frozen;
+    int score;
+    int group;
+    bool failed;
+} QuirksVariant;
+
+typedef struct tQuirks {
+    const uint8_t *rom;
+    size_t romSize;
+    const Movie *movie;
+    uint64_t frames;
+    QuirksVariant variants[QUIRKS_VARIANTS];
+    // Variant indices, best first.
+    int ranking[QUIRKS_VARIANTS];
+    int groupCount;
+    uint32_t exercised;
+} Quirks;
+
+static int ScriptInput(Movie *movie, const char *keys, uint64_t frames);
+static void RunVariant(void *user, int job, int worker);
+static uint32_t ExercisedQuirks(const Quirks *quirks);
+static void RankVariants(Quirks *quirks);
+static int CompareVariants(const Quirks *quirks, int a, int b);
+static bool LoadCache(const char *filePath, uint32_t romHash, uint32_t *quirks);
+static int SaveCache(const char *filePath, uint32_t romHash, uint32_t quirks);
+static void WriteQuirks(FILE *out, uint32_t quirks);
+static void WriteResult(FILE *out, const Quirks *quirks, const char *romPath,
+                        uint32_t romHash, double wallMs);
+
+int main(int argc, char *argv[])
+{
+    const char *romPath = NULL;
+    const char *outPath = NULL;
+    const char *moviePath = NULL;
+    const char *keys = NULL;
+    const char *cachePath = "chip8-quirks.cache";
+    int refresh = 0;
+    int threadCount = 0;
+    int cyclesPerTick = 20;
+    unsigned int seed = 1;
+    int frames = 0;
+
+    adc_argp_option opts[] = {
+        ADC_ARGP_HELP(),
+        ADC_ARGP_OPTION("rom", "r", ADC_ARGP_TYPE_STRING, &romPath,
+                        "ROM to detect the quirks of. Required"),
+        ADC_ARGP_OPTION(
+            "out", "o", ADC_ARGP_TYPE_STRING, &outPath,
+            "Write the JSON result to this file. Defaults to stdout"),
+        ADC_ARGP_OPTION(
+            "movie", "m", ADC_ARGP_TYPE_STRING, &moviePath,
+            "Movie to play to every variant. Defaults to pressing --keys"),
+        ADC_ARGP_OPTION(
+            "keys", "k", ADC_ARGP_TYPE_STRING, &keys,
+            "Keys to press in turn without a movie, as hex digits. Defaults "
+            "to all 16"),
+        ADC_ARGP_OPTION(
+            "frames", "f", ADC_ARGP_TYPE_UINT, &frames,
+            "Ticks to run each variant for. Defaults to 1200, or the "
+            "movie's length"),
+        ADC_ARGP_OPTION(
+            "cache", "C", ADC_ARGP_TYPE_STRING, &cachePath,
+            "File caching the best quirks by rom hash. Defaults to "
+            "chip8-quirks.cache"),
+        ADC_ARGP_OPTION(
+            "refresh", "R", ADC_ARGP_TYPE_FLAG, &refresh,
+            "Run the variants even if the rom is in the cache"),
+        ADC_ARGP_OPTION(
+            "threads", "j", ADC_ARGP_TYPE_UINT, &threadCount,
+            "Worker threads. Defaults to 0, one per cpu"),
+        ADC_ARGP_OPTION(
+            "cycles", "c", ADC_ARGP_TYPE_UINT, &cyclesPerTick,
+            "Cycles per tick without a movie. Defaults to 20"),
+        ADC_ARGP_OPTION(
+            "seed", "s", ADC_ARGP_TYPE_UINT, &seed,
+            "Rng seed without a movie. Defaults to 1")
+    };
+
+    adc_argp_parser *parser = adc_argp_new_parser(opts, ADC_ARGP_COUNT(opts));
+    if (!parser) {
+        fprintf(stderr, "Failed to create arg parser\n");
+        return EXIT_FAILURE;
+    }
+    int errors = adc_argp_parse(parser, argc, (const char **)argv);
+    if (errors > 0) {
+        adc_argp_print_errors(parser, stderr);
+    }
+    adc_argp_destroy_parser(&parser);
+    if (errors > 0) {
+        return EXIT_FAILURE;
+    }
+    if (!romPath) {
+        fprintf(stderr, "No rom given, use --rom!\n");
+        return EXIT_FAILURE;
+    }
+    if (cyclesPerTick <= 0) {
+        fprintf(stderr, "Cycles must be positive!\n");
+        return EXIT_FAILURE;
+    }
+    if (seed == 0) {
+        fprintf(stderr, "The seed must not be 0, every variant needs the "
+                        "same random numbers!\n");
+        return EXIT_FAILURE;
+    }
+
+    int result = EXIT_FAILURE;
+    FILE *out = NULL;
+    Pool *pool = NULL;
+    Quirks *quirks = NULL;
+    Movie movie = {0};
+    uint8_t rom[CHIP8_USERMEM_TOTAL + 1];
+    size_t romSize = sizeof(rom);
+    if (ToolReadRom(romPath, rom, &romSize) != 0) {
+        goto error;
+    }
+
+    VM *vm = VMCreate(cyclesPerTick, VMCOLOR_PALETTE_ORIGINAL, seed);
+    if (!vm) {
+        goto error;
+    }
+    int loaded = VMLoadRomData(vm, rom, romSize);
+    uint32_t romHash = VMGetRomHash(vm);
+    VMDestroy(vm);
+    if (loaded != 0) {
+        goto error;
+    }
+
+    out = outPath ? fopen(outPath, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Failed to open %s for writing!\n", outPath);
+        goto error;
+    }
+
+    // A cached rom is answered without running it.
+    uint32_t cached;
+    if (!refresh && LoadCache(cachePath, romHash, &cached)) {
+        fputs("{\"rom\":", out);
+        ToolWriteJsonString(out, romPath);
+        fprintf(out, ",\"rom_hash\":\"%08" PRIx32 "\",\"cached\":true,"
+                     "\"best\":", romHash);
+        WriteQuirks(out, cached);
+        fputs("}\n", out);
+    } else {
+        if (moviePath) {
+            if (MovieLoad(&movie, moviePath) != 0) {
+                goto error;
+            }
+            if (movie.romHash != romHash) {
+                fprintf(stderr, "Movie %s was recorded with a different "
+                                "rom!\n", moviePath);
+                goto error;
+            }
+        } else {
+            MovieInit(&movie, romHash, seed, cyclesPerTick, 0);
+            movie.frames = QUIRKS_DEFAULT_FRAMES;
+            if (ScriptInput(&movie, keys ? keys : "0123456789ABCDEF",
+                            frames ? (uint64_t)frames : movie.frames) != 0) {
+                goto error;
+            }
+        }
+
+        pool = PoolCreate(threadCount);
+        quirks = calloc(1, sizeof(Quirks));
+        if (!pool || !quirks) {
+            fprintf(stderr, "Failed to allocate the variants!\n");
+            goto error;
+        }
+        quirks->rom = rom;
+        quirks->romSize = romSize;
+        quirks->movie = &movie;
+        quirks->frames = frames ? (uint64_t)frames : movie.frames;
+        if (quirks->frames == 0) {
+            quirks->frames = QUIRKS_DEFAULT_FRAMES;
+        }
+
+        double start = ToolNowSeconds();
+        PoolRun(pool, QUIRKS_VARIANTS, RunVariant, quirks);
+        for (int i = 0; i < QUIRKS_VARIANTS; i++) {
+            if (quirks->variants[i].failed) {
+                goto error;
+            }
+        }
+        RankVariants(quirks);
+        double elapsed = ToolNowSeconds() - start;
+
+        WriteResult(out, quirks, romPath, romHash, elapsed * 1000.0);
+        uint32_t best = quirks->variants[quirks->ranking[0]].quirks;
+        if (SaveCache(cachePath, romHash, best) != 0) {
+            goto error;
+        }
+
+        char bestText[128];
+        VMFormatQuirks(best, bestText, sizeof(bestText));
+        fprintf(stderr,
+                "Detection finished! %d variants of %" PRIu64 " ticks on %d "
+                "threads in %.03fs, %d display groups, best %s\n",
+                QUIRKS_VARIANTS, quirks->frames, PoolThreadCount(pool),
+                elapsed, quirks->groupCount, bestText);
+    }
+    if (out != stdout && fclose(out) != 0) {
+        out = NULL;
+        fprintf(stderr, "Failed to write %s!\n", outPath);
+        goto error;
+    }
+    out = NULL;
+    result = EXIT_SUCCESS;
+
+error:
+    if (out && out != stdout) {
+        fclose(out);
+    }
+    PoolDestroy(pool);
+    MovieFree(&movie);
+    free(quirks);
+    return result;
+}
+
+// Presses each key in turn, one every QUIRKS_PRESS_EVERY ticks from the first
+// of them on. Returns 0 on success and -1 on failure.
+static int ScriptInput(Movie *movie, const char *keys, uint64_t frames)
+{
+    uint8_t order[16];
+    int keyCount;
+    if (ToolParseKeys(keys, order, &keyCount) != 0) {
+        return -1;
+    }
+    if (keyCount == 0) {
+        fprintf(stderr, "No keys given to press!\n");
+        return -1;
+    }
+
+    int press = 0;
+    for (uint64_t tick = QUIRKS_PRESS_EVERY;
+         tick + QUIRKS_PRESS_TICKS < frames; tick += QUIRKS_PRESS_EVERY) {
+        uint8_t key = order[press++ % keyCount];
+        if (MovieAppend(movie, (MovieEvent){ .tick = tick, .key = key,
+                                             .pressed = true }) != 0 ||
+            MovieAppend(movie, (MovieEvent){ .tick = tick + QUIRKS_PRESS_TICKS,
+                                             .key = key,
+                                             .pressed = false }) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Runs the rom under the quirks of one variant until it faults or the frames
+// run out, recording its display hashes and symptoms.
+static void RunVariant(void *user, int job, int worker)
+{
+    (void)worker;
+    Quirks *quirks = user;
+    QuirksVariant *variant = &quirks->variants[job];
+    const Movie *movie = quirks->movie;
+
+    variant->quirks = (uint32_t)job;
+    VM *vm = VMCreate(movie->cyclesPerTick, VMCOLOR_PALETTE_ORIGINAL,
+                      movie->seed);
+    if (!vm) {
+        variant->failed = true;
+        return;
+    }
+    VMSetQuirks(vm, variant->quirks);
+    VMSetCoverage(vm, &variant->coverage);
+    if (VMLoadRomData(vm, quirks->rom, quirks->romSize) != 0) {
+        VMDestroy(vm);
+        variant->failed = true;
+        return;
+    }
+
+    uint64_t display = VMHashDisplay(vm);
+    int nextEvent = 0;
+    uint64_t tick = 0;
+    while (tick < quirks->frames && !variant->coverage.faults) {
+        while (nextEvent < movie->eventCount &&
+               movie->events[nextEvent].tick <= tick) {
+            const MovieEvent *event = &movie->events[nextEvent++];
+            VMScheduleKeyAt(vm, event->key, event->pressed, event->tick,
+                            event->cycle);
+        }
+
+        VMTick(vm);
+        tick++;
+
+        uint64_t hash = VMHashDisplay(vm);
+        if (hash != display) {
+            display = hash;
+            variant->changes++;
+            variant->lastChange = tick;
+        }
+        variant->sequence = (variant->sequence ^ hash) * 0x100000001B3ull;
+
+        const uint8_t *pixels = VMGetDisplayPixels(vm);
+        int lit = 0;
+        for (int i = 0; i < CHIP8_W * CHIP8_H / 8; i++) {
+            for (uint8_t b = pixels[i]; b; b &= b - 1) {
+                lit++;
+            }
+        }
+        variant->mostLit = MAX(variant->mostLit, lit);
+    }
+    variant->ticks = tick;
+    VMDestroy(vm);
+
+    for (int address = 0; address < 0x1000; address++) {
+        bool executed = variant->coverage.addresses[address / 8] &
+                        (1 << (address % 8));
+        if (executed && (address < CHIP8_USERMEM_START ||
+                         (size_t)address >=
+                             CHIP8_USERMEM_START + quirks->romSize)) {
+            variant->outside++;
+        }
+    }
+}
+
+// Returns the quirks that change what an instruction the ROM executed under
+// any variant does.
+static uint32_t ExercisedQuirks(const Quirks *quirks)
+{
+    uint32_t exercised = 0;
+    for (size_t i = 0; i + 1 < quirks->romSize; i++) {
+        size_t address = CHIP8_USERMEM_START + i;
+        bool executed = false;
+        for (int v = 0; v < QUIRKS_VARIANTS && !executed; v++) {
+            executed = quirks->variants[v].coverage.addresses[address / 8] &
+                       (1 << (address % 8));
+        }
+        if (!executed) {
+            continue;
+        }
+
+        uint16_t op = (quirks->rom[i] << 8) | quirks->rom[i + 1];
+        uint8_t n = op & 0xF;
+        uint8_t kk = op & 0xFF;
+        switch (op >> 12) {
+        case 0x8:
+            if (n >= 0x1 && n <= 0x3) {
+                exercised |= CHIP8_QUIRK_VF_RESET;
+            } else if (n == 0x6 || n == 0xE) {
+                exercised |= CHIP8_QUIRK_SHIFT_VY;
+            }
+            break;
+        case 0xB:
+            exercised |= CHIP8_QUIRK_JUMP_VX;
+            break;
+        case 0xD:
+            exercised |= CHIP8_QUIRK_SPRITE_WRAP;
+            break;
+        case 0xF:
+            if (kk == 0x55 || kk == 0x65) {
+                exercised |= CHIP8_QUIRK_LOAD_STORE_I;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return exercised;
+}
+
+// Scores every variant by its symptoms, groups those with the same display
+// hashes and sorts them best first.
+static void RankVariants(Quirks *quirks)
+{
+    // A display counts as frozen if it stopped changing in the first half of
+    // the run while another variant's kept changing.
+    uint64_t latest = 0;
+    for (int v = 0; v < QUIRKS_VARIANTS; v++) {
+        latest = MAX(latest, quirks->variants[v].lastChange);
+    }
+    for (int v = 0; v < QUIRKS_VARIANTS; v++) {
+        QuirksVariant *variant = &quirks->variants[v];
+        variant->frozen = variant->lastChange < quirks->frames / 2 &&
+                          latest >= quirks->frames / 2;
+
+        variant->score = 0;
+        if (variant->coverage.faults) {
+            variant->score += QUIRKS_PENALTY_FAULT;
+        }
+        if (variant->outside > 0) {
+            variant->score += QUIRKS_PENALTY_RUNAWAY;
+        }
+        if (variant->mostLit > QUIRKS_GARBAGE_PIXELS) {
+            variant->score += QUIRKS_PENALTY_GARBAGE;
+        }
+        if (variant->frozen) {
+            variant->score += QUIRKS_PENALTY_FROZEN;
+        }
+
+        variant->group = -1;
+        for (int w = 0; w < v && variant->group < 0; w++) {
+            if (quirks->variants[w].sequence == variant->sequence &&
+                quirks->variants[w].ticks == variant->ticks) {
+                variant->group = quirks->variants[w].group;
+            }
+        }
+        if (variant->group < 0) {
+            variant->group = quirks->groupCount++;
+        }
+        quirks->ranking[v] = v;
+    }
+    quirks->exercised = ExercisedQuirks(quirks);
+
+    // Insertion sort, there being few variants and the order needing the
+    // exercised quirks.
+    for (int i = 1; i < QUIRKS_VARIANTS; i++) {
+        int index = quirks->ranking[i];
+        int j = i;
+        while (j > 0 &&
+               CompareVariants(quirks, quirks->ranking[j - 1], index) > 0) {
+            quirks->ranking[j] = quirks->ranking[j - 1];
+            j--;
+        }
+        quirks->ranking[j] = index;
+    }
+}
+
+// Orders variants by score, then by the fewest quirks the ROM exercises, then
+// by the fewest quirks.
+static int CompareVariants(const Quirks *quirks, int a, int b)
+{
+    const QuirksVariant *x = &quirks->variants[a];
+    const QuirksVariant *y = &quirks->variants[b];
+
+    if (x->score != y->score) {
+        return x->score < y->score ? -1 : 1;
+    }
+    int xBits = 0;
+    int yBits = 0;
+    int xExercised = 0;
+    int yExercised = 0;
+    for (int bit = 0; bit < 32; bit++) {
+        xBits += (x->quirks >> bit) & 1;
+        yBits += (y->quirks >> bit) & 1;
+        xExercised += (x->quirks & quirks->exercised) >> bit & 1;
+        yExercised += (y->quirks & quirks->exercised) >> bit & 1;
+    }
+    if (xExercised != yExercised) {
+        return xExercised < yExercised ? -1 : 1;
+    }
+    if (xBits != yBits) {
+        return xBits < yBits ? -1 : 1;
+    }
+    return x->quirks < y->quirks ? -1 : (x->quirks > y->quirks);
+}
+
+// Looks the rom up in the cache. Returns true and sets quirks if it is there.
+// A cache that is not valid is treated as empty, SaveCache() then replaces it.
+static bool LoadCache(const char *filePath, uint32_t romHash, uint32_t *quirks)
+{
+    FILE *file = fopen(filePath, "r");
+    if (!file) {
+        return false;
+    }
+
+    int version;
+    if (fscanf(file, QUIRKS_CACHE_MAGIC " %d", &version) != 1 ||
+        version != QUIRKS_CACHE_VERSION) {
+        fprintf(stderr, "Ignoring invalid quirks cache %s\n", filePath);
+        fclose(file);
+        return false;
+    }
+
+    bool found = false;
+    uint32_t hash;
+    char names[128];
+    while (!found && fscanf(file, " %" SCNx32 " %127s", &hash, names) == 2) {
+        if (hash == romHash && VMParseQuirks(names, quirks) == 0) {
+            found = true;
+        }
+    }
+    fclose(file);
+
+    return found;
+}
+
+// Writes the quirks of the rom to the cache, keeping those of other roms.
+// Returns 0 on success and -1 on failure.
+static int SaveCache(const char *filePath, uint32_t romHash, uint32_t quirks)
+{
+    char *kept = NULL;
+    size_t keptSize = 0;
+    FILE *file = fopen(filePath, "r");
+    if (file) {
+        int version;
+        char line[256];
+        if (fscanf(file, QUIRKS_CACHE_MAGIC " %d ", &version) == 1 &&
+            version == QUIRKS_CACHE_VERSION) {
+            while (fgets(line, sizeof(line), file)) {
+                uint32_t hash;
+                if (sscanf(line, "%" SCNx32, &hash) != 1 || hash == romHash) {
+                    continue;
+                }
+                char *grown = realloc(kept, keptSize + strlen(line) + 1);
+                if (!grown) {
+                    fprintf(stderr, "Failed to read the quirks cache!\n");
+                    free(kept);
+                    fclose(file);
+                    return -1;
+                }
+                kept = grown;
+                strcpy(kept + keptSize, line);
+                keptSize += strlen(line);
+            }
+        }
+        fclose(file);
+    }
+
+    char names[128];
+    VMFormatQuirks(quirks, names, sizeof(names));
+    file = fopen(filePath, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open quirks cache %s for writing!\n",
+                filePath);
+        free(kept);
+        return -1;
+    }
+    fprintf(file, "%s %d\n", QUIRKS_CACHE_MAGIC, QUIRKS_CACHE_VERSION);
+    if (kept) {
+        fputs(kept, file);
+    }
+    fprintf(file, "%08" PRIx32 " %s\n", romHash, names);
+    free(kept);
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Failed to write quirks cache %s!\n", filePath);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void WriteQuirks(FILE *out, uint32_t quirks)
+{
+    char text[128];
+    VMFormatQuirks(quirks, text, sizeof(text));
+    ToolWriteJsonString(out, text);
+}
+
+static void WriteResult(FILE *out, const Quirks *quirks, const char *romPath,
+                        uint32_t romHash, double wallMs)
+{
+    static const char *faultNames[] = { "opcode", "pc", "stack-overflow",
+                                        "stack-underflow", "memory" };
+
+    const QuirksVariant *best = &quirks->variants[quirks->ranking[0]];
+
+    fputs("{\"rom\":", out);
+    ToolWriteJsonString(out, romPath);
+    fprintf(out, ",\"rom_hash\":\"%08" PRIx32 "\",\"cached\":false,\"best\":",
+            romHash);
+    WriteQuirks(out, best->quirks);
+
+    // The best is certain only if no variant that draws differently does as
+    // well.
+    bool certain = true;
+    for (int i = 1; i < QUIRKS_VARIANTS; i++) {
+        const QuirksVariant *variant = &quirks->variants[quirks->ranking[i]];
+        if (variant->score == best->score && variant->group != best->group) {
+            certain = false;
+        }
+    }
+    fprintf(out, ",\"certain\":%s,\"exercised\":",
+            certain ? "true" : "false");
+    WriteQuirks(out, quirks->exercised);
+    fprintf(out, ",\"frames\":%" PRIu64 ",\"groups\":%d,\"variants\":[",
+            quirks->frames, quirks->groupCount);
+
+    for (int i = 0; i < QUIRKS_VARIANTS; i++) {
+        const QuirksVariant *variant = &quirks->variants[quirks->ranking[i]];
+        fputs(i ? ",{\"quirks\":" : "{\"quirks\":", out);
+        WriteQuirks(out, variant->quirks);
+        fprintf(out,
+                ",\"score\":%d,\"group\":%d,\"ticks\":%" PRIu64
+                ",\"display_changes\":%d,\"symptoms\":[",
+                variant->score, variant->group, variant->ticks,
+                variant->changes);
+
+        bool first = true;
+        for (int f = 0; f < (int)ARRAY_LEN(faultNames); f++) {
+            if (variant->coverage.faults & (1u << f)) {
+                fprintf(out, "%s\"%s@%03X\"", first ? "" : ",", faultNames[f],
+                        variant->coverage.faultAddress);
+                first = false;
+            }
+        }
+        if (variant->outside > 0) {
+            fprintf(out, "%s\"runaway\"", first ? "" : ",");
+            first = false;
+        }
+        if (variant->mostLit > QUIRKS_GARBAGE_PIXELS) {
+            fprintf(out, "%s\"garbage\"", first ? "" : ",");
+            first = false;
+        }
+        if (variant->frozen) {
+            fprintf(out, "%s\"frozen\"", first ? "" : ",");
+        }
+        fputs("]}", out);
+    }
+    fprintf(out, "],\"wall_ms\":%.3f}\n", wallMs);
+}
@@ -0,0 +1,291 @@
+#include "rewind.h"
+
+// One second of history between keyframes at the VM tick rate.
+#define REWIND_KEYFRAME_INTERVAL 60
+// About the smallest entry between consecutive ticks, which decides how the
+// capacity is split between the data and the entry index.
+#define REWIND_MIN_ENTRY_SIZE 8
+
+static size_t Encode(const uint8_t *a, size_t aSize, const uint8_t *b,
+                     size_t bSize, uint64_t changedSpans, uint8_t *dst);
+static bool Decode(const uint8_t *src, size_t length, uint8_t *dst,
+                   size_t maxSize, size_t *decodedSize);
+static void StoreEntry(RewindBuffer *rb, const uint8_t *encoded, size_t length,
+                       uint16_t stateSize, bool keyframe);
+
+int RewindInit(RewindBuffer *rb, size_t capacity, size_t maxStateSize)
+{
+    assert(rb != NULL);
+    assert(maxStateSize <= UINT16_MAX);
+
+    // The index counts against the capacity, with room for as many entries as
+    // the data holds when they are all the smallest size.
+    memset(rb, 0, sizeof(*rb));
+    rb->entryCapacity =
+        (int)(capacity / (REWIND_MIN_ENTRY_SIZE + sizeof(RewindEntry)));
+    rb->capacity = capacity - rb->entryCapacity * sizeof(RewindEntry);
+    rb->maxStateSize = maxStateSize;
+    rb->keyframeInterval = REWIND_KEYFRAME_INTERVAL;
+
+    rb->data = malloc(rb->capacity);
+    rb->entries = malloc(rb->entryCapacity * sizeof(RewindEntry));
+    rb->current = calloc(maxStateSize, 1);
+    // An encoded entry is never more than 1.5x its input plus a token.
+    rb->scratch = malloc(maxStateSize * 2 + 16);
+    if (!rb->data || !rb->entries || !rb->current || !rb->scratch) {
+        fprintf(stderr, "Failed to allocate the rewind buffer!\n");
+        RewindDestroy(rb);
+        return -1;
+    }
+
+    return 0;
+}
+
+void RewindDestroy(RewindBuffer *rb)
+{
+    assert(rb != NULL);
+
+    free(rb->data);
+    free(rb->entries);
+    free(rb->current);
+    free(rb->scratch);
+    memset(rb, 0, sizeof(*rb));
+}
+
+void RewindReset(RewindBuffer *rb)
+{
+    assert(rb != NULL);
+
+    rb->entryHead = 0;
+    rb->entryCount = 0;
+    rb->currentSize = 0;
+    rb->sinceKeyframe = 0;
+}
+
+void RewindCapture(RewindBuffer *rb, const uint8_t *state, size_t size,
+                   uint64_t changedSpans)
+{
+    assert(rb != NULL && rb->data != NULL);
+    assert(state != NULL);
+    assert(size <= rb->maxStateSize);
+
+    // The entry lets the previous state be rebuilt from this one. A keyframe
+    // holds the previous state itself, otherwise it is the XOR of the two,
+    // which is almost all zeros between consecutive ticks.
+    if (rb->currentSize > 0) {
+        size_t length;
+        bool keyframe = rb->sinceKeyframe >= rb->keyframeInterval;
+        if (keyframe) {
+            length = Encode(rb->current, rb->currentSize, NULL, 0,
+                            ~(uint64_t)0, rb->scratch);
+            rb->sinceKeyframe = 0;
+        } else {
+            length = Encode(rb->current, rb->currentSize, state, size,
+                            changedSpans, rb->scratch);
+            rb->sinceKeyframe++;
+        }
+        StoreEntry(rb, rb->scratch, length, (uint16_t)rb->currentSize,
+                   keyframe);
+    }
+
+    memcpy(rb->current, state, size);
+    if (size < rb->currentSize) {
+        memset(rb->current + size, 0, rb->currentSize - size);
+    }
+    rb->currentSize = size;
+}
+
+bool RewindStep(RewindBuffer *rb, uint8_t *state, size_t *size)
+{
+    assert(rb != NULL && rb->data != NULL);
+    assert(state != NULL && size != NULL);
+
+    if (rb->entryCount == 0) {
+        return false;
+    }
+
+    int newest = (rb->entryHead + rb->entryCount - 1) % rb->entryCapacity;
+    const RewindEntry *entry = &rb->entries[newest];
+    size_t decodedSize;
+    if (!Decode(rb->data + entry->offset, entry->length, rb->scratch,
+                rb->maxStateSize, &decodedSize)) {
+        fprintf(stderr, "Rewind entry is corrupt, dropping the history!\n");
+        RewindReset(rb);
+        return false;
+    }
+
+    if (entry->keyframe) {
+        memcpy(rb->current, rb->scratch, decodedSize);
+        memset(rb->current + decodedSize, 0,
+               rb->maxStateSize - decodedSize);
+    } else {
+        for (size_t i = 0; i < decodedSize; i++) {
+            rb->current[i] ^= rb->scratch[i];
+        }
+    }
+    rb->currentSize = entry->stateSize;
+    rb->entryCount--;
+
+    memcpy(state, rb->current, rb->currentSize);
+    *size = rb->currentSize;
+    return true;
+}
+
+double RewindSeconds(const RewindBuffer *rb, int hz)
+{
+    assert(rb != NULL);
+
+    return (double)rb->entryCount / hz;
+}
+
+static size_t PutVarint(uint8_t *dst, size_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80) {
+        dst[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    dst[n++] = (uint8_t)value;
+    return n;
+}
+
+static bool GetVarint(const uint8_t *src, size_t length, size_t *pos,
+                      size_t *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 32; shift += 7) {
+        if (*pos >= length) {
+            return false;
+        }
+        uint8_t byte = src[(*pos)++];
+        *value |= (size_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline uint8_t XorAt(const uint8_t *a, size_t aSize, const uint8_t *b,
+                            size_t bSize, size_t i)
+{
+    return (i < aSize ? a[i] : 0) ^ (i < bSize ? b[i] : 0);
+}
+
+// Encodes a XOR b as a series of tokens, each a run of zero bytes followed by a
+// run of literal bytes with both lengths as varints. The shorter input reads
+// as zero padded, and a NULL b with a bSize of 0 encodes a alone. Spans clear
+// in changedSpans are taken as zero without reading them.
+static size_t Encode(const uint8_t *a, size_t aSize, const uint8_t *b,
+                     size_t bSize, uint64_t changedSpans, uint8_t *dst)
+{
+    size_t size = MAX(aSize, bSize);
+    size_t out = 0;
+    size_t i = 0;
+
+    while (i < size) {
+        size_t zeroStart = i;
+        while (i < size) {
+            size_t span = i / REWIND_SPAN_SIZE;
+            if (i % REWIND_SPAN_SIZE == 0 && span < 64 &&
+                !(changedSpans & ((uint64_t)1 << span))) {
+                i += REWIND_SPAN_SIZE;
+            } else if (XorAt(a, aSize, b, bSize, i) == 0) {
+                i++;
+            } else {
+                break;
+            }
+        }
+        i = MIN(i, size);
+        size_t literalStart = i;
+        // A single zero byte inside a literal is cheaper kept as a literal.
+        while (i < size) {
+            if (XorAt(a, aSize, b, bSize, i) == 0 &&
+                (i + 1 >= size || XorAt(a, aSize, b, bSize, i + 1) == 0)) {
+                break;
+            }
+            i++;
+        }
+
+        out += PutVarint(dst + out, literalStart - zeroStart);
+        out += PutVarint(dst + out, i - literalStart);
+        for (size_t j = literalStart; j < i; j++) {
+            dst[out++] = XorAt(a, aSize, b, bSize, j);
+        }
+    }
+
+    return out;
+}
+
+static bool Decode(const uint8_t *src, size_t length, uint8_t *dst,
+                   size_t maxSize, size_t *decodedSize)
+{
+    size_t pos = 0;
+    size_t out = 0;
+
+    while (pos < length) {
+        size_t zeros, literals;
+        if (!GetVarint(src, length, &pos, &zeros) ||
+            !GetVarint(src, length, &pos, &literals) ||
+            zeros + literals > maxSize - out || literals > length - pos) {
+            return false;
+        }
+
+        memset(dst + out, 0, zeros);
+        out += zeros;
+        memcpy(dst + out, src + pos, literals);
+        out += literals;
+        pos += literals;
+    }
+
+    *decodedSize = out;
+    return true;
+}
+
+static bool Overlaps(const RewindEntry *entry, size_t offset, size_t length)
+{
+    return entry->offset < offset + length &&
+           offset < entry->offset + entry->length;
+}
+
+static void StoreEntry(RewindBuffer *rb, const uint8_t *encoded, size_t length,
+                       uint16_t stateSize, bool keyframe)
+{
+    if (length > rb->capacity) {
+        RewindReset(rb);
+        return;
+    }
+
+    // Entries are laid out back to back, starting over at the beginning when
+    // one does not fit before the end.
+    size_t offset = 0;
+    if (rb->entryCount > 0) {
+        int newest = (rb->entryHead + rb->entryCount - 1) % rb->entryCapacity;
+        offset = rb->entries[newest].offset + rb->entries[newest].length;
+    }
+    // When wrapping, the entries past the end of the newest one are left over
+    // from the previous lap. They are the oldest, so they go first.
+    size_t lapEnd = rb->capacity;
+    if (offset + length > rb->capacity) {
+        lapEnd = offset;
+        offset = 0;
+    }
+
+    // Drop the oldest entries that the new one overwrites.
+    while (rb->entryCount > 0 &&
+           (rb->entryCount == rb->entryCapacity ||
+            rb->entries[rb->entryHead].offset >= lapEnd ||
+            Overlaps(&rb->entries[rb->entryHead], offset, length))) {
+        rb->entryHead = (rb->entryHead + 1) % rb->entryCapacity;
+        rb->entryCount--;
+    }
+
+    memcpy(rb->data + offset, encoded, length);
+
+    int index = (rb->entryHead + rb->entryCount) % rb->entryCapacity;
+    rb->entries[index] = (RewindEntry){ .offset = (uint32_t)offset,
+                                        .length = (uint32_t)length,
+                                        .stateSize = stateSize,
+                                        .keyframe = keyframe };
+    rb->entryCount++;
+}
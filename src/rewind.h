@@ -0,0 +1,72 @@
+#ifndef CHIP8_REWIND_H
+#define CHIP8_REWIND_H
+
+// Rewind module.
+// Keeps a history of VM save states in a fixed size ring. Each state is stored
+// as the run length encoded XOR against the state captured after it, so
+// stepping back from the newest state only needs the newest state. Every so
+// often a state is stored whole instead, as a keyframe.
+
+#include "def.h"
+
+// Granularity of the changed spans passed to RewindCapture().
+#define REWIND_SPAN_SIZE 64
+
+typedef struct tRewindEntry {
+    uint32_t offset;
+    uint32_t length;
+    // Size of the state this entry decodes to.
+    uint16_t stateSize;
+    bool keyframe;
+} RewindEntry;
+
+typedef struct tRewindBuffer {
+    // Encoded entries, written back to back and wrapping to the start.
+    uint8_t *data;
+    size_t capacity;
+
+    RewindEntry *entries;
+    int entryCapacity;
+    int entryHead;
+    int entryCount;
+
+    // The newest state, zero padded to maxStateSize.
+    uint8_t *current;
+    size_t currentSize;
+    size_t maxStateSize;
+    // Scratch space for encoding and decoding one entry.
+    uint8_t *scratch;
+
+    int keyframeInterval;
+    int sinceKeyframe;
+} RewindBuffer;
+
+// RewindInit() - Allocates a rewind buffer of capacity bytes, the encoded states
+// of at most maxStateSize bytes each and their index together. Returns 0 on
+// success and -1 on failure.
+int RewindInit(RewindBuffer *rb, size_t capacity, size_t maxStateSize);
+
+// RewindDestroy() - Frees the buffer.
+void RewindDestroy(RewindBuffer *rb);
+
+// RewindReset() - Drops the whole history, e.g. after the VM state was
+// replaced by a save state.
+void RewindReset(RewindBuffer *rb);
+
+// RewindCapture() - Records the state the VM is in now. The oldest entries are
+// dropped once the buffer is full. Bit n of changedSpans is clear if the
+// REWIND_SPAN_SIZE bytes at n * REWIND_SPAN_SIZE are known to be the same as
+// in the previous capture, which are then skipped rather than compared. Bytes
+// past the 64th span are always compared, pass ~0 to compare everything.
+void RewindCapture(RewindBuffer *rb, const uint8_t *state, size_t size,
+                   uint64_t changedSpans);
+
+// RewindStep() - Steps one capture back in time. Writes the previous state into
+// state and its size into size, and returns false when there is no history
+// left.
+bool RewindStep(RewindBuffer *rb, uint8_t *state, size_t *size);
+
+// RewindSeconds() - Returns how much history is held, given captures at hz.
+double RewindSeconds(const RewindBuffer *rb, int hz);
+
+#endif // CHIP8_REWIND_H
@@ -0,0 +1,361 @@
+#include "sched.h"
+
+#include "pool.h"
+
+// VMs run per pool job, so that running many quick VMs is not all locking.
+#define SCHED_CHUNK 64
+// The deadline of a VM parked until input.
+#define SCHED_NEVER UINT64_MAX
+
+typedef enum {
+    SCHED_FREE,
+    SCHED_RUNNING,
+    SCHED_PARKED
+} SchedState;
+
+typedef struct tSchedSlot {
+    VM *vm;
+    SchedState state;
+    // The tick of the clock the VM has run to, behind it while parked.
+    uint64_t tick;
+    // While parked, the tick its wait ends on.
+    uint64_t deadline;
+    // Its position in the run queue, or -1.
+    int queued;
+} SchedSlot;
+
+typedef struct tSchedTimer {
+    uint64_t deadline;
+    int index;
+} SchedTimer;
+
+struct tSched {
+    Pool *pool;
+    uint64_t now;
+    // The tick the SchedRun() under way runs to.
+    uint64_t target;
+
+    SchedSlot *slots;
+    int slotCount;
+    int slotCapacity;
+    int count;
+    // Indices of removed slots, to be handed out again.
+    int *freeSlots;
+    int freeCount;
+
+    // Indices of the running VMs.
+    int *queue;
+    int queueCount;
+
+    // The deadlines of parked VMs, a min-heap. A VM woken early leaves its
+    // timer behind, which is dropped once it comes up.
+    SchedTimer *timers;
+    int timerCount;
+    int timerCapacity;
+};
+
+static int SchedGrow(Sched *sched);
+static void SchedResume(Sched *sched, int index, uint64_t tick);
+static void SchedRunChunk(void *user, int job, int worker);
+static int SchedPushTimer(Sched *sched, SchedTimer timer);
+static SchedTimer SchedPopTimer(Sched *sched);
+
+Sched *SchedCreate(int threadCount)
+{
+    Sched *sched = calloc(1, sizeof(Sched));
+    if (!sched) {
+        fprintf(stderr, "Failed to allocate a scheduler!\n");
+        return NULL;
+    }
+
+    sched->pool = PoolCreate(threadCount);
+    if (!sched->pool) {
+        free(sched);
+        return NULL;
+    }
+
+    return sched;
+}
+
+void SchedDestroy(Sched *sched)
+{
+    if (!sched) {
+        return;
+    }
+
+    PoolDestroy(sched->pool);
+    free(sched->slots);
+    free(sched->freeSlots);
+    free(sched->queue);
+    free(sched->timers);
+    free(sched);
+}
+
+int SchedAdd(Sched *sched, VM *vm)
+{
+    assert(sched != NULL);
+    assert(vm != NULL);
+
+    int index;
+    if (sched->freeCount > 0) {
+        index = sched->freeSlots[--sched->freeCount];
+    } else {
+        if (sched->slotCount == sched->slotCapacity && SchedGrow(sched) != 0) {
+            return -1;
+        }
+        index = sched->slotCount++;
+    }
+
+    SchedSlot *slot = &sched->slots[index];
+    slot->vm = vm;
+    slot->state = SCHED_RUNNING;
+    slot->tick = sched->now;
+    slot->queued = sched->queueCount;
+    sched->queue[sched->queueCount++] = index;
+    sched->count++;
+
+    return index;
+}
+
+void SchedRemove(Sched *sched, int index)
+{
+    assert(sched != NULL);
+    assert(index >= 0 && index < sched->slotCount);
+    assert(sched->slots[index].state != SCHED_FREE);
+
+    SchedSlot *slot = &sched->slots[index];
+    SchedResume(sched, index, sched->now);
+
+    // Move the last VM of the run queue into its place.
+    int last = sched->queue[--sched->queueCount];
+    sched->queue[slot->queued] = last;
+    sched->slots[last].queued = slot->queued;
+
+    slot->vm = NULL;
+    slot->state = SCHED_FREE;
+    slot->queued = -1;
+    sched->freeSlots[sched->freeCount++] = index;
+    sched->count--;
+}
+
+VM *SchedWake(Sched *sched, int index)
+{
+    assert(sched != NULL);
+    assert(index >= 0 && index < sched->slotCount);
+    assert(sched->slots[index].state != SCHED_FREE);
+
+    SchedResume(sched, index, sched->now);
+
+    return sched->slots[index].vm;
+}
+
+void SchedSetKey(Sched *sched, int index, uint8_t key, bool pressed)
+{
+    VM *vm = SchedWake(sched, index);
+
+    if (pressed) {
+        VMSetKey(vm, key & 0xF);
+    } else {
+        VMClearKey(vm, key & 0xF);
+    }
+}
+
+void SchedRun(Sched *sched, int ticks)
+{
+    assert(sched != NULL);
+    assert(ticks >= 0);
+
+    sched->target = sched->now + ticks;
+
+    // Put back the VMs whose waits end before the target, from the tick they
+    // end on.
+    while (sched->timerCount > 0 &&
+           sched->timers[0].deadline < sched->target) {
+        SchedTimer timer = SchedPopTimer(sched);
+        const SchedSlot *slot = &sched->slots[timer.index];
+        if (slot->state == SCHED_PARKED && slot->deadline == timer.deadline) {
+            SchedResume(sched, timer.index, timer.deadline);
+        }
+    }
+
+    int jobCount = (sched->queueCount + SCHED_CHUNK - 1) / SCHED_CHUNK;
+    if (jobCount == 1) {
+        SchedRunChunk(sched, 0, 0);
+    } else {
+        PoolRun(sched->pool, jobCount, SchedRunChunk, sched);
+    }
+
+    // Take the VMs that parked off the run queue. One whose timer cannot be
+    // stored stays on it, and is parked again the next run.
+    int kept = 0;
+    for (int i = 0; i < sched->queueCount; i++) {
+        int index = sched->queue[i];
+        SchedSlot *slot = &sched->slots[index];
+        if (slot->state == SCHED_PARKED) {
+            if (slot->deadline == SCHED_NEVER ||
+                SchedPushTimer(sched, (SchedTimer){ .deadline = slot->deadline,
+                                                    .index = index }) == 0) {
+                slot->queued = -1;
+                continue;
+            }
+            slot->state = SCHED_RUNNING;
+        }
+        slot->queued = kept;
+        sched->queue[kept++] = index;
+    }
+    sched->queueCount = kept;
+
+    sched->now = sched->target;
+}
+
+uint64_t SchedGetTick(const Sched *sched)
+{
+    assert(sched != NULL);
+
+    return sched->now;
+}
+
+int SchedGetCount(const Sched *sched)
+{
+    assert(sched != NULL);
+
+    return sched->count;
+}
+
+int SchedGetRunningCount(const Sched *sched)
+{
+    assert(sched != NULL);
+
+    return sched->queueCount;
+}
+
+static int SchedGrow(Sched *sched)
+{
+    int capacity = sched->slotCapacity ? sched->slotCapacity * 2 : 64;
+
+    // Each array keeps its contents if a later one fails to grow.
+    SchedSlot *slots = realloc(sched->slots, capacity * sizeof(SchedSlot));
+    if (slots) {
+        sched->slots = slots;
+    }
+    int *freeSlots = realloc(sched->freeSlots, capacity * sizeof(int));
+    if (freeSlots) {
+        sched->freeSlots = freeSlots;
+    }
+    int *queue = realloc(sched->queue, capacity * sizeof(int));
+    if (queue) {
+        sched->queue = queue;
+    }
+    if (!slots || !freeSlots || !queue) {
+        fprintf(stderr, "Failed to grow the scheduler to %d VMs!\n", capacity);
+        return -1;
+    }
+
+    sched->slotCapacity = capacity;
+    return 0;
+}
+
+// Catches a VM that has been waiting since it last ran up to the given tick,
+// and puts it on the run queue if it is not there.
+static void SchedResume(Sched *sched, int index, uint64_t tick)
+{
+    SchedSlot *slot = &sched->slots[index];
+
+    if (slot->tick < tick) {
+        VMSkipTicks(slot->vm, tick - slot->tick);
+        slot->tick = tick;
+    }
+    slot->state = SCHED_RUNNING;
+    if (slot->queued < 0) {
+        slot->queued = sched->queueCount;
+        sched->queue[sched->queueCount++] = index;
+    }
+}
+
+static void SchedRunChunk(void *user, int job, int worker)
+{
+    (void)worker;
+    Sched *sched = user;
+    uint64_t target = sched->target;
+
+    int end = MIN((job + 1) * SCHED_CHUNK, sched->queueCount);
+    for (int i = job * SCHED_CHUNK; i < end; i++) {
+        SchedSlot *slot = &sched->slots[sched->queue[i]];
+
+        // Waits that end within the run are skipped on the spot, those that
+        // outlast it park the VM.
+        while (slot->tick < target) {
+            uint64_t idle = VMGetIdleTicks(slot->vm);
+            if (idle >= target - slot->tick) {
+                slot->state = SCHED_PARKED;
+                slot->deadline =
+                    idle == UINT64_MAX ? SCHED_NEVER : slot->tick + idle;
+                break;
+            }
+            if (idle > 0) {
+                VMSkipTicks(slot->vm, idle);
+                slot->tick += idle;
+            } else {
+                VMTick(slot->vm);
+                slot->tick++;
+            }
+        }
+    }
+}
+
+static int SchedPushTimer(Sched *sched, SchedTimer timer)
+{
+    if (sched->timerCount == sched->timerCapacity) {
+        int capacity = sched->timerCapacity ? sched->timerCapacity * 2 : 64;
+        SchedTimer *timers =
+            realloc(sched->timers, capacity * sizeof(SchedTimer));
+        if (!timers) {
+            return -1;
+        }
+        sched->timers = timers;
+        sched->timerCapacity = capacity;
+    }
+
+    // Sift the new timer up from the bottom of the heap.
+    int i = sched->timerCount++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (sched->timers[parent].deadline <= timer.deadline) {
+            break;
+        }
+        sched->timers[i] = sched->timers[parent];
+        i = parent;
+    }
+    sched->timers[i] = timer;
+
+    return 0;
+}
+
+static SchedTimer SchedPopTimer(Sched *sched)
+{
+    SchedTimer top = sched->timers[0];
+    SchedTimer last = sched->timers[--sched->timerCount];
+
+    // Sift the last timer down from the top of the heap.
+    int i = 0;
+    for (;;) {
+        int child = i * 2 + 1;
+        if (child >= sched->timerCount) {
+            break;
+        }
+        if (child + 1 < sched->timerCount &&
+            sched->timers[child + 1].deadline < sched->timers[child].deadline) {
+            child++;
+        }
+        if (last.deadline <= sched->timers[child].deadline) {
+            break;
+        }
+        sched->timers[i] = sched->timers[child];
+        i = child;
+    }
+    if (sched->timerCount > 0) {
+        sched->timers[i] = last;
+    }
+
+    return top;
+}
@@ -0,0 +1,53 @@
+#ifndef CHIP8_SCHED_H
+#define CHIP8_SCHED_H
+
+// Scheduler module.
+// Runs thousands of VMs off one clock over a few worker threads. A VM that is
+// waiting for a key, or spinning until the delay timer runs down, is parked
+// off the run queue with the tick its wait ends on as its continuation. Input
+// or that deadline puts it back, and VMSkipTicks() catches it up in one step,
+// so the work done per tick grows with the running VMs rather than all of them.
+
+#include "def.h"
+#include "vm.h"
+
+typedef struct tSched Sched;
+
+// SchedCreate() - Starts a scheduler with threadCount workers, or one per cpu
+// if threadCount is 0 or less. Returns NULL on failure.
+Sched *SchedCreate(int threadCount);
+
+// SchedDestroy() - Stops the workers and frees the scheduler. The VMs are left
+// to their owners.
+void SchedDestroy(Sched *sched);
+
+// SchedAdd() - Adds a VM, which runs from the next SchedRun() on. The VM stays
+// owned by the caller. Returns its index, or -1 on failure.
+int SchedAdd(Sched *sched, VM *vm);
+
+// SchedRemove() - Catches a VM up to the clock and removes it. Its index may
+// be handed out again.
+void SchedRemove(Sched *sched, int index);
+
+// SchedWake() - Catches a VM up to the clock, puts it back on the run queue if
+// it was parked and returns it. Call this before reading or changing a VM
+// between runs.
+VM *SchedWake(Sched *sched, int index);
+
+// SchedSetKey() - Wakes a VM and presses or releases one of its keys.
+void SchedSetKey(Sched *sched, int index, uint8_t key, bool pressed);
+
+// SchedRun() - Advances the clock by ticks, running every VM that is not
+// parked up to it. The other functions must not be called while it runs.
+void SchedRun(Sched *sched, int ticks);
+
+// SchedGetTick() - Returns the ticks run since SchedCreate().
+uint64_t SchedGetTick(const Sched *sched);
+
+// SchedGetCount() - Returns the number of VMs added and not removed.
+int SchedGetCount(const Sched *sched);
+
+// SchedGetRunningCount() - Returns the number of VMs on the run queue.
+int SchedGetRunningCount(const Sched *sched);
+
+#endif // CHIP8_SCHED_H
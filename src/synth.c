@@ -0,0 +1,210 @@
+#include "synth.h"
+
+#include <math.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                   \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SYNTH_SSE2 1
+#endif
+
+#define TABLE_BITS 11
+#define TABLE_SIZE (1 << TABLE_BITS)
+// One table per octave, starting from the lowest pitch below.
+#define TABLE_COUNT 11
+#define TABLE_BASE_FREQUENCY 20.0
+// Bits of phase used to interpolate between two table samples.
+#define FRAC_BITS 14
+#define FRAC_ONE (1 << FRAC_BITS)
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Each table has a guard sample at the end so that interpolation never needs
+// to wrap the index. They are built once, by the first SynthInit() on any
+// thread.
+static int16_t tables[TABLE_COUNT][TABLE_SIZE + 1];
+#if defined(_WIN32)
+static INIT_ONCE tablesOnce = INIT_ONCE_STATIC_INIT;
+#else
+static pthread_once_t tablesOnce = PTHREAD_ONCE_INIT;
+#endif
+
+static void BuildTablesOnce();
+static void BuildTables();
+static void BuildSquareTable(int16_t *table, int maxHarmonic);
+
+void SynthInit(Synth *synth)
+{
+    assert(synth != NULL);
+
+    BuildTablesOnce();
+
+    synth->phase = 0;
+    SynthSetFrequency(synth, SYNTH_DEFAULT_FREQUENCY);
+}
+
+void SynthSetFrequency(Synth *synth, double hz)
+{
+    assert(synth != NULL);
+
+    hz = MAX(1.0, MIN(hz, SYNTH_SAMPLE_RATE / 2.0));
+
+    // Table t is band-limited for pitches up to BASE * 2^(t + 1).
+    int t = 0;
+    while (t < TABLE_COUNT - 1 && hz >= TABLE_BASE_FREQUENCY * (2 << t)) {
+        t++;
+    }
+
+    synth->table = tables[t];
+    synth->phaseStep = (uint32_t)(hz / SYNTH_SAMPLE_RATE * 4294967296.0);
+}
+
+double SynthPitchToFrequency(uint8_t pitch)
+{
+    return 4000.0 * pow(2.0, ((double)pitch - 64.0) / 48.0);
+}
+
+// Interpolates between table[index] and table[index + 1] using a 14-bit
+// fraction. The SIMD path below computes exactly the same integer result.
+static inline int16_t Lerp(const int16_t *table, uint32_t phase)
+{
+    uint32_t index = phase >> (32 - TABLE_BITS);
+    int32_t frac = (phase >> (32 - TABLE_BITS - FRAC_BITS)) & (FRAC_ONE - 1);
+    int32_t a = table[index];
+    int32_t b = table[index + 1];
+
+    return (int16_t)((a * (FRAC_ONE - frac) + b * frac) >> FRAC_BITS);
+}
+
+void SynthRender(Synth *synth, int16_t *buffer, int sampleCount)
+{
+    assert(synth != NULL);
+    assert(buffer != NULL);
+
+    const int16_t *table = synth->table;
+    uint32_t phase = synth->phase;
+    uint32_t step = synth->phaseStep;
+    int i = 0;
+
+#if defined(SYNTH_SSE2)
+    // Eight samples per iteration. The phases for each lane are advanced with
+    // vector adds, each lane fetches its two neighbouring table samples with a
+    // single 32-bit load, and the interpolation weights are built so that one
+    // _mm_madd_epi16 computes a * (1 - frac) + b * frac for four lanes.
+    const __m128i fracMask = _mm_set1_epi32(FRAC_ONE - 1);
+    const __m128i fracOne = _mm_set1_epi32(FRAC_ONE);
+    const __m128i step8 = _mm_set1_epi32((int32_t)(step * 8));
+    __m128i phaseLo = _mm_setr_epi32((int32_t)phase, (int32_t)(phase + step),
+                                     (int32_t)(phase + step * 2),
+                                     (int32_t)(phase + step * 3));
+    __m128i phaseHi =
+        _mm_add_epi32(phaseLo, _mm_set1_epi32((int32_t)(step * 4)));
+
+    for (; i + 8 <= sampleCount; i += 8) {
+        uint32_t idx[8];
+        _mm_storeu_si128((__m128i *)&idx[0],
+                         _mm_srli_epi32(phaseLo, 32 - TABLE_BITS));
+        _mm_storeu_si128((__m128i *)&idx[4],
+                         _mm_srli_epi32(phaseHi, 32 - TABLE_BITS));
+
+        int32_t pairs[8];
+        for (int j = 0; j < 8; j++) {
+            memcpy(&pairs[j], &table[idx[j]], sizeof(int32_t));
+        }
+
+        __m128i fracLo = _mm_and_si128(
+            _mm_srli_epi32(phaseLo, 32 - TABLE_BITS - FRAC_BITS), fracMask);
+        __m128i fracHi = _mm_and_si128(
+            _mm_srli_epi32(phaseHi, 32 - TABLE_BITS - FRAC_BITS), fracMask);
+        __m128i weightLo = _mm_or_si128(_mm_sub_epi32(fracOne, fracLo),
+                                        _mm_slli_epi32(fracLo, 16));
+        __m128i weightHi = _mm_or_si128(_mm_sub_epi32(fracOne, fracHi),
+                                        _mm_slli_epi32(fracHi, 16));
+
+        __m128i lo = _mm_madd_epi16(
+            _mm_loadu_si128((const __m128i *)&pairs[0]), weightLo);
+        __m128i hi = _mm_madd_epi16(
+            _mm_loadu_si128((const __m128i *)&pairs[4]), weightHi);
+        lo = _mm_srai_epi32(lo, FRAC_BITS);
+        hi = _mm_srai_epi32(hi, FRAC_BITS);
+        _mm_storeu_si128((__m128i *)&buffer[i], _mm_packs_epi32(lo, hi));
+
+        phaseLo = _mm_add_epi32(phaseLo, step8);
+        phaseHi = _mm_add_epi32(phaseHi, step8);
+    }
+    phase += step * (uint32_t)i;
+#endif
+
+    for (; i < sampleCount; i++) {
+        buffer[i] = Lerp(table, phase);
+        phase += step;
+    }
+
+    synth->phase = phase;
+}
+
+#if defined(_WIN32)
+static BOOL CALLBACK BuildTablesEntry(INIT_ONCE *once, void *param,
+                                      void **context)
+{
+    BuildTables();
+    return TRUE;
+}
+
+static void BuildTablesOnce()
+{
+    InitOnceExecuteOnce(&tablesOnce, BuildTablesEntry, NULL, NULL);
+}
+#else
+static void BuildTablesOnce()
+{
+    pthread_once(&tablesOnce, BuildTables);
+}
+#endif
+
+static void BuildTables()
+{
+    for (int t = 0; t < TABLE_COUNT; t++) {
+        double topFrequency = TABLE_BASE_FREQUENCY * (2 << t);
+        int maxHarmonic = (int)((SYNTH_SAMPLE_RATE / 2.0) / topFrequency);
+        maxHarmonic = MIN(maxHarmonic, TABLE_SIZE / 2 - 1);
+
+        BuildSquareTable(tables[t], MAX(1, maxHarmonic));
+    }
+}
+
+// Additive synthesis of a square wave using the odd harmonics up to
+// maxHarmonic. Each harmonic is scaled by the Lanczos sigma factor to tame the
+// Gibbs ringing, then the table is normalised to the tone volume.
+static void BuildSquareTable(int16_t *table, int maxHarmonic)
+{
+    double wave[TABLE_SIZE];
+    double peak = 0.0;
+
+    for (int i = 0; i < TABLE_SIZE; i++) {
+        double x = 2.0 * M_PI * (double)i / TABLE_SIZE;
+        double sum = 0.0;
+
+        for (int k = 1; k <= maxHarmonic; k += 2) {
+            double s = M_PI * k / (maxHarmonic + 1);
+            double sigma = sin(s) / s;
+            sum += sigma * sin(k * x) / k;
+        }
+
+        wave[i] = sum;
+        peak = MAX(peak, fabs(sum));
+    }
+
+    for (int i = 0; i < TABLE_SIZE; i++) {
+        table[i] = (int16_t)lrint(wave[i] / peak * SYNTH_TONE_VOLUME);
+    }
+    table[TABLE_SIZE] = table[0];
+}
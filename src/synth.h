@@ -0,0 +1,35 @@
+#ifndef CHIP8_SYNTH_H
+#define CHIP8_SYNTH_H
+
+// Synth module.
+// Generates the CHIP-8 buzzer tone from precomputed band-limited wavetables.
+// Used by the host application to fill audio buffers.
+
+#include "def.h"
+
+#define SYNTH_SAMPLE_RATE 48000
+#define SYNTH_TONE_VOLUME 3000
+#define SYNTH_DEFAULT_FREQUENCY 256.0
+
+typedef struct tSynth {
+    // 32-bit fixed point phase, a full turn of the wavetable wraps to zero.
+    uint32_t phase;
+    uint32_t phaseStep;
+    const int16_t *table;
+} Synth;
+
+// SynthInit() - Builds the wavetables on first use and resets the synth to
+// the default tone.
+void SynthInit(Synth *synth);
+
+// SynthSetFrequency() - Sets the tone pitch in hz. Picks the wavetable that has
+// no harmonics above nyquist for this pitch.
+void SynthSetFrequency(Synth *synth, double hz);
+
+// SynthPitchToFrequency() - Converts an XO-CHIP pitch register value to hz.
+double SynthPitchToFrequency(uint8_t pitch);
+
+// SynthRender() - Renders sampleCount samples of the tone into buffer.
+void SynthRender(Synth *synth, int16_t *buffer, int sampleCount);
+
+#endif // CHIP8_SYNTH_H
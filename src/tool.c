@@ -0,0 +1,97 @@
+#include "tool.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+int ToolReadRom(const char *filePath, uint8_t *data, size_t *size)
+{
+    assert(filePath != NULL);
+    assert(data != NULL && size != NULL);
+
+    FILE *file = fopen(filePath, "rb");
+    if (!file) {
+        fprintf(stderr, "Failed to open rom %s!\n", filePath);
+        return -1;
+    }
+
+    *size = fread(data, 1, *size, file);
+    bool failed = ferror(file) != 0;
+    fclose(file);
+    if (failed) {
+        fprintf(stderr, "Failed to read rom %s!\n", filePath);
+        return -1;
+    }
+
+    return 0;
+}
+
+int ToolParseKeys(const char *str, uint8_t keys[16], int *count)
+{
+    assert(str != NULL);
+    assert(keys != NULL && count != NULL);
+
+    uint16_t seen = 0;
+    *count = 0;
+    for (const char *c = str; *c; c++) {
+        if (*c == ',' || *c == ' ') {
+            continue;
+        }
+        char digit[2] = { *c, '\0' };
+        char *end;
+        long key = strtol(digit, &end, 16);
+        if (*end != '\0') {
+            fprintf(stderr, "Invalid key '%c', keys are hex digits!\n", *c);
+            return -1;
+        }
+        if (!(seen & (1 << key))) {
+            seen |= 1 << key;
+            keys[(*count)++] = (uint8_t)key;
+        }
+    }
+
+    return 0;
+}
+
+void ToolWriteJsonString(FILE *out, const char *str)
+{
+    if (!str) {
+        fputs("null", out);
+        return;
+    }
+
+    fputc('"', out);
+    for (const unsigned char *c = (const unsigned char *)str; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(out, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(out, "\\u%04x", *c);
+        } else {
+            fputc(*c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+#if defined(_WIN32)
+
+double ToolNowSeconds()
+{
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+}
+
+#else
+
+double ToolNowSeconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef CHIP8_TOOL_H
+#define CHIP8_TOOL_H
+
+// Tool module.
+// Helpers shared by the headless command line tools: timing, reading ROMs,
+// parsing the keys to press and writing JSON results. Not part of libchip8.
+
+#include "def.h"
+
+// ToolNowSeconds() - Returns a monotonic time in seconds, for measuring how
+// long something took.
+double ToolNowSeconds();
+
+// ToolReadRom() - Reads up to *size bytes of a ROM into data and sets *size to
+// the bytes read. Returns 0 on success and -1 on failure.
+int ToolReadRom(const char *filePath, uint8_t *data, size_t *size);
+
+// ToolParseKeys() - Parses keys given as hex digits, optionally separated by
+// commas or spaces, into keys in the order given, skipping repeats. Sets
+// *count to the number of keys. Returns 0 on success and -1 on failure.
+int ToolParseKeys(const char *str, uint8_t keys[16], int *count);
+
+// ToolWriteJsonString() - Writes str as a quoted JSON string, or null if it is
+// NULL.
+void ToolWriteJsonString(FILE *out, const char *str);
+
+#endif // CHIP8_TOOL_H
@@ -1,18 +1,70 @@
 #include "vm.h"
 
-struct VM {
+#include <stddef.h>
+
+struct VMKeyEvent {
+    uint64_t tick;
+    int cycle;
+    uint8_t key;
+    bool pressed;
+};
+
+// Chunks the display is hashed in, each rehashed only once written.
+#define DISPLAY_HASH_CHUNKS (sizeof(((Chip8 *)0)->display) / 64)
+
+struct VMTracking {
+    // Blocks written since each consumer last asked. New writes collect in
+    // chip8.dirty and are handed to every consumer when one asks.
+    uint64_t dirtyBlocks[VMDIRTY_CONSUMER_MAX];
+
+    // Hash of each memory block as of the last VMHashState(), and the XOR of
+    // all of them.
+    uint64_t blockHashes[CHIP8_DIRTY_BLOCKS];
+    uint64_t memoryHash;
+    uint64_t displayHashes[DISPLAY_HASH_CHUNKS];
+};
+
+struct tVM {
     Chip8 chip8;
     VMColorPalette palette;
     int cyclesPerTick;
+    unsigned int seed;
+    uint64_t tickCount;
+    // Instructions executed since VMCreate(), not counting cycles spent
+    // waiting for a key.
+    uint64_t cycleCount;
+    // FNV-1a hash of the loaded ROM, save states only load onto the same ROM.
+    uint32_t romHash;
+
+    // FIFO of scheduled key transitions, ordered by (tick, cycle).
+    struct VMKeyEvent keyQueue[VM_KEY_QUEUE_LEN];
+    int keyQueueHead;
+    int keyQueueCount;
+
+    VMKeyListener keyListener;
+    void *keyListenerUser;
+
+    VMCoverage *coverage;
+
+    // Tracks the memory as it is now rather than as part of the machine
+    // state, so restoring a snapshot keeps it.
+    struct VMTracking tracking;
 
     bool paused;
-    bool initialized;
 };
 
-static struct VM vm;
+static void ApplyKey(VM *vm, uint8_t key, bool pressed, int cycle);
+static void ApplyDueKeys(VM *vm, int cycle);
+static uint64_t HashMemory(VM *vm);
+static bool CoveredCycle(VM *vm);
+static inline void MarkCovered(VM *vm, uint16_t address, uint16_t next);
+static uint32_t HashBytes(const uint8_t *data, size_t size);
+static uint64_t DiffBlocks(const Chip8 *a, const Chip8 *b);
+static uint64_t HashChunk(const uint8_t *data, uint64_t seed);
+static inline uint64_t Mix64(uint64_t x);
 
 // clang-format off
-static VMColorPalette palettes[] = {
+static const VMColorPalette palettes[] = {
 	{ 0xFF000000, 0xFFFFFFFF },		// PALETTE_ORIGINAL
 	{ 0xFF43523D, 0xFFC7F0D8 },		// PALETTE_NOKIA
 	{ 0xFFF9FFB3, 0xFF3D8026 },	    // PALETTE_LCD
@@ -25,22 +77,58 @@ static VMColorPalette palettes[] = {
 };
 // clang-format on
 
-void VMInit(int cyclesPerTick, VMColorPaletteType paletteType)
+VM *VMCreate(int cyclesPerTick, VMColorPaletteType paletteType,
+             unsigned int seed)
+{
+    VM *vm = calloc(1, sizeof(VM));
+    if (!vm) {
+        fprintf(stderr, "Failed to allocate a VM!\n");
+        return NULL;
+    }
+
+    Chip8Init(&vm->chip8, seed);
+    vm->seed = vm->chip8.rng;
+    memcpy(vm->palette, palettes[paletteType], sizeof(VMColorPalette));
+    vm->cyclesPerTick = cyclesPerTick;
+    vm->tickCount = 0;
+    vm->romHash = HashBytes(NULL, 0);
+    vm->keyQueueHead = 0;
+    vm->keyQueueCount = 0;
+    vm->keyListener = NULL;
+    vm->keyListenerUser = NULL;
+    memset(&vm->tracking, 0, sizeof(vm->tracking));
+
+    vm->paused = false;
+    return vm;
+}
+
+void VMDestroy(VM *vm)
+{
+    free(vm);
+}
+
+unsigned int VMGetSeed(VM *vm)
 {
-    Chip8Init(&vm.chip8);
-    memcpy(vm.palette, palettes[paletteType], sizeof(VMColorPalette));
-    vm.cyclesPerTick = cyclesPerTick;
+    assert(vm != NULL);
 
-    vm.paused = false;
-    vm.initialized = true;
+    return vm->seed;
 }
 
-int VMLoadRom(const char *filePath)
+void VMSetSeed(VM *vm, unsigned int seed)
 {
-    assert(vm.initialized);
+    assert(vm != NULL);
+
+    Chip8Seed(&vm->chip8, seed);
+    vm->seed = vm->chip8.rng;
+}
+
+int VMLoadRom(VM *vm, const char *filePath)
+{
+    assert(vm != NULL);
     assert(filePath != NULL);
 
     FILE *file = NULL;
+    uint8_t data[CHIP8_USERMEM_TOTAL];
 
     file = fopen(filePath, "rb");
     if (!file) {
@@ -60,9 +148,7 @@ int VMLoadRom(const char *filePath)
     }
     rewind(file);
 
-    // Read the rom program into CHIP8 user memory space.
-    size_t bytesRead =
-        fread(vm.chip8.memory + CHIP8_USERMEM_START, 1, sz, file);
+    size_t bytesRead = fread(data, 1, sz, file);
     if (bytesRead != sz) {
         fprintf(
             stderr,
@@ -71,11 +157,8 @@ int VMLoadRom(const char *filePath)
         goto error;
     }
 
-    // Set the CHIP-8 program counter to the start of user memory.
-    vm.chip8.PC = CHIP8_USERMEM_START;
-
     fclose(file);
-    return 0;
+    return VMLoadRomData(vm, data, sz);
 
 error:
     if (file) {
@@ -84,72 +167,940 @@ error:
     return -1;
 }
 
-void VMTick()
+int VMLoadRomData(VM *vm, const uint8_t *data, size_t size)
 {
-    assert(vm.initialized);
+    assert(vm != NULL);
+    assert(data != NULL);
+
+    if (size > CHIP8_USERMEM_TOTAL) {
+        fprintf(stderr, "Rom is too large for CHIP8! Got %zu, must be < %d\n",
+                size, CHIP8_USERMEM_TOTAL);
+        return -1;
+    }
+
+    // Copy the rom program into CHIP8 user memory space.
+    memcpy(vm->chip8.memory + CHIP8_USERMEM_START, data, size);
+    Chip8MarkDirty(&vm->chip8, CHIP8_USERMEM_START, size);
 
-    if (vm.paused) {
+    // Set the CHIP-8 program counter to the start of user memory.
+    vm->chip8.PC = CHIP8_USERMEM_START;
+    Chip8MarkDirty(&vm->chip8, offsetof(Chip8, PC), sizeof(vm->chip8.PC));
+    vm->romHash = HashBytes(vm->chip8.memory + CHIP8_USERMEM_START, size);
+
+    return 0;
+}
+
+void VMTick(VM *vm)
+{
+    assert(vm != NULL);
+
+    if (vm->paused) {
         return;
     }
 
-    // Execute CHIP8 instructions at correct rate.
-    for (int c = 0; (c < vm.cyclesPerTick) && !Chip8WaitingForKey(&vm.chip8);
-         c++) {
-        Chip8Cycle(&vm.chip8);
+    // Execute CHIP8 instructions at correct rate. Cycles spent waiting for a
+    // key still pass, so a key scheduled later in the tick releases the wait
+    // at the cycle it was scheduled for.
+    for (int c = 0; c < vm->cyclesPerTick; c++) {
+        ApplyDueKeys(vm, c);
+        if (!Chip8WaitingForKey(&vm->chip8)) {
+            bool faulted = false;
+            if (vm->coverage) {
+                faulted = CoveredCycle(vm);
+            } else {
+                Chip8Cycle(&vm->chip8);
+            }
+            vm->cycleCount++;
+            // Whatever runs after a fault is garbage, stop before it.
+            if (faulted) {
+                break;
+            }
+        }
     }
+    ApplyDueKeys(vm, vm->cyclesPerTick);
 
     // Update the timers.
-    if (vm.chip8.delayTimer > 0) {
-        vm.chip8.delayTimer--;
+    if (vm->chip8.delayTimer > 0) {
+        vm->chip8.delayTimer--;
     }
-    if (vm.chip8.soundTimer > 0) {
-        vm.chip8.soundTimer--;
+    if (vm->chip8.soundTimer > 0) {
+        vm->chip8.soundTimer--;
     }
+    Chip8MarkDirty(&vm->chip8, offsetof(Chip8, delayTimer), 2);
+
+    vm->tickCount++;
 }
 
-uint8_t *VMGetDisplayPixels()
+int VMGetCyclesPerTick(VM *vm)
 {
-    assert(vm.initialized);
+    assert(vm != NULL);
 
-    return vm.chip8.display;
+    return vm->cyclesPerTick;
 }
 
-int VMGetSoundTimer()
+uint64_t VMGetTickCount(VM *vm)
 {
-    assert(vm.initialized);
+    assert(vm != NULL);
 
-    return (int)vm.chip8.soundTimer;
+    return vm->tickCount;
 }
 
-void VMGetColorPalette(VMColorPalette outPalette)
+uint64_t VMGetCycleCount(VM *vm)
 {
-    assert(vm.initialized);
+    assert(vm != NULL);
 
-    memcpy(outPalette, vm.palette, sizeof(VMColorPalette));
+    return vm->cycleCount;
 }
 
-void VMSetKey(uint8_t key)
+void VMSetQuirks(VM *vm, uint32_t quirks)
 {
-    assert(vm.initialized);
+    assert(vm != NULL);
 
-    vm.chip8.keys[key % 16] = 1;
+    vm->chip8.quirks = quirks & CHIP8_QUIRK_ALL;
 }
 
-void VMClearKey(uint8_t key)
+uint32_t VMGetQuirks(VM *vm)
 {
-    assert(vm.initialized);
+    assert(vm != NULL);
 
-    vm.chip8.keys[key % 16] = 0;
+    return vm->chip8.quirks;
+}
+
+// clang-format off
+static const struct {
+    const char *name;
+    uint32_t quirk;
+} quirkNames[] = {
+    { "vf-reset",     CHIP8_QUIRK_VF_RESET },
+    { "shift-vy",     CHIP8_QUIRK_SHIFT_VY },
+    { "load-store-i", CHIP8_QUIRK_LOAD_STORE_I },
+    { "jump-vx",      CHIP8_QUIRK_JUMP_VX },
+    { "sprite-wrap",  CHIP8_QUIRK_SPRITE_WRAP },
+};
+// clang-format on
+
+int VMParseQuirks(const char *str, uint32_t *quirks)
+{
+    assert(str != NULL);
+    assert(quirks != NULL);
+
+    // A plain number is taken as the bits themselves.
+    char *end;
+    unsigned long value = strtoul(str, &end, 0);
+    if (end != str && *end == '\0') {
+        if (value & ~(unsigned long)CHIP8_QUIRK_ALL) {
+            return -1;
+        }
+        *quirks = (uint32_t)value;
+        return 0;
+    }
+
+    uint32_t result = 0;
+    while (*str) {
+        size_t length = strcspn(str, ",");
+        size_t i;
+        for (i = 0; i < ARRAY_LEN(quirkNames); i++) {
+            if (strlen(quirkNames[i].name) == length &&
+                strncmp(quirkNames[i].name, str, length) == 0) {
+                result |= quirkNames[i].quirk;
+                break;
+            }
+        }
+        if (i == ARRAY_LEN(quirkNames) &&
+            !(length == 4 && strncmp(str, "none", 4) == 0)) {
+            return -1;
+        }
+        str += length;
+        if (*str == ',') {
+            str++;
+        }
+    }
+
+    *quirks = result;
+    return 0;
+}
+
+void VMFormatQuirks(uint32_t quirks, char *buffer, size_t size)
+{
+    assert(buffer != NULL && size > 0);
+
+    buffer[0] = '\0';
+    size_t length = 0;
+    for (size_t i = 0; i < ARRAY_LEN(quirkNames); i++) {
+        if (quirks & quirkNames[i].quirk) {
+            length += snprintf(buffer + length, size - MIN(length, size),
+                               "%s%s", length > 0 ? "," : "",
+                               quirkNames[i].name);
+        }
+    }
+    if (length == 0) {
+        snprintf(buffer, size, "none");
+    }
+}
+
+uint32_t VMGetRomHash(VM *vm)
+{
+    assert(vm != NULL);
+
+    return vm->romHash;
+}
+
+uint64_t VMHashState(VM *vm)
+{
+    assert(vm != NULL);
+
+    uint64_t hash = VMHashMovieState(vm);
+    hash = Mix64(hash ^ (uint64_t)vm->paused);
+    for (int i = 0; i < vm->keyQueueCount; i++) {
+        const struct VMKeyEvent *event =
+            &vm->keyQueue[(vm->keyQueueHead + i) % VM_KEY_QUEUE_LEN];
+        hash = Mix64(hash ^ event->tick);
+        hash = Mix64(hash ^ ((uint64_t)(uint32_t)event->cycle << 16 |
+                             (uint64_t)event->key << 8 | event->pressed));
+    }
+    return hash;
+}
+
+uint64_t VMHashMovieState(VM *vm)
+{
+    assert(vm != NULL);
+
+    // The rest of the state is a handful of fields, cheap to hash in full.
+    uint64_t hash = HashMemory(vm);
+    hash = Mix64(hash ^ vm->tickCount);
+    hash = Mix64(hash ^
+                 ((uint64_t)vm->romHash << 32 | (uint32_t)vm->cyclesPerTick));
+    return Mix64(hash ^ vm->chip8.quirks);
+}
+
+uint64_t VMHashMachine(VM *vm)
+{
+    assert(vm != NULL);
+
+    return Mix64(HashMemory(vm));
+}
+
+uint64_t VMHashDisplay(VM *vm)
+{
+    assert(vm != NULL);
 
-    if (Chip8WaitingForKey(&vm.chip8)) {
-        vm.chip8.V[vm.chip8.waitingKey.reg] = key;
-        vm.chip8.waitingKey.waiting = 0;
+    struct VMTracking *tracking = &vm->tracking;
+    uint64_t blocks = VMTakeDirtyBlocks(vm, VMDIRTY_CONSUMER_HASH_DISPLAY);
+    uint64_t hash = 0;
+    for (size_t i = 0; i < DISPLAY_HASH_CHUNKS; i++) {
+        size_t address = offsetof(Chip8, display) + i * 64;
+        size_t first = address / CHIP8_DIRTY_BLOCK_SIZE;
+        size_t last = (address + 63) / CHIP8_DIRTY_BLOCK_SIZE;
+        for (size_t block = first; block <= last; block++) {
+            if (blocks & ((uint64_t)1 << block)) {
+                tracking->displayHashes[i] =
+                    HashChunk(vm->chip8.display + i * 64, (uint64_t)i);
+                break;
+            }
+        }
+        hash = Mix64(hash ^ tracking->displayHashes[i]);
     }
+    return hash;
 }
 
-void VMTogglePause(bool pause)
+uint8_t *VMGetDisplayPixels(VM *vm)
 {
-    assert(vm.initialized);
+    assert(vm != NULL);
 
-    vm.paused = pause;
+    return vm->chip8.display;
 }
+
+uint8_t VMPeek(VM *vm, uint16_t address)
+{
+    assert(vm != NULL);
+    assert(address < 0x1000);
+
+    return vm->chip8.memory[address];
+}
+
+int VMGetSoundTimer(VM *vm)
+{
+    assert(vm != NULL);
+
+    return (int)vm->chip8.soundTimer;
+}
+
+void VMGetColorPalette(VM *vm, VMColorPalette outPalette)
+{
+    assert(vm != NULL);
+
+    memcpy(outPalette, vm->palette, sizeof(VMColorPalette));
+}
+
+void VMSetKey(VM *vm, uint8_t key)
+{
+    assert(vm != NULL);
+
+    ApplyKey(vm, key, true, 0);
+}
+
+void VMClearKey(VM *vm, uint8_t key)
+{
+    assert(vm != NULL);
+
+    ApplyKey(vm, key, false, 0);
+}
+
+void VMScheduleKey(VM *vm, uint8_t key, bool pressed, double tickOffset)
+{
+    assert(vm != NULL);
+
+    tickOffset = MAX(tickOffset, 0.0);
+    int wholeTicks = (int)tickOffset;
+    VMScheduleKeyAt(vm, key, pressed, vm->tickCount + wholeTicks,
+                    (int)((tickOffset - wholeTicks) * vm->cyclesPerTick));
+}
+
+void VMScheduleKeyAt(VM *vm, uint8_t key, bool pressed, uint64_t tick,
+                     int cycle)
+{
+    assert(vm != NULL);
+
+    // Nowhere left to hold it, so apply it straight away.
+    if (vm->keyQueueCount == VM_KEY_QUEUE_LEN) {
+        ApplyKey(vm, key, pressed, 0);
+        return;
+    }
+
+    struct VMKeyEvent event = {
+        .tick = tick, .cycle = cycle, .key = key, .pressed = pressed
+    };
+
+    // Never schedule ahead of an earlier event so the queue stays ordered.
+    if (vm->keyQueueCount > 0) {
+        int last =
+            (vm->keyQueueHead + vm->keyQueueCount - 1) % VM_KEY_QUEUE_LEN;
+        const struct VMKeyEvent *prev = &vm->keyQueue[last];
+        if (event.tick < prev->tick ||
+            (event.tick == prev->tick && event.cycle < prev->cycle)) {
+            event.tick = prev->tick;
+            event.cycle = prev->cycle;
+        }
+    }
+
+    int tail = (vm->keyQueueHead + vm->keyQueueCount) % VM_KEY_QUEUE_LEN;
+    vm->keyQueue[tail] = event;
+    vm->keyQueueCount++;
+}
+
+uint64_t VMTakeDirtyBlocks(VM *vm, VMDirtyConsumer consumer)
+{
+    assert(vm != NULL);
+    assert(consumer >= 0 && consumer < VMDIRTY_CONSUMER_MAX);
+
+    for (int i = 0; i < VMDIRTY_CONSUMER_MAX; i++) {
+        vm->tracking.dirtyBlocks[i] |= vm->chip8.dirty;
+    }
+    vm->chip8.dirty = 0;
+
+    uint64_t blocks = vm->tracking.dirtyBlocks[consumer];
+    vm->tracking.dirtyBlocks[consumer] = 0;
+    return blocks;
+}
+
+// Where user memory starts in a save state, after the header, registers and
+// display. VMSaveState() checks it stays in step with the layout.
+#define STATE_USERMEM_OFFSET 368
+
+uint64_t VMStateDirtySpans(uint64_t dirtyBlocks)
+{
+    const size_t userMemSize = 0x1000 - CHIP8_USERMEM_START;
+    const size_t userMemEnd = STATE_USERMEM_OFFSET + userMemSize;
+
+    // Everything before and after user memory changes every tick anyway.
+    uint64_t spans = 0;
+    for (size_t span = 0; span < 64; span++) {
+        size_t start = span * VM_STATE_SPAN_SIZE;
+        if (start < STATE_USERMEM_OFFSET ||
+            start + VM_STATE_SPAN_SIZE > userMemEnd) {
+            spans |= (uint64_t)1 << span;
+        }
+    }
+
+    for (int block = CHIP8_USERMEM_START / CHIP8_DIRTY_BLOCK_SIZE;
+         block < CHIP8_DIRTY_BLOCKS; block++) {
+        if (!(dirtyBlocks & ((uint64_t)1 << block))) {
+            continue;
+        }
+
+        size_t start = STATE_USERMEM_OFFSET +
+                       block * CHIP8_DIRTY_BLOCK_SIZE - CHIP8_USERMEM_START;
+        size_t first = start / VM_STATE_SPAN_SIZE;
+        size_t last = (start + CHIP8_DIRTY_BLOCK_SIZE - 1) / VM_STATE_SPAN_SIZE;
+        for (size_t span = first; span <= last && span < 64; span++) {
+            spans |= (uint64_t)1 << span;
+        }
+    }
+
+    return spans;
+}
+
+size_t VMSnapshotSize()
+{
+    return sizeof(VM);
+}
+
+void VMTakeSnapshot(VM *vm, void *buffer)
+{
+    assert(vm != NULL);
+    assert(buffer != NULL);
+
+    memcpy(buffer, vm, sizeof(VM));
+}
+
+void VMRestoreSnapshot(VM *vm, const void *buffer)
+{
+    assert(vm != NULL);
+    assert(buffer != NULL);
+
+    // Consumers keep what they had pending against the current memory, plus
+    // whatever the snapshot puts back differently.
+    const VM *snapshot = buffer;
+    uint64_t changed =
+        vm->chip8.dirty | DiffBlocks(&vm->chip8, &snapshot->chip8);
+    struct VMTracking tracking = vm->tracking;
+    VMCoverage *coverage = vm->coverage;
+
+    memcpy(vm, buffer, sizeof(VM));
+
+    vm->tracking = tracking;
+    vm->coverage = coverage;
+    vm->chip8.dirty = changed;
+}
+
+// Little endian cursor over a save state buffer. Writes and reads past the end
+// are dropped and flag the cursor instead, so callers check once at the end.
+struct StateCursor {
+    uint8_t *data;
+    const uint8_t *readData;
+    size_t size;
+    size_t pos;
+    bool overflow;
+};
+
+static void PutBytes(struct StateCursor *c, const void *src, size_t n)
+{
+    if (c->overflow || c->size - c->pos < n) {
+        c->overflow = true;
+        return;
+    }
+    memcpy(c->data + c->pos, src, n);
+    c->pos += n;
+}
+
+static void PutUint(struct StateCursor *c, uint64_t value, int bytes)
+{
+    uint8_t le[8];
+    for (int i = 0; i < bytes; i++) {
+        le[i] = (uint8_t)(value >> (8 * i));
+    }
+    PutBytes(c, le, bytes);
+}
+
+static void GetBytes(struct StateCursor *c, void *dst, size_t n)
+{
+    if (c->overflow || c->size - c->pos < n) {
+        c->overflow = true;
+        memset(dst, 0, n);
+        return;
+    }
+    memcpy(dst, c->readData + c->pos, n);
+    c->pos += n;
+}
+
+static uint64_t GetUint(struct StateCursor *c, int bytes)
+{
+    uint8_t le[8];
+    GetBytes(c, le, bytes);
+
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= (uint64_t)le[i] << (8 * i);
+    }
+    return value;
+}
+
+size_t VMSaveState(VM *vm, void *buffer, size_t size)
+{
+    assert(vm != NULL);
+    assert(buffer != NULL);
+
+    struct StateCursor c = { .data = buffer, .size = size };
+    const Chip8 *chip8 = &vm->chip8;
+
+    // Header.
+    PutBytes(&c, VM_STATE_MAGIC, 4);
+    PutUint(&c, VM_STATE_VERSION, 2);
+    PutUint(&c, vm->romHash, 4);
+    PutUint(&c, vm->cyclesPerTick, 4);
+    PutUint(&c, vm->tickCount, 8);
+    PutUint(&c, vm->cycleCount, 8);
+    PutUint(&c, vm->paused, 1);
+
+    // CPU registers, written field by field so the file does not depend on
+    // the struct layout.
+    PutBytes(&c, chip8->V, sizeof(chip8->V));
+    PutUint(&c, chip8->delayTimer, 1);
+    PutUint(&c, chip8->soundTimer, 1);
+    PutUint(&c, chip8->SP, 1);
+    PutBytes(&c, chip8->keys, sizeof(chip8->keys));
+    PutUint(&c, chip8->waitingKey.reg, 1);
+    PutUint(&c, chip8->waitingKey.waiting, 1);
+    PutUint(&c, chip8->PC, 2);
+    for (int i = 0; i < CHIP8_STACK_MAX; i++) {
+        PutUint(&c, chip8->stack[i], 2);
+    }
+    PutUint(&c, chip8->I, 2);
+    PutUint(&c, chip8->rng, 4);
+    PutUint(&c, chip8->quirks, 4);
+    PutBytes(&c, chip8->display, sizeof(chip8->display));
+
+    // User memory. Everything below it is the registers and font above.
+    assert(c.overflow || c.pos == STATE_USERMEM_OFFSET);
+    PutBytes(&c, chip8->memory + CHIP8_USERMEM_START,
+             sizeof(chip8->memory) - CHIP8_USERMEM_START);
+
+    // Key transitions that were scheduled but not applied yet.
+    PutUint(&c, vm->keyQueueCount, 1);
+    for (int i = 0; i < vm->keyQueueCount; i++) {
+        const struct VMKeyEvent *event =
+            &vm->keyQueue[(vm->keyQueueHead + i) % VM_KEY_QUEUE_LEN];
+        PutUint(&c, event->tick, 8);
+        PutUint(&c, event->cycle, 2);
+        PutUint(&c, event->key, 1);
+        PutUint(&c, event->pressed, 1);
+    }
+
+    return c.overflow ? 0 : c.pos;
+}
+
+int VMLoadState(VM *vm, const void *buffer, size_t size)
+{
+    assert(vm != NULL);
+    assert(buffer != NULL);
+
+    struct StateCursor c = { .readData = buffer, .size = size };
+
+    char magic[4];
+    GetBytes(&c, magic, 4);
+    uint64_t version = GetUint(&c, 2);
+    uint32_t romHash = (uint32_t)GetUint(&c, 4);
+    if (c.overflow || memcmp(magic, VM_STATE_MAGIC, 4) != 0) {
+        fprintf(stderr, "Save state is not a CHIP-8 save state!\n");
+        return -1;
+    }
+    if (version != VM_STATE_VERSION) {
+        fprintf(stderr, "Save state version %d is not supported, expected %d\n",
+                (int)version, VM_STATE_VERSION);
+        return -1;
+    }
+    if (romHash != vm->romHash) {
+        fprintf(stderr, "Save state was made with a different rom!\n");
+        return -1;
+    }
+
+    // Decode into a copy so a truncated state leaves the VM untouched.
+    VM next = *vm;
+    Chip8 *chip8 = &next.chip8;
+
+    next.cyclesPerTick = (int)GetUint(&c, 4);
+    next.tickCount = GetUint(&c, 8);
+    next.cycleCount = GetUint(&c, 8);
+    next.paused = GetUint(&c, 1) != 0;
+
+    GetBytes(&c, chip8->V, sizeof(chip8->V));
+    chip8->delayTimer = (uint8_t)GetUint(&c, 1);
+    chip8->soundTimer = (uint8_t)GetUint(&c, 1);
+    chip8->SP = (uint8_t)GetUint(&c, 1);
+    GetBytes(&c, chip8->keys, sizeof(chip8->keys));
+    chip8->waitingKey.reg = (unsigned int)GetUint(&c, 1);
+    chip8->waitingKey.waiting = (unsigned int)GetUint(&c, 1);
+    chip8->PC = (uint16_t)GetUint(&c, 2);
+    for (int i = 0; i < CHIP8_STACK_MAX; i++) {
+        chip8->stack[i] = (uint16_t)GetUint(&c, 2);
+    }
+    chip8->I = (uint16_t)GetUint(&c, 2);
+    chip8->rng = (uint32_t)GetUint(&c, 4);
+    chip8->quirks = (uint32_t)GetUint(&c, 4) & CHIP8_QUIRK_ALL;
+    GetBytes(&c, chip8->display, sizeof(chip8->display));
+    GetBytes(&c, chip8->memory + CHIP8_USERMEM_START,
+             sizeof(chip8->memory) - CHIP8_USERMEM_START);
+
+    int keyCount = (int)GetUint(&c, 1);
+    next.keyQueueHead = 0;
+    next.keyQueueCount = MIN(keyCount, VM_KEY_QUEUE_LEN);
+    for (int i = 0; i < next.keyQueueCount; i++) {
+        struct VMKeyEvent *event = &next.keyQueue[i];
+        event->tick = GetUint(&c, 8);
+        event->cycle = (int)GetUint(&c, 2);
+        event->key = (uint8_t)GetUint(&c, 1);
+        event->pressed = GetUint(&c, 1) != 0;
+    }
+
+    if (c.overflow) {
+        fprintf(stderr, "Save state is truncated!\n");
+        return -1;
+    }
+    // SP is not range checked, unbalanced calls and returns take it anywhere
+    // in 0-255 on a running VM too.
+    if (next.cyclesPerTick <= 0) {
+        fprintf(stderr, "Save state is corrupt!\n");
+        return -1;
+    }
+
+    next.chip8.dirty |= DiffBlocks(&vm->chip8, &next.chip8);
+    *vm = next;
+    return 0;
+}
+
+int VMSaveStateFile(VM *vm, const char *filePath)
+{
+    assert(vm != NULL);
+    assert(filePath != NULL);
+
+    uint8_t buffer[VM_STATE_MAX_SIZE];
+    size_t size = VMSaveState(vm, buffer, sizeof(buffer));
+    assert(size > 0);
+
+    FILE *file = fopen(filePath, "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to fopen() save state file at %s!\n",
+                filePath);
+        return -1;
+    }
+
+    size_t bytesWritten = fwrite(buffer, 1, size, file);
+    if (fclose(file) != 0 || bytesWritten != size) {
+        fprintf(stderr, "Failed to write save state file %s!\n", filePath);
+        return -1;
+    }
+
+    return 0;
+}
+
+int VMLoadStateFile(VM *vm, const char *filePath)
+{
+    assert(vm != NULL);
+    assert(filePath != NULL);
+
+    uint8_t buffer[VM_STATE_MAX_SIZE];
+
+    FILE *file = fopen(filePath, "rb");
+    if (!file) {
+        fprintf(stderr, "Failed to fopen() save state file at %s!\n",
+                filePath);
+        return -1;
+    }
+
+    size_t bytesRead = fread(buffer, 1, sizeof(buffer), file);
+    fclose(file);
+
+    return VMLoadState(vm, buffer, bytesRead);
+}
+
+void VMSetCoverage(VM *vm, VMCoverage *coverage)
+{
+    assert(vm != NULL);
+
+    vm->coverage = coverage;
+}
+
+void VMSetKeyListener(VM *vm, VMKeyListener listener, void *user)
+{
+    assert(vm != NULL);
+
+    vm->keyListener = listener;
+    vm->keyListenerUser = user;
+}
+
+void VMTogglePause(VM *vm, bool pause)
+{
+    assert(vm != NULL);
+
+    vm->paused = pause;
+}
+
+bool VMIsIdle(VM *vm)
+{
+    assert(vm != NULL);
+
+    if (vm->paused) {
+        return true;
+    }
+
+    // A tick spent waiting for a key only counts the timers down, so once
+    // they have stopped ticking changes nothing.
+    return Chip8WaitingForKey(&vm->chip8) && vm->chip8.delayTimer == 0 &&
+           vm->chip8.soundTimer == 0 && vm->keyQueueCount == 0;
+}
+
+uint64_t VMGetIdleTicks(VM *vm)
+{
+    assert(vm != NULL);
+
+    if (vm->paused) {
+        return UINT64_MAX;
+    }
+
+    uint64_t idle = UINT64_MAX;
+    Chip8DelayLoop loop;
+    if (!Chip8WaitingForKey(&vm->chip8)) {
+        if (!Chip8FindDelayLoop(&vm->chip8, &loop)) {
+            return 0;
+        }
+        if (loop.exitDelay >= 0) {
+            idle = vm->chip8.delayTimer - loop.exitDelay;
+        }
+    }
+
+    // Scheduled keys are applied by VMTick() on their own tick.
+    if (vm->keyQueueCount > 0) {
+        uint64_t tick = vm->keyQueue[vm->keyQueueHead].tick;
+        idle = MIN(idle, tick > vm->tickCount ? tick - vm->tickCount : 0);
+    }
+
+    return idle;
+}
+
+void VMSkipTicks(VM *vm, uint64_t ticks)
+{
+    assert(vm != NULL);
+    assert(ticks <= VMGetIdleTicks(vm));
+
+    if (vm->paused || ticks == 0) {
+        return;
+    }
+
+    // Every tick runs cyclesPerTick instructions round the loop, so it ends up
+    // where that many instructions take it, with each register it loads
+    // holding what was last loaded into it.
+    Chip8 *chip8 = &vm->chip8;
+    Chip8DelayLoop loop;
+    if (!Chip8WaitingForKey(chip8) && Chip8FindDelayLoop(chip8, &loop)) {
+        uint64_t cycles = ticks * vm->cyclesPerTick;
+        uint64_t lastCycle[16] = {0};
+        for (int i = 0; i < loop.length; i++) {
+            int x = loop.reg[i];
+            if (x < 0 || cycles <= (uint64_t)i) {
+                continue;
+            }
+            // One past the cycle that last ran it, so 0 is never run.
+            uint64_t cycle =
+                i + (cycles - 1 - i) / loop.length * loop.length + 1;
+            if (cycle < lastCycle[x]) {
+                continue;
+            }
+            lastCycle[x] = cycle;
+
+            uint64_t tick = (cycle - 1) / vm->cyclesPerTick;
+            if (loop.value[i] >= 0) {
+                chip8->V[x] = (uint8_t)loop.value[i];
+            } else {
+                chip8->V[x] = tick < chip8->delayTimer ?
+                                  (uint8_t)(chip8->delayTimer - tick) : 0;
+            }
+        }
+        chip8->PC = loop.address[cycles % loop.length];
+        vm->cycleCount += cycles;
+        for (int i = 0; vm->coverage && i < loop.length; i++) {
+            if ((uint64_t)i < cycles) {
+                MarkCovered(vm, loop.address[i],
+                            loop.address[(i + 1) % loop.length]);
+            }
+        }
+    }
+
+    chip8->delayTimer =
+        ticks < chip8->delayTimer ? (uint8_t)(chip8->delayTimer - ticks) : 0;
+    chip8->soundTimer =
+        ticks < chip8->soundTimer ? (uint8_t)(chip8->soundTimer - ticks) : 0;
+    Chip8MarkDirty(chip8, 0, offsetof(Chip8, display));
+    Chip8MarkDirty(chip8, offsetof(Chip8, PC), sizeof(chip8->PC));
+
+    vm->tickCount += ticks;
+}
+
+// Keys applied between ticks are reported at cycle 0 of the next tick, which
+// is where a replay applies them.
+static void ApplyKey(VM *vm, uint8_t key, bool pressed, int cycle)
+{
+    if (vm->keyListener) {
+        vm->keyListener(vm->tickCount, cycle, key, pressed,
+                        vm->keyListenerUser);
+    }
+
+    vm->chip8.keys[key % 16] = pressed ? 1 : 0;
+
+    if (!pressed && Chip8WaitingForKey(&vm->chip8)) {
+        vm->chip8.V[vm->chip8.waitingKey.reg] = key;
+        vm->chip8.waitingKey.waiting = 0;
+    }
+    Chip8MarkDirty(&vm->chip8, 0, offsetof(Chip8, display));
+}
+
+// Applies every queued key transition that is due at or before the given cycle
+// of the current tick, including any left over from earlier ticks.
+static void ApplyDueKeys(VM *vm, int cycle)
+{
+    while (vm->keyQueueCount > 0) {
+        const struct VMKeyEvent *event = &vm->keyQueue[vm->keyQueueHead];
+        if (event->tick > vm->tickCount ||
+            (event->tick == vm->tickCount && event->cycle > cycle)) {
+            break;
+        }
+
+        ApplyKey(vm, event->key, event->pressed, cycle);
+        vm->keyQueueHead = (vm->keyQueueHead + 1) % VM_KEY_QUEUE_LEN;
+        vm->keyQueueCount--;
+    }
+}
+
+// Rehashes the memory blocks written since the last call, and returns the hash
+// of all of memory.
+static uint64_t HashMemory(VM *vm)
+{
+    struct VMTracking *tracking = &vm->tracking;
+    uint64_t blocks = VMTakeDirtyBlocks(vm, VMDIRTY_CONSUMER_HASH_STATE);
+    for (int i = 0; i < CHIP8_DIRTY_BLOCKS; i++) {
+        if (blocks & ((uint64_t)1 << i)) {
+            uint64_t hash = HashChunk(
+                vm->chip8.memory + i * CHIP8_DIRTY_BLOCK_SIZE, (uint64_t)i);
+            tracking->memoryHash ^= tracking->blockHashes[i] ^ hash;
+            tracking->blockHashes[i] = hash;
+        }
+    }
+
+    return tracking->memoryHash;
+}
+
+// Runs a cycle, recording it and any fault it raises in the coverage. Returns
+// if it raised one.
+static bool CoveredCycle(VM *vm)
+{
+    Chip8 *chip8 = &vm->chip8;
+    uint16_t address = chip8->PC;
+    uint8_t sp = chip8->SP;
+    uint16_t op = 0;
+    if (address < CHIP8_USERMEM_END) {
+        op = (chip8->memory[address] << 8) | chip8->memory[address + 1];
+    }
+
+    // How far past I the instruction reads or writes, checked before it runs
+    // as Fx55 and Fx65 may move I.
+    int span = 0;
+    if (op >> 12 == 0xD) {
+        span = op & 0xF;
+    } else if ((op & 0xF0FF) == 0xF033) {
+        span = 3;
+    } else if ((op & 0xF0FF) == 0xF055 || (op & 0xF0FF) == 0xF065) {
+        span = ((op >> 8) & 0xF) + 1;
+    }
+    bool outOfMemory = chip8->I + span > 0x1000;
+
+    Chip8Cycle(chip8);
+    MarkCovered(vm, address, chip8->PC);
+
+    uint32_t faults = 0;
+    if (!Chip8IsOpcode(op)) {
+        faults |= VMFAULT_OPCODE;
+    }
+    if (chip8->PC >= CHIP8_USERMEM_END) {
+        faults |= VMFAULT_PC;
+    }
+    if (chip8->SP != sp && chip8->SP >= CHIP8_STACK_MAX) {
+        faults |= op >> 12 == 0x2 ? VMFAULT_STACK_OVERFLOW :
+                                    VMFAULT_STACK_UNDERFLOW;
+    }
+    if (outOfMemory) {
+        faults |= VMFAULT_MEMORY;
+    }
+    if (faults) {
+        if (!vm->coverage->faults) {
+            vm->coverage->faultAddress = address;
+        }
+        vm->coverage->faults |= faults;
+    }
+    return faults != 0;
+}
+
+// Marks the instruction at address as executed, and the edge to next if it
+// did not carry on to the instruction after it.
+static inline void MarkCovered(VM *vm, uint16_t address, uint16_t next)
+{
+    VMCoverage *coverage = vm->coverage;
+
+    address &= 0xFFF;
+    next &= 0xFFF;
+    coverage->addresses[address / 8] |= (uint8_t)(1 << (address % 8));
+    if (next != address + 2) {
+        uint32_t edge =
+            ((uint32_t)address * 0x9E37u ^ next) & (VM_COVERAGE_EDGES - 1);
+        coverage->edges[edge / 8] |= (uint8_t)(1 << (edge % 8));
+    }
+}
+
+// 32-bit FNV-1a.
+static uint32_t HashBytes(const uint8_t *data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Returns the dirty bits of the blocks that differ between a and b.
+static uint64_t DiffBlocks(const Chip8 *a, const Chip8 *b)
+{
+    uint64_t blocks = 0;
+    for (int i = 0; i < CHIP8_DIRTY_BLOCKS; i++) {
+        size_t offset = (size_t)i * CHIP8_DIRTY_BLOCK_SIZE;
+        if (memcmp(a->memory + offset, b->memory + offset,
+                   CHIP8_DIRTY_BLOCK_SIZE) != 0) {
+            blocks |= (uint64_t)1 << i;
+        }
+    }
+    return blocks;
+}
+
+// Hashes CHIP8_DIRTY_BLOCK_SIZE bytes as 8 independent 64-bit lanes that are
+// only folded together at the end, so the lane loop vectorises.
+static uint64_t HashChunk(const uint8_t *data, uint64_t seed)
+{
+    static const uint64_t laneKeys[8] = {
+        0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull,
+        0xD6E8FEB86659FD93ull, 0xFF51AFD7ED558CCDull, 0xC4CEB9FE1A85EC53ull,
+        0x27D4EB2F165667C5ull, 0x94D049BB133111EBull,
+    };
+
+    uint64_t lanes[8];
+    for (int i = 0; i < 8; i++) {
+        uint64_t value;
+        memcpy(&value, data + i * 8, 8);
+        value ^= laneKeys[i] + seed;
+        lanes[i] = (value & 0xFFFFFFFF) * (value >> 32) + value;
+    }
+
+    uint64_t hash = seed;
+    for (int i = 0; i < 8; i++) {
+        hash = (hash ^ lanes[i]) * 0x9E3779B97F4A7C15ull;
+    }
+    return Mix64(hash);
+}
+
+// splitmix64 finaliser.
+static inline uint64_t Mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return x;
+}
\ No newline at end of file
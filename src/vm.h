@@ -3,12 +3,15 @@
 
 // Virtual Machine module.
 // Manages the entire CHIP8 system and provides a layer of abstraction for the
-// host application.
+// host application. Each VM is a separate machine with no state shared between
+// them, so any number can run side by side, one thread per VM at a time.
 
 #include "chip8.h"
 #include "def.h"
 
 #define VM_TICK_FREQUENCY 60
+// Max key transitions that can be scheduled ahead of the CPU.
+#define VM_KEY_QUEUE_LEN 64
 
 typedef enum {
     VMCOLOR_PALETTE_ORIGINAL,
@@ -25,32 +28,234 @@ typedef enum {
 
 typedef uint32_t VMColorPalette[2];
 
-// VMInit() - Initialises the CHIP-8 VM.
-void VMInit(int cyclesPerTick, VMColorPaletteType paletteType);
+typedef struct tVM VM;
+
+// Users of VMTakeDirtyBlocks(), each told about every write exactly once.
+typedef enum {
+    VMDIRTY_CONSUMER_REWIND,
+    VMDIRTY_CONSUMER_HASH_STATE,
+    VMDIRTY_CONSUMER_HASH_DISPLAY,
+    VMDIRTY_CONSUMER_MAX
+} VMDirtyConsumer;
+
+// Ways a program goes wrong, as bits of VMCoverage.faults.
+typedef enum {
+    // An instruction CHIP-8 does not have, 0nnn included.
+    VMFAULT_OPCODE = 1 << 0,
+    // PC left memory.
+    VMFAULT_PC = 1 << 1,
+    // 2nnn called deeper than the stack.
+    VMFAULT_STACK_OVERFLOW = 1 << 2,
+    // 00EE returned with the stack empty.
+    VMFAULT_STACK_UNDERFLOW = 1 << 3,
+    // Dxyn, Fx33, Fx55 or Fx65 reached past the end of memory from I.
+    VMFAULT_MEMORY = 1 << 4
+} VMFault;
+
+// Bits of VMCoverage.edges.
+#define VM_COVERAGE_EDGES 0x10000
+
+// What a VM executes while given to VMSetCoverage(), bits are only ever set.
+typedef struct tVMCoverage {
+    // Bit per address of the instructions executed.
+    uint8_t addresses[0x1000 / 8];
+    // Bit per jump, call, return and taken skip, hashed from the address it
+    // leaves and the one it lands on.
+    uint8_t edges[VM_COVERAGE_EDGES / 8];
+    // VMFault bits, and the address of the instruction that raised the first.
+    uint32_t faults;
+    uint16_t faultAddress;
+} VMCoverage;
+
+// Called whenever a key transition reaches the CPU, with the tick and the cycle
+// within it that it was applied before.
+typedef void (*VMKeyListener)(uint64_t tick, int cycle, uint8_t key,
+                              bool pressed, void *user);
+
+// Save states start with this magic and version. Bump the version whenever
+// the layout written by VMSaveState() changes.
+#define VM_STATE_MAGIC "CH8S"
+#define VM_STATE_VERSION 2
+// Upper bound of a save state in bytes, with a full key queue.
+#define VM_STATE_MAX_SIZE (4096 + VM_KEY_QUEUE_LEN * 12)
+// Granularity of VMStateDirtySpans().
+#define VM_STATE_SPAN_SIZE 64
+
+// VMCreate() - Creates a CHIP-8 VM. A seed of 0 seeds the rng from the current
+// time. Returns NULL on failure.
+VM *VMCreate(int cyclesPerTick, VMColorPaletteType paletteType,
+             unsigned int seed);
+
+// VMDestroy() - Frees a VM created by VMCreate().
+void VMDestroy(VM *vm);
+
+// VMGetSeed() - Returns the seed the rng started from, the one picked from the
+// time if VMCreate() was given 0.
+unsigned int VMGetSeed(VM *vm);
+
+// VMSetSeed() - Reseeds the rng, as VMCreate() would.
+void VMSetSeed(VM *vm, unsigned int seed);
 
 // VMLoadRom() - Loads a ROM from the given filepath into the CHIP8 system.
 // Returns 0 on success and -1 on failure.
-int VMLoadRom(const char *filePath);
+int VMLoadRom(VM *vm, const char *filePath);
+
+// VMLoadRomData() - Loads a ROM of size bytes from memory into the CHIP8
+// system. Returns 0 on success and -1 on failure.
+int VMLoadRomData(VM *vm, const uint8_t *data, size_t size);
 
 // VMTick() - Updates the CHIP-8 CPU and timers.
-void VMTick();
+void VMTick(VM *vm);
+
+// VMGetCyclesPerTick() - Returns the number of cycles run per tick.
+int VMGetCyclesPerTick(VM *vm);
+
+// VMGetTickCount() - Returns the number of ticks run since VMCreate(). Ticks
+// skipped while paused are not counted.
+uint64_t VMGetTickCount(VM *vm);
+
+// VMGetCycleCount() - Returns the number of instructions executed since
+// VMCreate(). Cycles spent waiting for a key are not counted.
+uint64_t VMGetCycleCount(VM *vm);
+
+// VMSetQuirks() - Sets the Chip8Quirk bits to emulate. Quirks are part of the
+// machine state: save states store them and VMHashState() includes them.
+void VMSetQuirks(VM *vm, uint32_t quirks);
+
+// VMGetQuirks() - Returns the Chip8Quirk bits being emulated.
+uint32_t VMGetQuirks(VM *vm);
+
+// VMParseQuirks() - Parses quirks given as a number or as comma separated
+// names, e.g. "shift-vy,load-store-i" or "none".
+// Returns 0 on success and -1 on failure.
+int VMParseQuirks(const char *str, uint32_t *quirks);
+
+// VMFormatQuirks() - Writes the names of the quirks, comma separated, or
+// "none", into buffer.
+void VMFormatQuirks(uint32_t quirks, char *buffer, size_t size);
+
+// VMGetRomHash() - Returns the FNV-1a hash of the loaded ROM.
+uint32_t VMGetRomHash(VM *vm);
+
+// VMHashState() - Returns a 64-bit hash of the whole VM state, used to check
+// that two runs ended up in the same place. Only the memory blocks written
+// since the last call are rehashed, so calling it every tick is cheap. Memory
+// is hashed as laid out in the host, so hashes only compare between builds on
+// the same byte order.
+uint64_t VMHashState(VM *vm);
+
+// VMHashMovieState() - Returns a hash of the VM state like VMHashState(), but
+// leaves out the pause state and the key transitions still queued, which a
+// movie does not record. Movies end on it so that a recording stopped while
+// paused or with keys queued still replays to the same hash.
+uint64_t VMHashMovieState(VM *vm);
+
+// VMHashMachine() - Returns a 64-bit hash of the CHIP-8 memory and registers
+// alone, updated the same way as VMHashState(). Unlike it, states reached at
+// different ticks hash the same, so it tells when a search reaches a state it
+// has seen before.
+uint64_t VMHashMachine(VM *vm);
+
+// VMHashDisplay() - Returns a 64-bit hash of the display alone, updated the
+// same way as VMHashState().
+uint64_t VMHashDisplay(VM *vm);
 
 // VMGetDisplayPixels() - Returns a pointer to the display memory from the CHIP-8.
-uint8_t *VMGetDisplayPixels();
+uint8_t *VMGetDisplayPixels(VM *vm);
+
+// VMPeek() - Returns the byte at an address of the CHIP-8, registers included.
+uint8_t VMPeek(VM *vm, uint16_t address);
 
 // VMGetSoundTimer() - Returns the CHIP-8 sound timer.
-int VMGetSoundTimer();
+int VMGetSoundTimer(VM *vm);
 
 // VMGetColorPalette() - Returns the color palette to use when presenting the CHIP-8 display.
-void VMGetColorPalette(VMColorPalette palette);
+void VMGetColorPalette(VM *vm, VMColorPalette palette);
 
 // VMSetKey() - Sets the key state to pressed and the waiting key register (if required).
-void VMSetKey(uint8_t key);
+void VMSetKey(VM *vm, uint8_t key);
 
 // VMClearKey() - Sets the key state to released.
-void VMClearKey(uint8_t key);
+void VMClearKey(VM *vm, uint8_t key);
+
+// VMScheduleKey() - Queues a key press or release to be applied part way
+// through a future tick. The whole part of tickOffset counts ticks from the
+// next VMTick() call and the fraction picks the cycle within that tick. Events
+// are applied in the order they were queued.
+void VMScheduleKey(VM *vm, uint8_t key, bool pressed, double tickOffset);
+
+// VMScheduleKeyAt() - Queues a key transition for an absolute tick and cycle,
+// as reported to a VMKeyListener. Used to replay recorded input.
+void VMScheduleKeyAt(VM *vm, uint8_t key, bool pressed, uint64_t tick,
+                     int cycle);
+
+// VMSetCoverage() - Sets where the instructions executed are recorded. The
+// coverage stays with the VM when a snapshot is restored. Pass NULL to stop.
+// While it is set a cycle that faults ends its tick early.
+void VMSetCoverage(VM *vm, VMCoverage *coverage);
+
+// VMSetKeyListener() - Sets the function told about every key transition as it
+// is applied. Pass NULL to remove it.
+void VMSetKeyListener(VM *vm, VMKeyListener listener, void *user);
+
+// VMTakeDirtyBlocks() - Returns the CHIP8_DIRTY_BLOCK_SIZE byte blocks of
+// CHIP-8 memory written since the consumer last asked, one bit per block, and
+// forgets them for that consumer. Loading a state or snapshot counts as writing
+// every block it changed.
+uint64_t VMTakeDirtyBlocks(VM *vm, VMDirtyConsumer consumer);
+
+// VMStateDirtySpans() - Maps dirty blocks to the VM_STATE_SPAN_SIZE byte spans
+// of a save state that may have changed with them, one bit per span. The spans
+// outside user memory are always included. Spans past the 64th have no bit and
+// must be treated as changed.
+uint64_t VMStateDirtySpans(uint64_t dirtyBlocks);
+
+// VMSnapshotSize() - Returns the size in bytes of a VM snapshot.
+size_t VMSnapshotSize();
+
+// VMTakeSnapshot() - Copies the whole VM state into buffer, which must hold
+// VMSnapshotSize() bytes. Meant for short lived in-process snapshots such as
+// run-ahead, the layout is not stable across builds.
+void VMTakeSnapshot(VM *vm, void *buffer);
+
+// VMRestoreSnapshot() - Restores the VM state from a buffer filled by
+// VMTakeSnapshot().
+void VMRestoreSnapshot(VM *vm, const void *buffer);
+
+// VMSaveState() - Serialises the VM into a versioned, endian independent save
+// state. Returns the number of bytes written, or 0 if the buffer is too small.
+// VM_STATE_MAX_SIZE bytes are always enough.
+size_t VMSaveState(VM *vm, void *buffer, size_t size);
+
+// VMLoadState() - Restores the VM from a save state. Returns 0 on success and
+// -1 if the state is malformed, from another version or from another ROM, in
+// which case the VM is left untouched.
+int VMLoadState(VM *vm, const void *buffer, size_t size);
+
+// VMSaveStateFile() - Writes a save state to the given filepath.
+// Returns 0 on success and -1 on failure.
+int VMSaveStateFile(VM *vm, const char *filePath);
+
+// VMLoadStateFile() - Loads a save state from the given filepath.
+// Returns 0 on success and -1 on failure.
+int VMLoadStateFile(VM *vm, const char *filePath);
 
 // VMTogglePause() - Toggles the pause state of the VM.
-void VMTogglePause(bool pause);
+void VMTogglePause(VM *vm, bool pause);
+
+// VMIsIdle() - Returns if the VM cannot make progress until it receives input.
+// That is while paused, or while waiting for a key with both timers stopped and
+// no key transitions scheduled.
+bool VMIsIdle(VM *vm);
+
+// VMGetIdleTicks() - Returns how many of the coming ticks the VM will spend
+// waiting, either for a key or in a loop that only polls the delay timer, up to
+// the next scheduled key transition. UINT64_MAX means it waits until it
+// receives input. Used with VMSkipTicks() to pass them at once.
+uint64_t VMGetIdleTicks(VM *vm);
+
+// VMSkipTicks() - Runs ticks idle ticks at once, leaving the VM as that many
+// VMTick() calls would. ticks must be at most VMGetIdleTicks().
+void VMSkipTicks(VM *vm, uint64_t ticks);
 
 #endif // CHIP8_VM_H
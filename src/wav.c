@@ -0,0 +1,109 @@
+#include "wav.h"
+
+#define WAV_HEADER_SIZE 44
+
+static void PutU16(uint8_t *dst, uint16_t val)
+{
+    dst[0] = val & 0xFF;
+    dst[1] = (val >> 8) & 0xFF;
+}
+
+static void PutU32(uint8_t *dst, uint32_t val)
+{
+    PutU16(dst, val & 0xFFFF);
+    PutU16(dst + 2, (val >> 16) & 0xFFFF);
+}
+
+static int WriteHeader(WavWriter *writer)
+{
+    uint32_t dataSize = writer->sampleCount * 2;
+    uint8_t header[WAV_HEADER_SIZE];
+
+    memcpy(header, "RIFF", 4);
+    PutU32(header + 4, 36 + dataSize);
+    memcpy(header + 8, "WAVE", 4);
+    memcpy(header + 12, "fmt ", 4);
+    PutU32(header + 16, 16);
+    // PCM, mono, 16 bits per sample.
+    PutU16(header + 20, 1);
+    PutU16(header + 22, 1);
+    PutU32(header + 24, writer->sampleRate);
+    PutU32(header + 28, writer->sampleRate * 2);
+    PutU16(header + 32, 2);
+    PutU16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    PutU32(header + 40, dataSize);
+
+    if (fseek(writer->file, 0L, SEEK_SET) != 0 ||
+        fwrite(header, 1, sizeof(header), writer->file) != sizeof(header)) {
+        return -1;
+    }
+    return 0;
+}
+
+int WavWriterOpen(WavWriter *writer, const char *filePath, int sampleRate)
+{
+    assert(writer != NULL);
+    assert(filePath != NULL);
+
+    writer->sampleRate = sampleRate;
+    writer->sampleCount = 0;
+    writer->file = fopen(filePath, "wb");
+    if (!writer->file) {
+        fprintf(stderr, "Failed to fopen() wav file at %s!\n", filePath);
+        return -1;
+    }
+
+    if (WriteHeader(writer) != 0) {
+        fprintf(stderr, "Failed to write wav header to %s!\n", filePath);
+        fclose(writer->file);
+        writer->file = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+int WavWriterWrite(WavWriter *writer, const int16_t *samples, int sampleCount)
+{
+    assert(writer != NULL && writer->file != NULL);
+
+    // Samples are converted to little endian in chunks so the output does not
+    // depend on the host byte order.
+    uint8_t bytes[1024];
+    int chunkLen = sizeof(bytes) / 2;
+
+    for (int i = 0; i < sampleCount; i += chunkLen) {
+        int n = MIN(chunkLen, sampleCount - i);
+        for (int j = 0; j < n; j++) {
+            PutU16(bytes + j * 2, (uint16_t)samples[i + j]);
+        }
+        if (fwrite(bytes, 2, n, writer->file) != (size_t)n) {
+            fprintf(stderr, "Failed to write wav samples!\n");
+            return -1;
+        }
+    }
+
+    writer->sampleCount += sampleCount;
+    return 0;
+}
+
+int WavWriterClose(WavWriter *writer)
+{
+    assert(writer != NULL);
+
+    if (!writer->file) {
+        return -1;
+    }
+
+    int result = WriteHeader(writer);
+    if (fclose(writer->file) != 0) {
+        result = -1;
+    }
+    writer->file = NULL;
+
+    if (result != 0) {
+        fprintf(stderr, "Failed to finalize wav file!\n");
+    }
+    return result;
+}
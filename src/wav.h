@@ -0,0 +1,27 @@
+#ifndef CHIP8_WAV_H
+#define CHIP8_WAV_H
+
+// WAV module.
+// Writes 16-bit mono PCM samples to a RIFF/WAVE file.
+
+#include "def.h"
+
+typedef struct tWavWriter {
+    FILE *file;
+    int sampleRate;
+    uint32_t sampleCount;
+} WavWriter;
+
+// WavWriterOpen() - Creates the file at filePath and writes a placeholder
+// header. Returns 0 on success and -1 on failure.
+int WavWriterOpen(WavWriter *writer, const char *filePath, int sampleRate);
+
+// WavWriterWrite() - Appends sampleCount samples to the file.
+// Returns 0 on success and -1 on failure.
+int WavWriterWrite(WavWriter *writer, const int16_t *samples, int sampleCount);
+
+// WavWriterClose() - Patches the header with the final sizes and closes the
+// file. Returns 0 on success and -1 on failure.
+int WavWriterClose(WavWriter *writer);
+
+#endif // CHIP8_WAV_H